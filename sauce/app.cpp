@@ -1,5 +1,6 @@
 #include "app.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
@@ -19,14 +20,18 @@
 #include "update/update.h"
 
 namespace VV {
-Result handle_args(int argv, const char **argc,
-                   std::optional<u32> &world_seed) {
-  if (argv < 1 || argv > 2) {
+// voyages-and-verve [seed] [--pregen|--preview x0 y0 x1 y1]
+// The seed is hex. --pregen and --preview take a chunk rectangle and need a
+// seed.
+Result handle_args(int argv, const char **argc, std::optional<u32> &world_seed,
+                   std::optional<Pregen_Request> &pregen,
+                   std::optional<World_Preview_Request> &preview) {
+  if (argv != 1 && argv != 2 && argv != 7) {
     LOG_WARN("Bad number of args {}", argv);
     return Result::BAD_ARGS_ERROR;
   }
 
-  if (argv == 2) {
+  if (argv >= 2) {
     try {
       size_t num_chars = 0;
       u32 stoul_res = std::stoul(argc[1], &num_chars, 16);
@@ -44,6 +49,33 @@ Result handle_args(int argv, const char **argc,
     }
   }
 
+  if (argv == 7) {
+    bool is_pregen = std::strcmp(argc[2], "--pregen") == 0;
+    if (!is_pregen && std::strcmp(argc[2], "--preview") != 0) {
+      LOG_WARN("Unknown argument {}", argc[2]);
+      return Result::BAD_ARGS_ERROR;
+    }
+
+    s32 rect[4];
+    for (int i = 0; i < 4; i++) {
+      try {
+        rect[i] = std::stoi(argc[3 + i]);
+      } catch (const std::exception &e) {
+        LOG_WARN("Couldn't convert {} argument {} to a chunk coord: {}",
+                 argc[2], argc[3 + i], e.what());
+        return Result::BAD_ARGS_ERROR;
+      }
+    }
+
+    Chunk_Coord min = {std::min(rect[0], rect[2]), std::min(rect[1], rect[3])};
+    Chunk_Coord max = {std::max(rect[0], rect[2]), std::max(rect[1], rect[3])};
+    if (is_pregen) {
+      pregen = Pregen_Request{world_seed.value(), min, max};
+    } else {
+      preview = World_Preview_Request{world_seed.value(), min, max};
+    }
+  }
+
   return Result::SUCCESS;
 }
 
@@ -110,14 +142,21 @@ Result init_app(App &app, int argv, const char **argc) {
   }
 
   app.config.tex_dir = app.config.res_dir / "textures";
+  app.config.save_dir = app.config.res_dir.parent_path() / "saves";
 
   std::optional<u32> world_seed;
-  Result args_res = handle_args(argv, argc, world_seed);
+  Result args_res =
+      handle_args(argv, argc, world_seed, app.pregen, app.preview);
   if (args_res == Result::BAD_ARGS_ERROR) {
     LOG_FATAL("Argument handling failed. Exiting.");
     return args_res;
   }
 
+  // Headless. Nothing else gets initialized
+  if (app.pregen.has_value() || app.preview.has_value()) {
+    return Result::SUCCESS;
+  }
+
   Result update_res = init_updating(app.update_state, app.config, world_seed);
   if (update_res != Result::SUCCESS) {
     LOG_FATAL("Failed to initialize updater. Exiting.");
@@ -137,6 +176,12 @@ Result init_app(App &app, int argv, const char **argc) {
 }
 
 Result run_app(App &app) {
+  if (app.pregen.has_value()) {
+    return pregen_world(app.config, app.pregen.value());
+  } else if (app.preview.has_value()) {
+    return preview_world(app.config, app.preview.value());
+  }
+
   std::deque<double> frame_times;
   const size_t max_frame_history = 20;
 
@@ -196,6 +241,10 @@ Result run_app(App &app) {
 }
 
 void destroy_app(App &app) {
+  if (app.pregen.has_value() || app.preview.has_value()) {
+    return;
+  }
+
   destroy_rendering(app.render_state);
   destroy_update(app.update_state);
 }
@@ -2,6 +2,8 @@
 
 #include "core.h"
 #include "render/render.h"
+#include "update/pregen.h"
+#include "update/preview.h"
 #include "update/update.h"
 #include "utils/config.h"
 
@@ -13,6 +15,12 @@ struct App {
   Update_State update_state;
   Render_State render_state;
   Config config;
+
+  // Set by --pregen. The app runs headless and exits instead of starting the
+  // game.
+  std::optional<Pregen_Request> pregen;
+  // Set by --preview. Also headless.
+  std::optional<World_Preview_Request> preview;
 };
 
 Result poll_events(App &app);
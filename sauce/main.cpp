@@ -15,10 +15,10 @@ int main(int argv, const char** argc) {
     destroy_app(*app);
     return EXIT_FAILURE;
   }
-  run_app(*app);
+  Result run_res = run_app(*app);
   destroy_app(*app);
 
   delete app;
 
-  return EXIT_SUCCESS;
+  return run_res == Result::SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,5 +1,6 @@
 #include "render/render.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <regex>
 #include <sstream>
@@ -130,6 +131,17 @@ Result init_rendering(Render_State &render_state, Update_State &us,
 
   LOG_INFO("Created cell texture");
 
+  SDL_ClearError();
+  render_state.minimap_texture = SDL_CreateTexture(
+      render_state.renderer, SDL_PIXELFORMAT_RGBA8888,
+      SDL_TEXTUREACCESS_STREAMING, HUD_MINIMAP_TEXELS, HUD_MINIMAP_TEXELS);
+  if (render_state.minimap_texture == nullptr) {
+    LOG_ERROR("Failed to create minimap texture with SDL: {}", SDL_GetError());
+    return Result::SDL_ERROR;
+  }
+
+  SDL_SetTextureBlendMode(render_state.minimap_texture, SDL_BLENDMODE_BLEND);
+
   // Create the rest of the textures from resources
 
   Result render_tex_res = init_render_textures(render_state, config);
@@ -161,25 +173,16 @@ Result init_rendering(Render_State &render_state, Update_State &us,
 Result render(Render_State &render_state, Update_State &update_state,
               const Config &config) {
   static u64 frame = 0;
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
 
   if (update_state.events.find(Update_Event::PLAYER_MOVED_CHUNK) ==
       update_state.events.end()) {
     f64 player_x = active_player.coord.x + active_player.camx;
     f64 player_y = active_player.coord.y + active_player.camy;
-    if (player_x < NICARAGUA_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH) {
-      render_state.biome = Biome::NICARAGUA;
-    } else if (player_x < FOREST_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH) {
-      render_state.biome = Biome::FOREST;
-    } else if (player_x < ALASKA_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH) {
-      render_state.biome = Biome::ALASKA;
-    } else {
-      if (player_y < DEEP_SEA_LEVEL_CELL) {
-        render_state.biome = Biome::DEEP_OCEAN;
-      } else {
-        render_state.biome = Biome::OCEAN;
-      }
-    }
+    render_state.biome =
+        get_ambient_biome(*get_active_dimension(update_state),
+                          static_cast<s64>(player_x),
+                          static_cast<s64>(player_y));
   }
 
   // music stuff
@@ -307,6 +310,11 @@ void destroy_rendering(Render_State &render_state) {
     LOG_INFO("Destroyed cell texture");
   }
 
+  if (render_state.minimap_texture != nullptr) {
+    SDL_DestroyTexture(render_state.minimap_texture);
+    LOG_INFO("Destroyed minimap texture");
+  }
+
   for (const std::pair<const u8, Res_Texture> &pair : render_state.textures) {
     SDL_DestroyTexture(pair.second.texture);
   }
@@ -491,7 +499,7 @@ Result gen_world_texture(Render_State &render_state, Update_State &update_state,
   // probably multithread.
   // TODO: multithread
 
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
 
   // Remember, Entity::cam is relative to the entity's position
   f64 camx, camy;
@@ -558,6 +566,9 @@ Result gen_world_texture(Render_State &render_state, Update_State &update_state,
       }
 #endif
 
+      s64 chunk_cell_x = static_cast<s64>(ic.x) * CHUNK_CELL_WIDTH;
+      s64 chunk_cell_y = static_cast<s64>(ic.y) * CHUNK_CELL_WIDTH;
+
       // assert(chunk.coord == ic);
       // if (chunk.cells[0].type == Cell_Type::AIR) {
       //   LOG_DEBUG("Chunk %d, %d is a air chunk", ic.x, ic.y);
@@ -588,12 +599,14 @@ Result gen_world_texture(Render_State &render_state, Update_State &update_state,
 #endif
 
           size_t cell_index = cell_x + cell_y * CHUNK_CELL_WIDTH;
-          const Cell &cell = chunk.cells[cell_index];
+          const Cell_Palette_Color &color =
+              get_cell_color(chunk.cells[cell_index].type,
+                             chunk_cell_x + cell_x, chunk_cell_y + cell_y);
 
-          cr = cell.cr;
-          cg = cell.cg;
-          cb = cell.cb;
-          ca = cell.ca;
+          cr = color.r;
+          cg = color.g;
+          cb = color.b;
+          ca = color.a;
 
           if (ic.x >= ALASKA_EAST_BORDER_CHUNK) {
             const s64 BONUS_DEEP_OCEAN_DEPTH = -30 * CHUNK_CELL_WIDTH;
@@ -654,9 +667,10 @@ Result gen_world_texture(Render_State &render_state, Update_State &update_state,
 Result refresh_debug_overlay(Render_State &render_state,
                              const Update_State &update_state, int &w, int &h) {
   f64 x, y;
-  x = update_state.entities[update_state.active_player].coord.x;
-  y = update_state.entities[update_state.active_player].coord.y;
-  u8 status = update_state.entities[update_state.active_player].status;
+  Entity active_player = update_state.entities.load(update_state.active_player);
+  x = active_player.coord.x;
+  y = active_player.coord.y;
+  u8 status = active_player.status;
 
   // Create a stringstream
   std::stringstream debug_info_stream;
@@ -668,12 +682,19 @@ Result refresh_debug_overlay(Render_State &render_state,
   // Reset stream format for other types
   debug_info_stream << std::setprecision(0);
 
-  debug_info_stream
-      << " | Dimension id: "
-      << static_cast<unsigned>(update_state.active_dimension)
-      << " Chunks loaded in dim "
-      << update_state.dimensions.at(update_state.active_dimension).chunks.size()
-      << " | Player pos: ";
+  const Dimension &active_dimension =
+      update_state.dimensions.at(update_state.active_dimension);
+  debug_info_stream << " | Dimension id: "
+                    << static_cast<unsigned>(update_state.active_dimension)
+                    << " Chunks loaded in dim "
+                    << active_dimension.chunks.size() << " ("
+                    << get_resident_chunk_bytes(active_dimension) / 1024
+                    << " KiB)"
+                    << " Entities " << update_state.entity_id_pool.size()
+                    << " ("
+                    << update_state.entity_id_pool.occupancy() * 100.0f
+                    << "% of cap)"
+                    << " | Player pos: ";
 
   // Set precision for player position
   debug_info_stream << std::fixed << std::setprecision(2) << x << ", " << y;
@@ -724,7 +745,7 @@ Result render_trees(Render_State &rs, Update_State &us) {
 
 Result render_cell_texture(Render_State &render_state,
                            Update_State &update_state) {
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
 
   u16 screen_cell_size = render_state.screen_cell_size;
 
@@ -765,13 +786,112 @@ Result render_cell_texture(Render_State &render_state,
   return Result::SUCCESS;
 }
 
+void render_entity(Render_State &render_state, Entity_Ref entity,
+                   const Entity_Coord &tl) {
+  static std::set<Texture_Id> suppressed_id_warns;
+  u16 screen_cell_size = render_state.screen_cell_size;
+
+  auto sdk_texture =
+      render_state.textures.find(static_cast<u8>(entity.texture));
+
+  if (sdk_texture == render_state.textures.end()) {
+    if (suppressed_id_warns.find(entity.texture) !=
+        suppressed_id_warns.end()) {
+      LOG_WARN("Entity wants texture {} which isn't loaded!",
+               (u8)entity.texture);
+      suppressed_id_warns.insert(entity.texture);
+    }
+  } else {
+    // Now it's time to render!
+
+    Res_Texture &texture = sdk_texture->second;
+
+    // LOG_DEBUG("entity coord: {} {}", entity.coord.x, entity.coord.y);
+    // LOG_DEBUG("tl: {} {}", tl.x, tl.y);
+
+    Entity_Coord world_offset;
+    world_offset.x = entity.coord.x - tl.x;
+    world_offset.y = tl.y - entity.coord.y;
+
+    // LOG_DEBUG("World offset: {} {}", world_offset.x, world_offset.y);
+
+    // TODO: No booleans! Maybe a separate animated entity collection in
+    // dimension?
+    //
+    // TODO: Also need to account for a full sprite sheet. Have y indexes be
+    // different states? i.e. walking anim, jumping, idle, etc.
+    if (entity.status & (u8)Entity_Status::ANIMATED) {
+      if (world_offset.x >= -entity.anim_width &&
+          world_offset.x <= SCREEN_CELL_SIZE_FULL - SCREEN_CELL_PADDING +
+                                entity.anim_width &&
+          world_offset.y >= -texture.height &&
+          world_offset.y <= static_cast<s32>(render_state.window_height /
+                                             render_state.screen_cell_size) +
+                                texture.height) {
+        SDL_Rect src_rect = {
+            entity.anim_width * entity.anim_current_frame, 0,
+            entity.anim_width * (entity.anim_current_frame + 1),
+            texture.height};
+
+        SDL_Rect dest_rect = {
+            (int)(world_offset.x * render_state.screen_cell_size),
+            (int)(world_offset.y * render_state.screen_cell_size),
+            entity.anim_width * screen_cell_size,
+            texture.height * screen_cell_size};
+
+        if (entity.flipped) {
+          SDL_RenderCopyEx(render_state.renderer, texture.texture, &src_rect,
+                           &dest_rect, 0, NULL, SDL_FLIP_HORIZONTAL);
+        } else {
+          SDL_RenderCopy(render_state.renderer, texture.texture, &src_rect,
+                         &dest_rect);
+        }
+      }
+
+      if (entity.anim_timer >
+          entity.anim_delay + entity.anim_delay_current_spice) {
+        entity.anim_current_frame = (entity.anim_current_frame + 1) %
+                                    (texture.width / entity.anim_width);
+        entity.anim_timer = 0;
+        if (entity.anim_delay_variety > 0) {
+          entity.anim_delay_current_spice =
+              rand() % entity.anim_delay_variety;
+        }
+      }
+      entity.anim_timer++;
+    } else {
+      // If visable
+      if (world_offset.x >= -texture.width &&
+          world_offset.x <=
+              SCREEN_CELL_SIZE_FULL - SCREEN_CELL_PADDING + texture.width &&
+          world_offset.y >= -texture.height &&
+          world_offset.y <= static_cast<s32>(render_state.window_height /
+                                             render_state.screen_cell_size) +
+                                texture.height) {
+        SDL_Rect dest_rect = {
+            (int)(world_offset.x * render_state.screen_cell_size),
+            (int)(world_offset.y * render_state.screen_cell_size),
+            texture.width * screen_cell_size,
+            texture.height * screen_cell_size};
+
+        if (entity.flipped) {
+          SDL_RenderCopyEx(render_state.renderer, texture.texture, NULL,
+                           &dest_rect, 0, NULL, SDL_FLIP_HORIZONTAL);
+        } else {
+          SDL_RenderCopy(render_state.renderer, texture.texture, NULL,
+                         &dest_rect);
+        }
+      }
+    }
+  }
+}
+
 Result render_entities(Render_State &render_state, Update_State &update_state,
                        Entity_Z z_min, Entity_Z z_thresh) {
   Dimension &active_dimension = *get_active_dimension(update_state);
-  static std::set<Texture_Id> suppressed_id_warns;
 
   u16 screen_cell_size = render_state.screen_cell_size;
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
 
   Entity_Coord tl;
   tl.x = active_player.camx + active_player.coord.x;
@@ -780,112 +900,39 @@ Result render_entities(Render_State &render_state, Update_State &update_state,
   tl.y = active_player.camy + active_player.coord.y;
   tl.y += (render_state.window_height / 2.0f) / screen_cell_size;
 
-  for (const auto &[z, entity_index] : active_dimension.e_render) {
-    if (z > z_thresh || z < z_min) {
+  // Only entities around the screen are drawn. They're sorted back into the
+  // registry's order so the ones on the same layer stay stacked the same way.
+  Entity_Coord min = {tl.x - ENTITY_CULL_MARGIN,
+                      tl.y - static_cast<f64>(render_state.window_height) /
+                                 screen_cell_size};
+  Entity_Coord max = {tl.x + static_cast<f64>(render_state.window_width) /
+                                 screen_cell_size,
+                      tl.y + ENTITY_CULL_MARGIN};
+  std::vector<Entity_ID> visible;
+  find_entities_in_box(update_state, active_dimension, min, max, visible);
+
+  std::vector<std::pair<u64, Entity_ID>> draws;
+  draws.reserve(visible.size());
+  for (Entity_ID id : visible) {
+    if (!active_dimension.e_render.contains(id)) {
       continue;
     }
-    Entity &entity = update_state.entities[entity_index];
-
-    auto sdk_texture =
-        render_state.textures.find(static_cast<u8>(entity.texture));
-
-    if (sdk_texture == render_state.textures.end()) {
-      if (suppressed_id_warns.find(entity.texture) !=
-          suppressed_id_warns.end()) {
-        LOG_WARN("Entity wants texture {} which isn't loaded!",
-                 (u8)entity.texture);
-        suppressed_id_warns.insert(entity.texture);
-      }
-    } else {
-      // Now it's time to render!
-
-      Res_Texture &texture = sdk_texture->second;
-
-      // LOG_DEBUG("entity coord: {} {}", entity.coord.x, entity.coord.y);
-      // LOG_DEBUG("tl: {} {}", tl.x, tl.y);
-
-      Entity_Coord world_offset;
-      world_offset.x = entity.coord.x - tl.x;
-      world_offset.y = tl.y - entity.coord.y;
-
-      // LOG_DEBUG("World offset: {} {}", world_offset.x, world_offset.y);
-
-      // TODO: No booleans! Maybe a separate animated entity collection in
-      // dimension?
-      //
-      // TODO: Also need to account for a full sprite sheet. Have y indexes be
-      // different states? i.e. walking anim, jumping, idle, etc.
-      if (entity.status & (u8)Entity_Status::ANIMATED) {
-        if (world_offset.x >= -entity.anim_width &&
-            world_offset.x <= SCREEN_CELL_SIZE_FULL - SCREEN_CELL_PADDING +
-                                  entity.anim_width &&
-            world_offset.y >= -texture.height &&
-            world_offset.y <= static_cast<s32>(render_state.window_height /
-                                               render_state.screen_cell_size) +
-                                  texture.height) {
-          SDL_Rect src_rect = {
-              entity.anim_width * entity.anim_current_frame, 0,
-              entity.anim_width * (entity.anim_current_frame + 1),
-              texture.height};
-
-          SDL_Rect dest_rect = {
-              (int)(world_offset.x * render_state.screen_cell_size),
-              (int)(world_offset.y * render_state.screen_cell_size),
-              entity.anim_width * screen_cell_size,
-              texture.height * screen_cell_size};
-
-          if (entity.flipped) {
-            SDL_RenderCopyEx(render_state.renderer, texture.texture, &src_rect,
-                             &dest_rect, 0, NULL, SDL_FLIP_HORIZONTAL);
-          } else {
-            SDL_RenderCopy(render_state.renderer, texture.texture, &src_rect,
-                           &dest_rect);
-          }
-        }
-
-        if (entity.anim_timer >
-            entity.anim_delay + entity.anim_delay_current_spice) {
-          entity.anim_current_frame = (entity.anim_current_frame + 1) %
-                                      (texture.width / entity.anim_width);
-          entity.anim_timer = 0;
-          if (entity.anim_delay_variety > 0) {
-            entity.anim_delay_current_spice =
-                rand() % entity.anim_delay_variety;
-          }
-        }
-        entity.anim_timer++;
-      } else {
-        // If visable
-        if (world_offset.x >= -texture.width &&
-            world_offset.x <=
-                SCREEN_CELL_SIZE_FULL - SCREEN_CELL_PADDING + texture.width &&
-            world_offset.y >= -texture.height &&
-            world_offset.y <= static_cast<s32>(render_state.window_height /
-                                               render_state.screen_cell_size) +
-                                  texture.height) {
-          SDL_Rect dest_rect = {
-              (int)(world_offset.x * render_state.screen_cell_size),
-              (int)(world_offset.y * render_state.screen_cell_size),
-              texture.width * screen_cell_size,
-              texture.height * screen_cell_size};
-
-          if (entity.flipped) {
-            SDL_RenderCopyEx(render_state.renderer, texture.texture, NULL,
-                             &dest_rect, 0, NULL, SDL_FLIP_HORIZONTAL);
-          } else {
-            SDL_RenderCopy(render_state.renderer, texture.texture, NULL,
-                           &dest_rect);
-          }
-        }
-      }
+    Entity_Z z = active_dimension.e_render.get_z(id);
+    if (z >= z_min && z <= z_thresh) {
+      draws.push_back({active_dimension.e_render.get_draw_order(id), id});
     }
   }
+  std::sort(draws.begin(), draws.end());
+
+  for (const auto &[order, id] : draws) {
+    render_entity(render_state, update_state.entities[id], tl);
+  }
 
   return Result::SUCCESS;
 }
 
 Result render_hud(Render_State &render_state, Update_State &update_state) {
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
 
   // Draw active player health bar
   // First a black background
@@ -917,6 +964,75 @@ Result render_hud(Render_State &render_state, Update_State &update_state) {
                          disp_health_width, BAR_HEIGHT - (HEALTH_MARGIN * 2)};
   SDL_RenderFillRect(render_state.renderer, &health_bar);
 
+  // Minimap under the health bar
+  Chunk_Coord player_chunk =
+      get_chunk_coord(active_player.coord.x, active_player.coord.y);
+  Result minimap_res = fill_minimap_texture(
+      render_state, *get_active_dimension(update_state), player_chunk);
+  if (minimap_res != Result::SUCCESS) {
+    return minimap_res;
+  }
+
+  const int MINIMAP_SIZE = HUD_MINIMAP_TEXELS * 2;
+  SDL_Rect minimap_rect = {
+      render_state.window_width - MINIMAP_SIZE - BAR_MARGIN,  // x position
+      BAR_MARGIN * 2 + BAR_HEIGHT,                            // y position
+      MINIMAP_SIZE, MINIMAP_SIZE};
+  SDL_SetRenderDrawColor(render_state.renderer, 0x33, 0x33, 0x33, 0xFF);
+  SDL_RenderFillRect(render_state.renderer, &minimap_rect);
+  SDL_RenderCopy(render_state.renderer, render_state.minimap_texture, NULL,
+                 &minimap_rect);
+
+  return Result::SUCCESS;
+}
+
+Result fill_minimap_texture(Render_State &render_state, const Dimension &dim,
+                            const Chunk_Coord &center) {
+  constexpr u16 TILES = HUD_MINIMAP_TEXELS / MINIMAP_TILE_WIDTH;
+  constexpr s32 TILE_CHUNKS = 1 << HUD_MINIMAP_LEVEL;
+
+  u32 *pixels;
+  int pitch;
+  SDL_ClearError();
+  if (SDL_LockTexture(render_state.minimap_texture, NULL, (void **)&pixels,
+                      &pitch) != 0) {
+    LOG_WARN("Failed to lock minimap texture for updating: {}",
+             SDL_GetError());
+    return Result::SDL_ERROR;
+  }
+
+  const u32 PITCH = pitch / sizeof(u32);
+  Chunk_Coord bl = {center.x - (TILES / 2) * TILE_CHUNKS,
+                    center.y - (TILES / 2) * TILE_CHUNKS};
+
+  for (u16 tile_y = 0; tile_y < TILES; tile_y++) {
+    for (u16 tile_x = 0; tile_x < TILES; tile_x++) {
+      const Minimap_Tile *tile = get_minimap_tile(
+          dim.minimap, HUD_MINIMAP_LEVEL,
+          {bl.x + tile_x * TILE_CHUNKS, bl.y + tile_y * TILE_CHUNKS});
+
+      for (u16 texel_y = 0; texel_y < MINIMAP_TILE_WIDTH; texel_y++) {
+        // Tiles are bottom row first and the texture is top row first
+        u32 *row = pixels + (HUD_MINIMAP_TEXELS - 1 -
+                             (tile_y * MINIMAP_TILE_WIDTH + texel_y)) *
+                                PITCH +
+                   tile_x * MINIMAP_TILE_WIDTH;
+        for (u16 texel_x = 0; texel_x < MINIMAP_TILE_WIDTH; texel_x++) {
+          if (tile == nullptr) {
+            row[texel_x] = 0;
+            continue;
+          }
+
+          const Cell_Palette_Color &color =
+              tile->texels[texel_y * MINIMAP_TILE_WIDTH + texel_x];
+          row[texel_x] =
+              (color.r << 24) | (color.g << 16) | (color.b << 8) | color.a;
+        }
+      }
+    }
+  }
+
+  SDL_UnlockTexture(render_state.minimap_texture);
   return Result::SUCCESS;
 }
 }  // namespace VV
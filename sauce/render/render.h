@@ -18,6 +18,11 @@ constexpr u8 SCREEN_CHUNK_SIZE =
 constexpr u8 SCREEN_CELL_PADDING = 160;  // Makes screen width 352 cells
 constexpr u16 SCREEN_CELL_SIZE_FULL = SCREEN_CHUNK_SIZE * CHUNK_CELL_WIDTH;
 
+// The hud minimap draws tiles from this level of the pyramid, so each texel is
+// 32 cells and the whole thing is 64 chunks across
+constexpr u8 HUD_MINIMAP_LEVEL = 2;
+constexpr u16 HUD_MINIMAP_TEXELS = 128;
+
 struct Render_State {
   int window_width, window_height;
 
@@ -40,6 +45,7 @@ struct Render_State {
   std::map<u8, Res_Texture>
       textures;  // This mapping should be the same as in resources.json
   SDL_Texture *debug_overlay_texture;
+  SDL_Texture *minimap_texture;
 
   std::vector<SDL_Event> pending_events;
 
@@ -68,9 +74,21 @@ Result refresh_debug_overlay(Render_State &render_state,
 // Result render_trees(Render_State &rs, Update_State &us);
 Result render_cell_texture(Render_State &render_state,
                            Update_State &update_state);
+// Draws the entity if it's on screen. tl is the world coord at the top left of
+// the screen.
+//
+// Sprites hang down and to the right of the entity's coord, so entities up to
+// this far above or left of the screen can still show. The biggest is about
+// 120 cells.
+constexpr f64 ENTITY_CULL_MARGIN = 2 * CHUNK_CELL_WIDTH;
+void render_entity(Render_State &render_state, Entity_Ref entity,
+                   const Entity_Coord &tl);
 Result render_entities(Render_State &render_state, Update_State &update_state,
                        Entity_Z z_min = 1, Entity_Z z_thresh = INT8_MAX);
 
 Result render_hud(Render_State &render_state, Update_State &update_state);
+// Copies the minimap tiles around center into the minimap texture
+Result fill_minimap_texture(Render_State &render_state, const Dimension &dim,
+                            const Chunk_Coord &center);
 
 }  // namespace VV
@@ -24,10 +24,138 @@ Entity default_entity() {
   return return_entity;
 }
 
-Entity_Coord get_cam_coord(const Entity &e) {
+bool string_to_entity_factory_type(const std::string &name,
+                                   Entity_Factory_Type &type) {
+  if (name == "guyplayer") {
+    type = Entity_Factory_Type::GUYPLAYER;
+  } else if (name == "tree") {
+    type = Entity_Factory_Type::TREE;
+  } else if (name == "bush") {
+    type = Entity_Factory_Type::BUSH;
+  } else if (name == "grass") {
+    type = Entity_Factory_Type::GRASS;
+  } else if (name == "nietzsche") {
+    type = Entity_Factory_Type::NIETZSCHE;
+  } else if (name == "aknietzsche") {
+    type = Entity_Factory_Type::AKNIETZSCHE;
+  } else if (name == "ecnietzsche") {
+    type = Entity_Factory_Type::ECNIETZSCHE;
+  } else if (name == "sdnietzsche") {
+    type = Entity_Factory_Type::SDNIETZSCHE;
+  } else if (name == "jellyfish") {
+    type = Entity_Factory_Type::JELLYFISH;
+  } else if (name == "seaweed") {
+    type = Entity_Factory_Type::SEAWEED;
+  } else if (name == "fish") {
+    type = Entity_Factory_Type::FISH;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+Entity_Coord get_cam_coord(const Entity_Ref &e) {
   return {
       e.coord.x + e.camx,  // x
       e.coord.y + e.camy   // y
   };
 }
+
+void Entity_Storage::add(Entity_ID id) {
+  size_t page_index = id / ENTITY_PAGE_SIZE;
+  if (page_index >= pages.size()) {
+    pages.resize(page_index + 1);
+  }
+
+  std::unique_ptr<Entity_Page> &page = pages[page_index];
+  if (page == nullptr) {
+    page = std::make_unique<Entity_Page>();
+    allocated_pages++;
+  }
+
+  page->live++;
+  store(id, default_entity());
+}
+
+void Entity_Storage::remove(Entity_ID id) {
+  std::unique_ptr<Entity_Page> &page = pages[id / ENTITY_PAGE_SIZE];
+  page->live--;
+  if (page->live == 0) {
+    page.reset();
+    allocated_pages--;
+  }
+}
+
+void Entity_Storage::store(Entity_ID id, const Entity &e) {
+  Entity_Page &page = get_page(id);
+  u32 slot = get_entity_page_slot(id);
+  page.coord[slot] = e.coord;
+  page.vx[slot] = e.vx;
+  page.vy[slot] = e.vy;
+  page.ax[slot] = e.ax;
+  page.ay[slot] = e.ay;
+  page.status[slot] = e.status;
+  page.bouyancy[slot] = e.bouyancy;
+  page.boundingw[slot] = e.boundingw;
+  page.boundingh[slot] = e.boundingh;
+  page.cold[slot] = e;
+}
+
+Entity Entity_Storage::load(Entity_ID id) const {
+  const Entity_Page &page = get_page(id);
+  u32 slot = get_entity_page_slot(id);
+  return {page.cold[slot],      page.coord[slot],     page.vx[slot],
+          page.vy[slot],        page.ax[slot],        page.ay[slot],
+          page.status[slot],    page.bouyancy[slot],  page.boundingw[slot],
+          page.boundingh[slot]};
+}
+
+Result Entity_ID_Pool::take(Entity_ID &id) {
+  if (!free_ids.empty()) {
+    id = free_ids.back();
+    free_ids.pop_back();
+  } else if (next_fresh < capacity) {
+    id = next_fresh++;
+    generations.resize(next_fresh, 0);
+    in_use_flags.resize(next_fresh, false);
+  } else {
+    LOG_WARN("Failed to get entity id. Pool full.");
+    return Result::ENTITY_POOL_FULL;
+  }
+
+  in_use_flags[id] = true;
+  used++;
+  return Result::SUCCESS;
+}
+
+Result Entity_ID_Pool::take(u32 count, std::vector<Entity_ID> &ids) {
+  if (used + count >= capacity) {
+    LOG_WARN("Failed to get {} entity ids. Pool full.", count);
+    return Result::ENTITY_POOL_FULL;
+  }
+
+  ids.reserve(ids.size() + count);
+  for (u32 i = 0; i < count; i++) {
+    Entity_ID id;
+    Result id_res = take(id);
+    if (id_res != Result::SUCCESS) {
+      return id_res;
+    }
+    ids.push_back(id);
+  }
+
+  return Result::SUCCESS;
+}
+
+void Entity_ID_Pool::release(Entity_ID id) {
+  if (!in_use(id)) {
+    return;
+  }
+
+  in_use_flags[id] = false;
+  generations[id]++;
+  free_ids.push_back(id);
+  used--;
+}
 }  // namespace VV
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "core.h"
 #include "render/texture.h"
 #include "update/ai.h"
 
 namespace VV {
-constexpr u32 MAX_TOTAL_ENTITIES = 100000;
+// How many ids an Entity_ID_Pool hands out unless it's told otherwise
+constexpr u32 DEFAULT_MAX_ENTITIES = 100000;
 
 struct Entity_Coord {
   f64 x, y;
@@ -14,6 +19,222 @@ struct Entity_Coord {
 typedef u32 Entity_ID;
 typedef s8 Entity_Z;
 
+// An id plus the generation it was handed out in. Ids get reused once their
+// entity is deleted, so hold one of these instead of a bare id to be able to
+// tell the entity's gone.
+struct Entity_Handle {
+  Entity_ID id;
+  u32 generation;
+};
+
+// Hands out entity ids from a free list, so taking and releasing one is
+// constant time however full the pool is. Id 0 is never handed out, which
+// makes a zeroed Entity_Handle always stale.
+class Entity_ID_Pool {
+ public:
+  // Ids go from 1 up to but not including capacity. Lowering it doesn't take
+  // back ids that are already out.
+  void set_capacity(u32 new_capacity) { capacity = new_capacity; }
+
+  // This can fail! Check the result.
+  Result take(Entity_ID &id);
+  // Takes count ids, appending them to ids. Fails without taking any if
+  // there aren't enough.
+  Result take(u32 count, std::vector<Entity_ID> &ids);
+  // Does nothing if the id isn't taken
+  void release(Entity_ID id);
+
+  bool in_use(Entity_ID id) const {
+    return id < in_use_flags.size() && in_use_flags[id];
+  }
+  Entity_Handle get_handle(Entity_ID id) const {
+    return {id, id < generations.size() ? generations[id] : 0};
+  }
+  // False once the id's been released, even if it's been taken again
+  bool is_live(const Entity_Handle &handle) const {
+    return in_use(handle.id) && generations[handle.id] == handle.generation;
+  }
+
+  size_t size() const { return used; }  // Ids taken
+  // Id 0 is never handed out, so a capacity of 1 or less is always full
+  f32 occupancy() const {
+    return capacity <= 1 ? 1.0f : static_cast<f32>(used) / (capacity - 1);
+  }
+
+ private:
+  // Both by id, up to the highest id handed out so far
+  std::vector<u32> generations;  // Bumped when the id's released
+  std::vector<bool> in_use_flags;
+
+  std::vector<Entity_ID> free_ids;  // Released ids, reused last in first out
+  Entity_ID next_fresh = 1;         // Lowest id never handed out
+  u32 used = 0;
+  u32 capacity = DEFAULT_MAX_ENTITIES;
+};
+
+// A set of entity ids with constant time insert, erase and lookup that
+// iterates over a packed array. Erasing moves the last id into the hole, so
+// iteration order isn't sorted or kept, and erasing invalidates iterators.
+class Entity_Set {
+ public:
+  typedef std::vector<Entity_ID>::const_iterator const_iterator;
+
+  // Returns false if it was already in the set
+  bool insert(Entity_ID id) {
+    if (contains(id)) {
+      return false;
+    }
+
+    if (id >= sparse.size()) {
+      sparse.resize(id + 1, NOT_IN_SET);
+    }
+    sparse[id] = static_cast<u32>(dense.size());
+    dense.push_back(id);
+    return true;
+  }
+
+  // Returns false if it wasn't in the set
+  bool erase(Entity_ID id) {
+    if (!contains(id)) {
+      return false;
+    }
+
+    u32 index = sparse[id];
+    Entity_ID last = dense.back();
+    dense[index] = last;
+    sparse[last] = index;
+    dense.pop_back();
+    sparse[id] = NOT_IN_SET;
+    return true;
+  }
+
+  bool contains(Entity_ID id) const {
+    return id < sparse.size() && sparse[id] != NOT_IN_SET;
+  }
+  size_t count(Entity_ID id) const { return contains(id) ? 1 : 0; }
+
+  size_t size() const { return dense.size(); }
+  bool empty() const { return dense.empty(); }
+  void clear() {
+    for (Entity_ID id : dense) {
+      sparse[id] = NOT_IN_SET;
+    }
+    dense.clear();
+  }
+
+  const_iterator begin() const { return dense.begin(); }
+  const_iterator end() const { return dense.end(); }
+  const Entity_ID *data() const { return dense.data(); }
+
+ private:
+  static constexpr u32 NOT_IN_SET = UINT32_MAX;
+
+  std::vector<Entity_ID> dense;  // The ids, packed
+  std::vector<u32> sparse;       // Index into dense by id. Grown as needed.
+};
+
+// Entities to draw, in an array per z. Each layer keeps the order its
+// entities were added in. Erasing leaves a hole that's skipped over, and a
+// layer is packed again once it's half holes, so erasing is constant time on
+// average without reordering anything.
+class Render_Registry {
+ public:
+  // Returns false if it was already in the registry
+  bool insert(Entity_ID id, Entity_Z z) {
+    if (contains(id)) {
+      return false;
+    }
+
+    if (id >= slots.size()) {
+      slots.resize(id + 1, {0, NOT_IN_SET});
+    }
+    Layer &layer = get_layer(z);
+    slots[id] = {z, static_cast<u32>(layer.ids.size())};
+    layer.ids.push_back(id);
+    entity_count++;
+    return true;
+  }
+
+  // Returns false if it wasn't in the registry
+  bool erase(Entity_ID id) {
+    if (!contains(id)) {
+      return false;
+    }
+
+    Slot &slot = slots[id];
+    Layer &layer = get_layer(slot.z);
+    layer.ids[slot.index] = HOLE;
+    layer.holes++;
+    slot.index = NOT_IN_SET;
+    entity_count--;
+
+    if (layer.holes * 2 > layer.ids.size()) {
+      pack_layer(layer);
+    }
+    return true;
+  }
+
+  bool contains(Entity_ID id) const {
+    return id < slots.size() && slots[id].index != NOT_IN_SET;
+  }
+
+  size_t size() const { return entity_count; }
+  bool empty() const { return entity_count == 0; }
+
+  // The id has to be in the registry
+  Entity_Z get_z(Entity_ID id) const { return slots[id].z; }
+  // Sorting ids by this puts them in the order for_each goes in
+  u64 get_draw_order(Entity_ID id) const {
+    return static_cast<u64>(slots[id].z - INT8_MIN) << 32 | slots[id].index;
+  }
+
+  // Calls f with each id from z_min up to and including z_max, lowest z
+  // first and then in the order they were added. f can't insert or erase.
+  template <typename F>
+  void for_each(Entity_Z z_min, Entity_Z z_max, F f) const {
+    for (s32 z = z_min; z <= z_max; z++) {
+      for (Entity_ID id : layers[z - INT8_MIN].ids) {
+        if (id != HOLE) {
+          f(id);
+        }
+      }
+    }
+  }
+
+ private:
+  static constexpr u32 NOT_IN_SET = UINT32_MAX;
+  static constexpr Entity_ID HOLE = UINT32_MAX;
+
+  struct Layer {
+    std::vector<Entity_ID> ids;
+    u32 holes = 0;
+  };
+
+  // Where an id is in the layers
+  struct Slot {
+    Entity_Z z;
+    u32 index;  // NOT_IN_SET if it isn't in the registry
+  };
+
+  Layer &get_layer(Entity_Z z) { return layers[z - INT8_MIN]; }
+
+  void pack_layer(Layer &layer) {
+    u32 packed = 0;
+    for (Entity_ID id : layer.ids) {
+      if (id != HOLE) {
+        slots[id].index = packed;
+        layer.ids[packed++] = id;
+      }
+    }
+    layer.ids.resize(packed);
+    layer.holes = 0;
+  }
+
+  Layer layers[UINT8_MAX + 1];
+  std::vector<Slot> slots;  // By id. Grown as needed.
+  size_t entity_count = 0;
+};
+
 // bool flags
 enum class Entity_Status : u8 {
   ON_GROUND = 1,
@@ -38,13 +259,20 @@ enum class Entity_Factory_Type : u16 {
   FISH,
 };
 
-// Monolithic Entity struct. Every entity possess every possible
-// attribute to simplify the data. I'm thinking we'll probably
-// never have more than at max hundreds of thousands of these
-// so even at hundreds of bytes this struct should be totally fine
-// to fit into memory. (Like maybe 100MB max)
-// AOS, so a little OOP, but I think this is very flexible way
-// to hold all the data. Plus no mapping like a SOA would require.
+// From the names used in the res json files. Returns false if it isn't one.
+bool string_to_entity_factory_type(const std::string &name,
+                                   Entity_Factory_Type &type);
+
+// Every entity possess every possible attribute to simplify the data. I'm
+// thinking we'll probably never have more than at max hundreds of thousands
+// of these so even at hundreds of bytes each they should be totally fine to
+// fit into memory. (Like maybe 100MB max)
+//
+// The physics loops go through every kinetic entity each frame but only look
+// at a handful of fields, so those are split off. An Entity is the whole thing
+// in one piece, which is what factories hold and what gets copied around.
+// Update_State keeps them in an Entity_Storage, where the hot fields are each
+// a column by id and the rest are packed into an Entity_Cold row.
 
 // Entity functionality: whenever components of an entity need to be acted on,
 // they should be registered in the dimensions component list. For example, if
@@ -53,19 +281,12 @@ enum class Entity_Factory_Type : u16 {
 // with anything custom, you can also add functionality after the entity is
 // created.
 
-struct Entity {
-  Entity_Coord coord;  // For bounding box and rendering, this is top left
-  f32 vx, vy;
-  f32 ax, ay;
+// Everything the physics doesn't look at every frame
+struct Entity_Cold {
+  Entity_Factory_Type factory_type;  // What it was created as. Used for saving
 
   f32 camx, camy;  // This is relative to coord
 
-  u16 status;
-  f32 bouyancy;
-
-  // The physics bounding box starting from coord as top left
-  f32 boundingw, boundingh;
-
   // Head bounding box starting from coord as top left
   f32 head_boundingw, head_boundingh;
 
@@ -85,14 +306,165 @@ struct Entity {
 
   s64 health;
   s64 max_health;
+  s64 contact_damage;      // Taken by whatever it touches
+  u64 contact_hurt_frame;  // Can't take contact damage again until this frame
   Entity_Coord respawn_point;
 
   AI_ID ai_id;
+  Entity_Handle ai_target;  // Who FOLLOW_PLAYER_SLOW follows. The player if
+                            // it's stale.
 
   Entity_Coord wander_target;
   u64 wander_target_frame;
 };
 
+// The cold fields are a base so they can be copied to and from the storage's
+// rows in one go, while callers still see one flat struct.
+struct Entity : Entity_Cold {
+  Entity_Coord coord;  // For bounding box and rendering, this is top left
+  f32 vx, vy;
+  f32 ax, ay;
+
+  u16 status;
+  f32 bouyancy;
+
+  // The physics bounding box starting from coord as top left
+  f32 boundingw, boundingh;
+};
+
+struct Entity_Page;
+
+// An entity in an Entity_Storage. It's used just like an Entity, but the
+// fields are references into the storage, so callers don't care which ones
+// are columns.
+struct Entity_Ref {
+  Entity_Ref(Entity_Page &page, u32 slot);
+
+  Entity_Coord &coord;
+  f32 &vx, &vy;
+  f32 &ax, &ay;
+
+  u16 &status;
+  f32 &bouyancy;
+
+  f32 &boundingw, &boundingh;
+
+  Entity_Factory_Type &factory_type;
+  f32 &camx, &camy;
+  f32 &head_boundingw, &head_boundingh;
+  Texture_Id &texture;
+  u8 &texture_index;
+  Entity_Z &zdepth;
+  bool &flipped;
+  u8 &anim_width;
+  u8 &anim_frames;
+  u8 &anim_current_frame;
+  u16 &anim_delay;
+  u16 &anim_delay_variety;
+  u16 &anim_timer;
+  u16 &anim_delay_current_spice;
+  s64 &health;
+  s64 &max_health;
+  s64 &contact_damage;
+  u64 &contact_hurt_frame;
+  Entity_Coord &respawn_point;
+  AI_ID &ai_id;
+  Entity_Handle &ai_target;
+  Entity_Coord &wander_target;
+  u64 &wander_target_frame;
+};
+
+// Entities are kept in pages of this many ids. A page is only allocated once
+// an id in it is in use and it's freed again once none are.
+constexpr u32 ENTITY_PAGE_SIZE = 1024;
+
+// One page of an Entity_Storage. The hot fields are each a column, so loops
+// that only need one or two of them can go through just those.
+struct Entity_Page {
+  Entity_Coord coord[ENTITY_PAGE_SIZE];
+  f32 vx[ENTITY_PAGE_SIZE], vy[ENTITY_PAGE_SIZE];
+  f32 ax[ENTITY_PAGE_SIZE], ay[ENTITY_PAGE_SIZE];
+
+  u16 status[ENTITY_PAGE_SIZE];
+  f32 bouyancy[ENTITY_PAGE_SIZE];
+
+  f32 boundingw[ENTITY_PAGE_SIZE], boundingh[ENTITY_PAGE_SIZE];
+
+  Entity_Cold cold[ENTITY_PAGE_SIZE];
+
+  u32 live = 0;  // Ids in the page that have been added and not removed
+};
+
+inline Entity_Ref::Entity_Ref(Entity_Page &page, u32 slot)
+    : coord(page.coord[slot]),
+      vx(page.vx[slot]),
+      vy(page.vy[slot]),
+      ax(page.ax[slot]),
+      ay(page.ay[slot]),
+      status(page.status[slot]),
+      bouyancy(page.bouyancy[slot]),
+      boundingw(page.boundingw[slot]),
+      boundingh(page.boundingh[slot]),
+      factory_type(page.cold[slot].factory_type),
+      camx(page.cold[slot].camx),
+      camy(page.cold[slot].camy),
+      head_boundingw(page.cold[slot].head_boundingw),
+      head_boundingh(page.cold[slot].head_boundingh),
+      texture(page.cold[slot].texture),
+      texture_index(page.cold[slot].texture_index),
+      zdepth(page.cold[slot].zdepth),
+      flipped(page.cold[slot].flipped),
+      anim_width(page.cold[slot].anim_width),
+      anim_frames(page.cold[slot].anim_frames),
+      anim_current_frame(page.cold[slot].anim_current_frame),
+      anim_delay(page.cold[slot].anim_delay),
+      anim_delay_variety(page.cold[slot].anim_delay_variety),
+      anim_timer(page.cold[slot].anim_timer),
+      anim_delay_current_spice(page.cold[slot].anim_delay_current_spice),
+      health(page.cold[slot].health),
+      max_health(page.cold[slot].max_health),
+      contact_damage(page.cold[slot].contact_damage),
+      contact_hurt_frame(page.cold[slot].contact_hurt_frame),
+      respawn_point(page.cold[slot].respawn_point),
+      ai_id(page.cold[slot].ai_id),
+      ai_target(page.cold[slot].ai_target),
+      wander_target(page.cold[slot].wander_target),
+      wander_target_frame(page.cold[slot].wander_target_frame) {}
+
+// Where an id is in its page
+inline u32 get_entity_page_slot(Entity_ID id) { return id % ENTITY_PAGE_SIZE; }
+
+// Holds every entity by id. Pages don't move once they're allocated, so an
+// Entity_Ref or a column reference stays good until its entity is removed.
+class Entity_Storage {
+ public:
+  // Makes room for id, allocating its page if it has to. The entity starts
+  // zeroed.
+  void add(Entity_ID id);
+  // Frees the id's page once nothing in it is left
+  void remove(Entity_ID id);
+
+  // The id has to have been added
+  Entity_Page &get_page(Entity_ID id) { return *pages[id / ENTITY_PAGE_SIZE]; }
+  const Entity_Page &get_page(Entity_ID id) const {
+    return *pages[id / ENTITY_PAGE_SIZE];
+  }
+
+  Entity_Ref operator[](Entity_ID id) {
+    return {get_page(id), get_entity_page_slot(id)};
+  }
+
+  // Copies a whole entity in or out
+  void store(Entity_ID id, const Entity &e);
+  Entity load(Entity_ID id) const;
+
+  size_t page_count() const { return allocated_pages; }
+
+ private:
+  std::vector<std::unique_ptr<Entity_Page>> pages;  // By id / page size
+  size_t allocated_pages = 0;
+};
+
 struct Entity_Factory {
   Entity e;
   bool register_kinetic;
@@ -101,8 +473,21 @@ struct Entity_Factory {
   bool register_ai;
 };
 
+// Two entities whose body boxes overlapped in update_kinetic
+struct Entity_Contact {
+  Entity_ID a, b;
+  Entity_ID top;  // The one standing on the other's head, or 0 if neither
+};
+
+// One entity for spawn_entities to make
+struct Entity_Spawn {
+  Entity_Factory_Type type;
+  Entity_Coord coord;
+  Texture_Id texture;  // NONE keeps the factory's
+};
+
 Entity default_entity();
 
-inline Entity_Coord get_cam_coord(const Entity &e);
+Entity_Coord get_cam_coord(const Entity_Ref &e);
 
 }  // namespace VV
@@ -0,0 +1,134 @@
+#include "update/minimap.h"
+
+#include <algorithm>
+
+namespace VV {
+void mark_chunk_summary_stale(Dimension &dim, Chunk &chunk) {
+  if (!chunk.summary.stale) {
+    chunk.summary.stale = true;
+    dim.minimap.stale.push_back(chunk.coord);
+  }
+}
+
+void summarize_chunk(Chunk &chunk) {
+  Chunk_Summary &summary = chunk.summary;
+  summary.stale = false;
+
+  // Uniform chunks are the type's palette all the way through
+  if (chunk.all_cell != Cell_Type::NONE) {
+    std::fill(std::begin(summary.tile.texels), std::end(summary.tile.texels),
+              cell_type_infos[(u16)chunk.all_cell].average_color);
+    summary.dominant = chunk.all_cell;
+    return;
+  }
+
+  s64 chunk_x = static_cast<s64>(chunk.coord.x) * CHUNK_CELL_WIDTH;
+  s64 chunk_y = static_cast<s64>(chunk.coord.y) * CHUNK_CELL_WIDTH;
+  constexpr u32 TEXEL_CELLS = MINIMAP_TILE_CELLS * MINIMAP_TILE_CELLS;
+
+  for (u16 texel_y = 0; texel_y < MINIMAP_TILE_WIDTH; texel_y++) {
+    for (u16 texel_x = 0; texel_x < MINIMAP_TILE_WIDTH; texel_x++) {
+      u32 r = 0, g = 0, b = 0, a = 0;
+      for (u16 y = texel_y * MINIMAP_TILE_CELLS;
+           y < (texel_y + 1) * MINIMAP_TILE_CELLS; y++) {
+        for (u16 x = texel_x * MINIMAP_TILE_CELLS;
+             x < (texel_x + 1) * MINIMAP_TILE_CELLS; x++) {
+          Cell_Type type = chunk.cells[y * CHUNK_CELL_WIDTH + x].type;
+
+          const Cell_Palette_Color &color =
+              get_cell_color(type, chunk_x + x, chunk_y + y);
+          r += color.r;
+          g += color.g;
+          b += color.b;
+          a += color.a;
+        }
+      }
+
+      summary.tile.texels[texel_y * MINIMAP_TILE_WIDTH + texel_x] = {
+          static_cast<u8>(r / TEXEL_CELLS), static_cast<u8>(g / TEXEL_CELLS),
+          static_cast<u8>(b / TEXEL_CELLS), static_cast<u8>(a / TEXEL_CELLS)};
+    }
+  }
+
+  summary.dominant = static_cast<Cell_Type>(
+      std::max_element(std::begin(chunk.cell_counts),
+                       std::end(chunk.cell_counts)) -
+      std::begin(chunk.cell_counts));
+}
+
+// Shrinks the four tiles under a tile at level into it. Missing tiles count as
+// empty.
+void downsample_minimap_tile(Minimap &minimap, u8 level,
+                             const Chunk_Coord &coord) {
+  constexpr u16 HALF_TILE = MINIMAP_TILE_WIDTH / 2;
+  Minimap_Tile &tile = minimap.levels[level][coord];
+
+  for (s32 quadrant_y = 0; quadrant_y < 2; quadrant_y++) {
+    for (s32 quadrant_x = 0; quadrant_x < 2; quadrant_x++) {
+      auto child_iter = minimap.levels[level - 1].find(
+          {coord.x * 2 + quadrant_x, coord.y * 2 + quadrant_y});
+
+      for (u16 y = 0; y < HALF_TILE; y++) {
+        for (u16 x = 0; x < HALF_TILE; x++) {
+          Cell_Palette_Color &texel =
+              tile.texels[(quadrant_y * HALF_TILE + y) * MINIMAP_TILE_WIDTH +
+                          quadrant_x * HALF_TILE + x];
+          if (child_iter == minimap.levels[level - 1].end()) {
+            texel = {0, 0, 0, 0};
+            continue;
+          }
+
+          u32 r = 0, g = 0, b = 0, a = 0;
+          for (u16 child_y = y * 2; child_y < y * 2 + 2; child_y++) {
+            for (u16 child_x = x * 2; child_x < x * 2 + 2; child_x++) {
+              const Cell_Palette_Color &child_texel =
+                  child_iter->second
+                      .texels[child_y * MINIMAP_TILE_WIDTH + child_x];
+              r += child_texel.r;
+              g += child_texel.g;
+              b += child_texel.b;
+              a += child_texel.a;
+            }
+          }
+          texel = {static_cast<u8>(r / 4), static_cast<u8>(g / 4),
+                   static_cast<u8>(b / 4), static_cast<u8>(a / 4)};
+        }
+      }
+    }
+  }
+}
+
+void update_minimap(Dimension &dim) {
+  Minimap &minimap = dim.minimap;
+
+  for (const Chunk_Coord &coord : minimap.stale) {
+    auto chunk_iter = dim.chunks.find(coord);
+    if (chunk_iter == dim.chunks.end()) {
+      continue;  // Evicted since it was queued
+    }
+
+    Chunk &chunk = chunk_iter->second;
+    summarize_chunk(chunk);
+    minimap.levels[0][coord] = chunk.summary.tile;
+
+    Chunk_Coord level_coord = coord;
+    for (u8 level = 1; level < MINIMAP_LEVELS; level++) {
+      level_coord = {floor_div(level_coord.x, 2), floor_div(level_coord.y, 2)};
+      downsample_minimap_tile(minimap, level, level_coord);
+    }
+  }
+
+  minimap.stale.clear();
+}
+
+const Minimap_Tile *get_minimap_tile(const Minimap &minimap, u8 level,
+                                     const Chunk_Coord &chunk_coord) {
+  Chunk_Coord level_coord = {floor_div(chunk_coord.x, 1 << level),
+                             floor_div(chunk_coord.y, 1 << level)};
+  auto tile_iter = minimap.levels[level].find(level_coord);
+  if (tile_iter == minimap.levels[level].end()) {
+    return nullptr;
+  }
+  return &tile_iter->second;
+}
+}  // namespace VV
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "core.h"
+#include "update/world.h"
+
+namespace VV {
+/// Minimap ///
+// Each chunk keeps a Chunk_Summary, and the dimension keeps a pyramid of
+// tiles built from them. Anything that changes a chunk's cells queues its
+// summary to be redone, and update_minimap only works through that queue, so
+// keeping the minimap up costs as much as the chunks that changed instead of
+// every chunk that's loaded.
+
+// Queues the chunk's summary to be redone. Cheap to call more than once.
+void mark_chunk_summary_stale(Dimension &dim, Chunk &chunk);
+// Works out the summary from the chunk's cells
+void summarize_chunk(Chunk &chunk);
+// Redoes the queued summaries and the tiles above them in the pyramid
+void update_minimap(Dimension &dim);
+
+// The tile at a level covering a chunk coord, or nullptr if nothing under it
+// has been loaded
+const Minimap_Tile *get_minimap_tile(const Minimap &minimap, u8 level,
+                                     const Chunk_Coord &chunk_coord);
+}  // namespace VV
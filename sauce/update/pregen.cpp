@@ -0,0 +1,348 @@
+#include "update/pregen.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "update/update.h"
+
+namespace VV {
+constexpr u32 PREGEN_FLUSH_CHUNKS = 256;
+// Pieces are strips this many chunks wide, so even a rectangle inside one
+// region is spread over every worker
+constexpr s32 PREGEN_STRIP_CHUNKS = 4;
+
+struct Pregen_Piece {
+  Chunk_Coord min, max;  // Never crosses a region boundary
+};
+
+struct Pregen_Piece_Result {
+  Result result;
+  u64 generated;  // Chunks that weren't already in the save
+  u64 skipped;
+};
+
+// What the workers share. Generating a chunk can spawn entities in the chunks
+// around it, like trees in the chunk above, and those can belong to another
+// piece. They're kept here until their chunk is saved, so a pregenerated chunk
+// ends up with the same entities as one generated in game no matter which
+// piece gets there first.
+struct Pregen_Shared {
+  World_Save save;       // Pieces share regions, so all writes go here
+  Chunk_Coord min, max;  // The whole rectangle
+
+  std::mutex strays_mutex;  // Guards the rest
+  std::set<Chunk_Coord> saved;    // Generated and queued this run
+  std::set<Chunk_Coord> skipped;  // Were already saved before this run
+  // Entities waiting for their chunk to be generated
+  std::map<Chunk_Coord, std::vector<Saved_Entity>> strays;
+};
+
+// Update_State holds mutexes, so it can't be moved and has to be handed
+// back on the heap. Each worker keeps one for all of its pieces.
+std::unique_ptr<Update_State> make_pregen_state(
+    const Config &config, const Pregen_Request &request,
+    const Update_State &factory_state) {
+  auto update_state = std::make_unique<Update_State>();
+  update_state->world_seed = request.world_seed;
+  update_state->entity_factories = factory_state.entity_factories;
+  update_state->structures = factory_state.structures;
+  update_state->dimensions.emplace(DimensionIndex::OVERWORLD, Dimension());
+  update_state->active_dimension = DimensionIndex::OVERWORLD;
+  update_state->active_player = 0;  // No player. 0 is never handed out
+
+  // Only read from, to skip chunks that are already saved. Pieces never
+  // overlap, so nobody else writes the chunks a worker is about to check.
+  Result save_res =
+      open_world_save(update_state->world_save,
+                      get_world_save_dir(config, request.world_seed));
+  if (save_res != Result::SUCCESS) {
+    return nullptr;
+  }
+
+  return update_state;
+}
+
+// The chunk in the rectangle an entity is saved with. That's the one it
+// stands in, or the closest one on the edge if it's outside. Loading that
+// chunk puts it back where it was, just like in game where it'd be left
+// standing in a chunk that isn't loaded.
+Chunk_Coord get_pregen_entity_chunk(const Pregen_Shared &shared,
+                                    const Entity_Coord &coord) {
+  Chunk_Coord chunk_coord = get_chunk_coord(coord.x, coord.y);
+  chunk_coord.x = std::clamp(chunk_coord.x, shared.min.x, shared.max.x - 1);
+  chunk_coord.y = std::clamp(chunk_coord.y, shared.min.y, shared.max.y - 1);
+  return chunk_coord;
+}
+
+// Hands an entity off to the chunk it's saved with, which wasn't in the
+// flush. Chunks that were already saved before this run keep what they had.
+// Needs strays_mutex.
+void add_pregen_stray(Pregen_Shared &shared, const Saved_Entity &entity) {
+  Chunk_Coord coord = get_pregen_entity_chunk(shared, entity.coord);
+  if (shared.skipped.count(coord)) {
+    return;
+  }
+
+  if (!shared.saved.count(coord)) {
+    shared.strays[coord].push_back(entity);
+    return;
+  }
+
+  // Already queued, so it's read back and queued again with the entity
+  auto snapshot = std::make_shared<Chunk_Snapshot>();
+  Result read_res =
+      read_region_chunk(shared.save, DimensionIndex::OVERWORLD, coord,
+                        snapshot->chunk, snapshot->entities);
+  if (read_res != Result::SUCCESS) {
+    LOG_WARN("Pregen couldn't read back chunk {}, {} for an entity: {}",
+             coord.x, coord.y, (s32)read_res);
+    return;
+  }
+  snapshot->chunk.coord = coord;
+  snapshot->entities.push_back(entity);
+  queue_chunk_save(shared.save, DimensionIndex::OVERWORLD, snapshot);
+}
+
+// Snapshots the generated chunks into the shared save along with any strays
+// waiting for them, and writes them out. Entities that don't stand in one of
+// them are handed off. Then the chunks and all the entities are dropped to
+// keep memory down.
+Result flush_pregen_chunks(Update_State &update_state, Pregen_Shared &shared,
+                           const std::vector<Chunk_Coord> &generated) {
+  Dimension &dim = update_state.dimensions[DimensionIndex::OVERWORLD];
+  snapshot_chunks(update_state, DimensionIndex::OVERWORLD, generated);
+
+  std::map<Saved_Chunk_Key, std::shared_ptr<const Chunk_Snapshot>> pending;
+  {
+    std::lock_guard<std::mutex> lock(update_state.world_save.mutex);
+    pending.swap(update_state.world_save.pending);
+  }
+
+  std::set<Chunk_Coord> generated_set(generated.begin(), generated.end());
+  std::vector<Entity_ID> ids;
+  for (Entity_ID id : dim.entity_indicies) {
+    ids.push_back(id);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(shared.strays_mutex);
+    for (auto &[chunk_key, snapshot] : pending) {
+      auto strays_iter = shared.strays.find(chunk_key.coord);
+      if (strays_iter != shared.strays.end()) {
+        auto merged = std::make_shared<Chunk_Snapshot>(*snapshot);
+        merged->entities.insert(merged->entities.end(),
+                                strays_iter->second.begin(),
+                                strays_iter->second.end());
+        snapshot = merged;
+        shared.strays.erase(strays_iter);
+      }
+      shared.saved.insert(chunk_key.coord);
+      queue_chunk_save(shared.save, chunk_key.dim, std::move(snapshot));
+    }
+
+    // Same filter as snapshot_chunks
+    for (Entity_ID id : ids) {
+      Entity_Ref e = update_state.entities[id];
+      if (!generated_set.count(get_chunk_coord(e.coord.x, e.coord.y)) &&
+          !(e.status & (u16)Entity_Status::DEATHLESS)) {
+        add_pregen_stray(shared,
+                         {e.factory_type, e.coord, e.texture, e.flipped,
+                          e.health});
+      }
+    }
+  }
+  Result flush_res = flush_world_save(shared.save);
+
+  for (Entity_ID id : ids) {
+    delete_entity(update_state, dim, id);
+  }
+  dim.chunks.clear();
+
+  return flush_res;
+}
+
+Pregen_Piece_Result pregen_piece(Update_State &update_state,
+                                 Pregen_Shared &shared,
+                                 const Pregen_Piece &piece) {
+  Pregen_Piece_Result piece_result = {Result::SUCCESS, 0, 0};
+
+  Dimension &dim = update_state.dimensions[DimensionIndex::OVERWORLD];
+
+  std::vector<Chunk_Coord> generated;
+  Chunk_Coord icc;
+  for (icc.x = piece.min.x; icc.x < piece.max.x; icc.x++) {
+    for (icc.y = piece.min.y; icc.y < piece.max.y; icc.y++) {
+      load_chunk(update_state, DimensionIndex::OVERWORLD, icc);
+
+      // Chunks that were already saved come back clean. Strays don't go
+      // into them, so they keep what they were saved with.
+      if (dim.chunks.at(icc).unsaved) {
+        generated.push_back(icc);
+      } else {
+        std::lock_guard<std::mutex> lock(shared.strays_mutex);
+        shared.skipped.insert(icc);
+        shared.strays.erase(icc);
+        piece_result.skipped++;
+      }
+    }
+
+    if (generated.size() >= PREGEN_FLUSH_CHUNKS || icc.x == piece.max.x - 1) {
+      Result flush_res = flush_pregen_chunks(update_state, shared, generated);
+      if (flush_res != Result::SUCCESS) {
+        piece_result.result = flush_res;
+      }
+
+      piece_result.generated += generated.size();
+      generated.clear();
+    }
+  }
+
+  return piece_result;
+}
+
+Result pregen_world(const Config &config, const Pregen_Request &request) {
+  if (request.min.x >= request.max.x || request.min.y >= request.max.y) {
+    LOG_ERROR("Pregen rectangle {}, {} to {}, {} is empty", request.min.x,
+              request.min.y, request.max.x, request.max.y);
+    return Result::BAD_ARGS_ERROR;
+  }
+
+  std::filesystem::path res_dir;
+  Result res_dir_res = get_resource_dir(res_dir);
+  if (res_dir_res != Result::SUCCESS) {
+    LOG_ERROR("Pregen failed to get resource dir");
+    return res_dir_res;
+  }
+
+  Result cell_factory_res = init_cell_factory(res_dir / "cell_factory.json");
+  if (cell_factory_res != Result::SUCCESS) {
+    LOG_ERROR("Pregen failed to initialize cell factories");
+    return cell_factory_res;
+  }
+
+  // Parsed once here and copied into each worker's Update_State
+  auto factory_state = std::make_unique<Update_State>();
+  Result entity_factory_res =
+      init_entity_factory(*factory_state, res_dir / "entity_factory.json");
+  if (entity_factory_res != Result::SUCCESS) {
+    LOG_ERROR("Pregen failed to initialize entity factories");
+    return entity_factory_res;
+  }
+  Result structures_res =
+      init_structures(factory_state->structures, res_dir / "structures.json");
+  if (structures_res != Result::SUCCESS) {
+    LOG_ERROR("Pregen failed to initialize structures");
+    return structures_res;
+  }
+
+  // Strips inside each region, a region at a time so the workers mostly
+  // share the regions they're writing
+  std::vector<Pregen_Piece> pieces;
+  Region_Key min_key = get_region_key(DimensionIndex::OVERWORLD, request.min);
+  Region_Key max_key = get_region_key(
+      DimensionIndex::OVERWORLD, {request.max.x - 1, request.max.y - 1});
+  for (s32 x = min_key.x; x <= max_key.x; x++) {
+    for (s32 y = min_key.y; y <= max_key.y; y++) {
+      Chunk_Coord region_min = {x * REGION_CHUNK_WIDTH, y * REGION_CHUNK_WIDTH};
+      Chunk_Coord min = {std::max(region_min.x, request.min.x),
+                         std::max(region_min.y, request.min.y)};
+      Chunk_Coord max = {
+          std::min(region_min.x + REGION_CHUNK_WIDTH, request.max.x),
+          std::min(region_min.y + REGION_CHUNK_WIDTH, request.max.y)};
+      for (s32 strip_x = min.x; strip_x < max.x;
+           strip_x += PREGEN_STRIP_CHUNKS) {
+        pieces.push_back(
+            {{strip_x, min.y},
+             {std::min(strip_x + PREGEN_STRIP_CHUNKS, max.x), max.y}});
+      }
+    }
+  }
+
+  Pregen_Shared shared = {};
+  shared.min = request.min;
+  shared.max = request.max;
+  Result save_res = open_world_save(
+      shared.save, get_world_save_dir(config, request.world_seed));
+  if (save_res != Result::SUCCESS) {
+    LOG_ERROR("Pregen failed to open the world save");
+    return save_res;
+  }
+
+  u32 num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  num_threads = std::min<u32>(num_threads, pieces.size());
+
+  u64 total_chunks = static_cast<u64>(request.max.x - request.min.x) *
+                     static_cast<u64>(request.max.y - request.min.y);
+  LOG_INFO(
+      "Pre-generating {} chunks for seed 0x{:08x} in {} pieces on {} threads",
+      total_chunks, request.world_seed, pieces.size(), num_threads);
+
+  std::atomic<size_t> next_piece = 0;
+  std::atomic<u64> generated = 0;
+  std::atomic<u64> skipped = 0;
+  std::atomic<bool> failed = false;
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> workers;
+  for (u32 i = 0; i < num_threads; i++) {
+    workers.emplace_back([&]() {
+      std::unique_ptr<Update_State> update_state =
+          make_pregen_state(config, request, *factory_state);
+      if (update_state == nullptr) {
+        LOG_ERROR("Pregen worker failed to open the world save");
+        failed = true;
+        return;
+      }
+
+      size_t piece;
+      while ((piece = next_piece++) < pieces.size()) {
+        Pregen_Piece_Result piece_result =
+            pregen_piece(*update_state, shared, pieces[piece]);
+        if (piece_result.result != Result::SUCCESS) {
+          LOG_ERROR("Failed to pre-generate chunks {}, {} to {}, {}: {}",
+                    pieces[piece].min.x, pieces[piece].min.y,
+                    pieces[piece].max.x, pieces[piece].max.y,
+                    (s32)piece_result.result);
+          failed = true;
+        }
+
+        generated += piece_result.generated;
+        skipped += piece_result.skipped;
+        LOG_INFO("Chunks {}, {} to {}, {} done. {}/{} chunks",
+                 pieces[piece].min.x, pieces[piece].min.y, pieces[piece].max.x,
+                 pieces[piece].max.y, generated + skipped, total_chunks);
+      }
+
+      close_world_save(update_state->world_save);
+    });
+  }
+
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  // Chunks that strays were added to after their piece flushed might still be
+  // queued
+  Result flush_res = flush_world_save(shared.save);
+  if (flush_res != Result::SUCCESS) {
+    LOG_ERROR("Pregen failed to write the last chunks: {}", (s32)flush_res);
+    failed = true;
+  }
+  close_world_save(shared.save);
+
+  std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+  LOG_INFO(
+      "Generated {} chunks ({} already saved) in {:.2f}s. {:.1f} chunks/s",
+      generated.load(), skipped.load(), elapsed.count(),
+      generated.load() / std::max(elapsed.count(), 1e-9));
+
+  return failed ? Result::GENERAL_ERROR : Result::SUCCESS;
+}
+}  // namespace VV
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "core.h"
+#include "update/world.h"
+#include "utils/config.h"
+
+namespace VV {
+/// Pre-generation ///
+// Headless mode that generates a rectangle of overworld chunks straight into
+// the world save, so a seed can be baked before anyone plays it. It also makes
+// a decent generation benchmark since it reports chunks/s.
+//
+// Work is split into strips a few chunks wide, so even a small rectangle keeps
+// every worker busy. Each worker generates into its own Update_State, the same
+// way the game would, and writes through one shared World_Save.
+struct Pregen_Request {
+  u32 world_seed;
+  Chunk_Coord min, max;  // Chunks from min up to but not including max
+};
+
+Result pregen_world(const Config &config, const Pregen_Request &request);
+}  // namespace VV
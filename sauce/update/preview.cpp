@@ -0,0 +1,154 @@
+#include "update/preview.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "SDL_error.h"
+#include "SDL_surface.h"
+#include "update/update.h"
+
+namespace VV {
+Cell_Palette_Color get_preview_color(Cell_Type type, s64 x, s64 y) {
+  const Cell_Palette_Color &color = get_cell_color(type, x, y);
+  auto blend = [&](u8 channel, u8 sky) {
+    return static_cast<u8>((channel * color.a + sky * (255 - color.a)) / 255);
+  };
+
+  return {blend(color.r, PREVIEW_SKY_COLOR.r),
+          blend(color.g, PREVIEW_SKY_COLOR.g),
+          blend(color.b, PREVIEW_SKY_COLOR.b), 0xff};
+}
+
+// Runs job for every index up to count spread over all the cores
+template <typename Job>
+void run_preview_jobs(size_t count, const Job &job) {
+  u32 num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  num_threads = std::min<size_t>(num_threads, count);
+
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (u32 i = 0; i < num_threads; i++) {
+    workers.emplace_back([&]() {
+      size_t index;
+      while ((index = next++) < count) {
+        job(index);
+      }
+    });
+  }
+
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+void render_world_preview(const World_Preview_Request &request,
+                          std::vector<Cell_Palette_Color> &pixels, u32 &width,
+                          u32 &height) {
+  const u32 PIXELS_PER_CHUNK = CHUNK_CELL_WIDTH / PREVIEW_CELLS_PER_PIXEL;
+  u32 chunks_wide = request.max.x - request.min.x;
+  width = chunks_wide * PIXELS_PER_CHUNK;
+  height = (request.max.y - request.min.y) * PIXELS_PER_CHUNK;
+  pixels.resize(static_cast<size_t>(width) * height);
+
+  // Settling needs the column strips either side of the ones drawn
+  std::vector<Gen_Columns> columns(chunks_wide + 2);
+  run_preview_jobs(columns.size(), [&](size_t strip) {
+    gen_columns(request.world_seed, DimensionIndex::OVERWORLD,
+                request.min.x - 1 + strip, columns[strip]);
+  });
+  run_preview_jobs(chunks_wide, [&](size_t strip) {
+    settle_columns(columns[strip], columns[strip + 1], columns[strip + 2]);
+  });
+
+  s64 top_y = static_cast<s64>(request.max.y) * CHUNK_CELL_WIDTH;
+  run_preview_jobs(chunks_wide, [&](size_t strip) {
+    const Gen_Columns &strip_columns = columns[strip + 1];
+    s64 strip_x =
+        (static_cast<s64>(request.min.x) + strip) * CHUNK_CELL_WIDTH;
+
+    for (u32 column_pixel = 0; column_pixel < PIXELS_PER_CHUNK;
+         column_pixel++) {
+      u16 column_x = column_pixel * PREVIEW_CELLS_PER_PIXEL;
+      const Gen_Column &column = strip_columns.settled[column_x];
+      u32 pixel_x = strip * PIXELS_PER_CHUNK + column_pixel;
+
+      for (u32 pixel_y = 0; pixel_y < height; pixel_y++) {
+        s64 cell_y =
+            top_y - static_cast<s64>(pixel_y + 1) * PREVIEW_CELLS_PER_PIXEL;
+        pixels[static_cast<size_t>(pixel_y) * width + pixel_x] =
+            get_preview_color(get_band_cell_type(column, cell_y),
+                              strip_x + column_x, cell_y);
+      }
+    }
+  });
+}
+
+Result preview_world(const Config &config,
+                     const World_Preview_Request &request) {
+  if (request.min.x >= request.max.x || request.min.y >= request.max.y) {
+    LOG_ERROR("Preview rectangle {}, {} to {}, {} is empty", request.min.x,
+              request.min.y, request.max.x, request.max.y);
+    return Result::BAD_ARGS_ERROR;
+  }
+
+  std::filesystem::path res_dir;
+  Result res_dir_res = get_resource_dir(res_dir);
+  if (res_dir_res != Result::SUCCESS) {
+    LOG_ERROR("Preview failed to get resource dir");
+    return res_dir_res;
+  }
+
+  Result cell_factory_res = init_cell_factory(res_dir / "cell_factory.json");
+  if (cell_factory_res != Result::SUCCESS) {
+    LOG_ERROR("Preview failed to initialize cell factories");
+    return cell_factory_res;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<Cell_Palette_Color> pixels;
+  u32 width, height;
+  render_world_preview(request, pixels, width, height);
+
+  std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+  u64 total_chunks = static_cast<u64>(request.max.x - request.min.x) *
+                     static_cast<u64>(request.max.y - request.min.y);
+  LOG_INFO("Drew {} chunks in {:.2f}s. {:.1f} chunks/s", total_chunks,
+           elapsed.count(), total_chunks / std::max(elapsed.count(), 1e-9));
+
+  std::filesystem::path preview_dir = config.save_dir / "previews";
+  std::error_code ec;
+  std::filesystem::create_directories(preview_dir, ec);
+  if (ec) {
+    LOG_ERROR("Couldn't make preview dir {}: {}", preview_dir.string(),
+              ec.message());
+    return Result::FILESYSTEM_ERROR;
+  }
+
+  std::filesystem::path preview_path =
+      preview_dir / fmt::format("{:08x}_{}_{}_{}_{}.bmp", request.world_seed,
+                                request.min.x, request.min.y, request.max.x,
+                                request.max.y);
+
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+      pixels.data(), width, height, 32, width * sizeof(Cell_Palette_Color),
+      SDL_PIXELFORMAT_RGBA32);
+  if (surface == nullptr) {
+    LOG_ERROR("Couldn't make preview surface: {}", SDL_GetError());
+    return Result::SDL_ERROR;
+  }
+
+  int save_res = SDL_SaveBMP(surface, preview_path.string().c_str());
+  SDL_FreeSurface(surface);
+  if (save_res != 0) {
+    LOG_ERROR("Couldn't save preview to {}: {}", preview_path.string(),
+              SDL_GetError());
+    return Result::SDL_ERROR;
+  }
+
+  LOG_INFO("Saved {}x{} preview to {}", width, height, preview_path.string());
+  return Result::SUCCESS;
+}
+}  // namespace VV
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "core.h"
+#include "update/world.h"
+#include "utils/config.h"
+
+namespace VV {
+/// World preview ///
+// Headless mode that draws a map of an overworld seed for picking seeds and
+// for eyeballing generator changes. It's drawn straight from the generation
+// columns, so no chunks are made and it only shows what the biomes lay out.
+// Structures, flora and creatures aren't on it.
+struct World_Preview_Request {
+  u32 world_seed;
+  Chunk_Coord min, max;  // Chunks from min up to but not including max
+};
+
+// Each pixel is the cell at the bottom left of a square this many cells wide
+constexpr u16 PREVIEW_CELLS_PER_PIXEL = 4;
+
+// What air is drawn over
+constexpr Cell_Palette_Color PREVIEW_SKY_COLOR = {0x87, 0xce, 0xeb, 0xff};
+
+// The cell's color blended over the sky
+Cell_Palette_Color get_preview_color(Cell_Type type, s64 x, s64 y);
+
+// Rows are top first. Needs init_cell_factory.
+void render_world_preview(const World_Preview_Request &request,
+                          std::vector<Cell_Palette_Color> &pixels, u32 &width,
+                          u32 &height);
+
+// Renders the preview and saves it as a bmp in the save dir's previews folder
+Result preview_world(const Config &config,
+                     const World_Preview_Request &request);
+}  // namespace VV
@@ -0,0 +1,176 @@
+#include "update/raycast.h"
+
+#include <cmath>
+#include <future>
+#include <limits>
+
+namespace VV {
+constexpr f64 NEVER = std::numeric_limits<f64>::infinity();
+
+// Chunk a world cell is in. Unlike get_chunk_coord this is exact for cells.
+s32 cell_to_chunk(s64 cell) {
+  return static_cast<s32>(cell >= 0 ? cell / CHUNK_CELL_WIDTH
+                                    : -((-cell + CHUNK_CELL_WIDTH - 1) /
+                                        CHUNK_CELL_WIDTH));
+}
+
+// One axis of the walk
+struct Ray_Axis {
+  s64 cell;
+  s8 step;
+  f64 t_delta;  // Distance along the ray between crossings
+  f64 t_max;    // Distance along the ray to the next crossing
+};
+
+Ray_Axis start_ray_axis(f64 from, f64 dir) {
+  Ray_Axis axis;
+  axis.cell = static_cast<s64>(std::floor(from));
+  if (dir > 0) {
+    axis.step = 1;
+    axis.t_delta = 1.0 / dir;
+    axis.t_max = (axis.cell + 1 - from) / dir;
+  } else if (dir < 0) {
+    axis.step = -1;
+    axis.t_delta = -1.0 / dir;
+    axis.t_max = (from - axis.cell) / -dir;
+  } else {
+    axis.step = 0;
+    axis.t_delta = NEVER;
+    axis.t_max = NEVER;
+  }
+  return axis;
+}
+
+// Crossings until the axis leaves the chunk
+s64 steps_out_of_chunk(const Ray_Axis &axis, s32 chunk) {
+  s64 last_cell = axis.step > 0
+                      ? static_cast<s64>(chunk + 1) * CHUNK_CELL_WIDTH - 1
+                      : static_cast<s64>(chunk) * CHUNK_CELL_WIDTH;
+  return std::abs(last_cell - axis.cell) + 1;
+}
+
+void step_ray_axis(Ray_Axis &axis, s64 steps) {
+  axis.cell += steps * axis.step;
+  axis.t_max += steps * axis.t_delta;
+}
+
+// Moves the ray to where it leaves the chunk it's in and returns how far along
+// the ray that is
+f64 skip_chunk(Ray_Axis &x, Ray_Axis &y, const Chunk_Coord &chunk_coord) {
+  s64 x_steps = steps_out_of_chunk(x, chunk_coord.x);
+  s64 y_steps = steps_out_of_chunk(y, chunk_coord.y);
+  f64 x_exit = x.step == 0 ? NEVER : x.t_max + (x_steps - 1) * x.t_delta;
+  f64 y_exit = y.step == 0 ? NEVER : y.t_max + (y_steps - 1) * y.t_delta;
+
+  // The other axis only has a few crossings left before the exit
+  if (x_exit == NEVER && y_exit == NEVER) {
+    return NEVER;  // Not going anywhere
+  } else if (x_exit < y_exit) {
+    step_ray_axis(x, x_steps);
+    while (y.t_max <= x_exit) {
+      step_ray_axis(y, 1);
+    }
+    return x_exit;
+  } else {
+    step_ray_axis(y, y_steps);
+    while (x.t_max <= y_exit) {
+      step_ray_axis(x, 1);
+    }
+    return y_exit;
+  }
+}
+
+// Whether any of the chunk's cells have a type in the mask
+bool chunk_has_cell_types(const Chunk &chunk, Cell_Type_Mask mask) {
+  for (u16 type = 0; type < CELL_TYPE_COUNT; type++) {
+    if ((mask & cell_type_bit((Cell_Type)type)) && chunk.cell_counts[type]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool raycast(const Dimension &dim, const Ray &ray, Cell_Type_Mask mask,
+             Raycast_Hit &hit) {
+  hit.hit = false;
+
+  f64 dx = ray.to.x - ray.from.x;
+  f64 dy = ray.to.y - ray.from.y;
+  f64 length = std::sqrt(dx * dx + dy * dy);
+  f64 dir_x = length > 0 ? dx / length : 0;
+  f64 dir_y = length > 0 ? dy / length : 0;
+
+  Ray_Axis x = start_ray_axis(ray.from.x, dir_x);
+  Ray_Axis y = start_ray_axis(ray.from.y, dir_y);
+
+  Chunk_Coord chunk_coord = {cell_to_chunk(x.cell), cell_to_chunk(y.cell)};
+  auto chunk_iter = dim.chunks.find(chunk_coord);
+
+  f64 t = 0;
+  while (t <= length) {
+    Chunk_Coord cell_chunk = {cell_to_chunk(x.cell), cell_to_chunk(y.cell)};
+    if (!(cell_chunk == chunk_coord)) {
+      chunk_coord = cell_chunk;
+      chunk_iter = dim.chunks.find(chunk_coord);
+    }
+
+    // Nothing in the chunk can stop the ray, so go right to where it leaves
+    if (chunk_iter == dim.chunks.end() ||
+        !chunk_has_cell_types(chunk_iter->second, mask)) {
+      t = skip_chunk(x, y, chunk_coord);
+      continue;
+    }
+
+    const Chunk &chunk = chunk_iter->second;
+    u32 cell_index =
+        (x.cell - static_cast<s64>(chunk_coord.x) * CHUNK_CELL_WIDTH) +
+        (y.cell - static_cast<s64>(chunk_coord.y) * CHUNK_CELL_WIDTH) *
+            CHUNK_CELL_WIDTH;
+    Cell_Type type = chunk.cells[cell_index].type;
+    if (mask & cell_type_bit(type)) {
+      hit = {true, x.cell, y.cell, type, t};
+      return true;
+    }
+
+    if (x.t_max < y.t_max) {
+      t = x.t_max;
+      step_ray_axis(x, 1);
+    } else {
+      t = y.t_max;
+      step_ray_axis(y, 1);
+    }
+  }
+
+  return false;
+}
+
+void raycast_batch(const Dimension &dim, const std::vector<Ray> &rays,
+                   Cell_Type_Mask mask, std::vector<Raycast_Hit> &hits,
+                   ThreadPool *pool) {
+  hits.resize(rays.size());
+
+  auto cast_range = [&](size_t first, size_t last) {
+    for (size_t ray = first; ray < last; ray++) {
+      raycast(dim, rays[ray], mask, hits[ray]);
+    }
+  };
+
+  // Not worth handing a few rays off to other threads
+  constexpr size_t MIN_RAYS_PER_TASK = 256;
+  constexpr size_t TASKS = 4;  // Same as the cell sim
+  if (pool == nullptr || rays.size() < MIN_RAYS_PER_TASK * 2) {
+    cast_range(0, rays.size());
+    return;
+  }
+
+  size_t per_task = (rays.size() + TASKS - 1) / TASKS;
+  std::vector<std::future<void>> futures;
+  for (size_t first = 0; first < rays.size(); first += per_task) {
+    futures.push_back(pool->enqueue(cast_range, first,
+                                    std::min(first + per_task, rays.size())));
+  }
+  for (std::future<void> &future : futures) {
+    future.get();
+  }
+}
+}  // namespace VV
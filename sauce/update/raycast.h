@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+
+#include "core.h"
+#include "update/entity.h"
+#include "update/world.h"
+#include "utils/threadpool.h"
+
+namespace VV {
+/// Raycasting ///
+// Walks a ray through every cell it passes over in order (a grid DDA) and
+// stops at the first one with a type in the mask. Chunks that aren't loaded,
+// or that have none of the mask's types in them, are crossed in one step
+// instead of a cell at a time.
+
+struct Ray {
+  Entity_Coord from, to;
+};
+
+struct Raycast_Hit {
+  bool hit;
+  s64 x, y;  // The cell that stopped the ray
+  Cell_Type type;
+  f64 distance;  // In cells from the ray's start to where it entered the cell.
+                 // 0 if it started inside it.
+};
+
+// Returns true if something in the mask is between from and to
+bool raycast(const Dimension &dim, const Ray &ray, Cell_Type_Mask mask,
+             Raycast_Hit &hit);
+
+// hits ends up lined up with rays. With a pool the rays are split up between
+// its workers. Nothing can be changing the dimension's cells meanwhile.
+void raycast_batch(const Dimension &dim, const std::vector<Ray> &rays,
+                   Cell_Type_Mask mask, std::vector<Raycast_Hit> &hits,
+                   ThreadPool *pool = nullptr);
+}  // namespace VV
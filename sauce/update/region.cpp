@@ -0,0 +1,564 @@
+#include "update/region.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "update/update.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#error "Unsupported platform"
+#endif
+
+namespace VV {
+bool Region_Key::operator<(const Region_Key &b) const {
+  if (dim != b.dim) {
+    return dim < b.dim;
+  }
+  return x < b.x || (x == b.x && y < b.y);
+}
+
+bool Saved_Chunk_Key::operator<(const Saved_Chunk_Key &b) const {
+  if (dim != b.dim) {
+    return dim < b.dim;
+  }
+  return coord < b.coord;
+}
+
+Region_Key get_region_key(DimensionIndex dim, const Chunk_Coord &coord) {
+  return {dim, floor_div(coord.x, REGION_CHUNK_WIDTH),
+          floor_div(coord.y, REGION_CHUNK_WIDTH)};
+}
+
+u32 get_region_entry_index(const Chunk_Coord &coord) {
+  const s32 W = REGION_CHUNK_WIDTH;
+  u32 local_x = ((coord.x % W) + W) % W;
+  u32 local_y = ((coord.y % W) + W) % W;
+  return local_x + local_y * W;
+}
+
+/// Mapping ///
+// NOTE: Like config.cpp, platform specific includes for this are at the top of
+// the file.
+Region_Mapping::~Region_Mapping() {
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+  CloseHandle(static_cast<HANDLE>(os_mapping));
+#else
+  munmap(const_cast<u8 *>(data), size);
+#endif
+}
+
+Result map_region(const std::filesystem::path &path,
+                  std::shared_ptr<const Region_Mapping> &mapping) {
+  mapping.reset();
+
+  auto new_mapping = std::make_shared<Region_Mapping>();
+
+#ifdef _WIN32
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return Result::NONEXIST;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return Result::NONEXIST;
+  }
+
+  HANDLE os_mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);  // The mapping keeps the file open
+  if (os_mapping == NULL) {
+    LOG_WARN("Failed to map region file {}", path.string());
+    return Result::OS_ERROR;
+  }
+
+  void *view = MapViewOfFile(os_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(os_mapping);
+    LOG_WARN("Failed to map region file {}", path.string());
+    return Result::OS_ERROR;
+  }
+
+  new_mapping->data = static_cast<const u8 *>(view);
+  new_mapping->size = static_cast<size_t>(file_size.QuadPart);
+  new_mapping->os_mapping = os_mapping;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Result::NONEXIST;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return Result::NONEXIST;
+  }
+
+  void *view =
+      mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // The mapping keeps the file open
+  if (view == MAP_FAILED) {
+    LOG_WARN("Failed to map region file {}", path.string());
+    return Result::OS_ERROR;
+  }
+
+  new_mapping->data = static_cast<const u8 *>(view);
+  new_mapping->size = static_cast<size_t>(file_stat.st_size);
+  new_mapping->os_mapping = nullptr;
+#endif
+
+  const Region_Header *header =
+      reinterpret_cast<const Region_Header *>(new_mapping->data);
+  if (new_mapping->size < sizeof(Region_Header) ||
+      header->magic != REGION_MAGIC || header->version != REGION_VERSION ||
+      header->chunk_width != REGION_CHUNK_WIDTH) {
+    LOG_WARN("Region file {} has a bad header. Ignoring it.", path.string());
+    return Result::VALUE_ERROR;
+  }
+
+  mapping = std::move(new_mapping);
+
+  return Result::SUCCESS;
+}
+
+// Expects save.mutex to be held
+Region_File &get_region(World_Save &save, const Region_Key &key) {
+  auto region_iter = save.regions.find(key);
+  if (region_iter != save.regions.end()) {
+    return region_iter->second;
+  }
+
+  Region_File &region = save.regions[key];
+  region.path = save.dir / fmt::format("r.{}.{}.{}.vvr",
+                                       static_cast<u32>(key.dim), key.x, key.y);
+  map_region(region.path, region.mapping);
+
+  return region;
+}
+
+Result open_world_save(World_Save &save, const std::filesystem::path &dir) {
+  save.enabled = false;
+  save.dir = dir;
+
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (ec) {
+    LOG_WARN("Couldn't create save directory {}: {}", dir.string(),
+             ec.message());
+    return Result::FILESYSTEM_ERROR;
+  }
+
+  save.enabled = true;
+  LOG_INFO("Saving world to {}", dir.string());
+
+  return Result::SUCCESS;
+}
+
+void close_world_save(World_Save &save) {
+  std::lock_guard<std::mutex> flush_lock(save.flush_mutex);
+  std::lock_guard<std::mutex> lock(save.mutex);
+  if (!save.pending.empty()) {
+    LOG_WARN("Closing world save with {} unwritten chunks",
+             save.pending.size());
+  }
+  save.pending.clear();
+  save.regions.clear();
+  save.enabled = false;
+}
+
+/// Chunk payloads ///
+template <typename T>
+inline void write_bytes(std::vector<u8> &out, const T &value) {
+  const u8 *bytes = reinterpret_cast<const u8 *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+inline bool read_bytes(const u8 *data, size_t size, size_t &cursor, T &value) {
+  if (cursor + sizeof(T) > size) {
+    return false;
+  }
+  std::memcpy(&value, data + cursor, sizeof(T));
+  cursor += sizeof(T);
+  return true;
+}
+
+void encode_chunk(const Chunk &chunk, const std::vector<Saved_Entity> &entities,
+                  std::vector<u8> &out) {
+  out.clear();
+
+  // Palette of the types in this chunk
+  static thread_local s16 palette_index[MAX_CELL_TYPES];
+  std::vector<u16> palette;
+  for (u32 cell = 0; cell < CHUNK_CELLS; cell++) {
+    u16 type = static_cast<u16>(chunk.cells[cell].type);
+    if (palette.empty() || palette_index[type] < 0 ||
+        palette_index[type] >= static_cast<s16>(palette.size()) ||
+        palette[palette_index[type]] != type) {
+      palette_index[type] = static_cast<s16>(palette.size());
+      palette.push_back(type);
+    }
+  }
+
+  // One byte indices unless the chunk is very colorful
+  u8 index_width = palette.size() > 256 ? 2 : 1;
+
+  write_bytes(out, static_cast<u16>(chunk.all_cell));
+  write_bytes(out, static_cast<u16>(palette.size()));
+  write_bytes(out, index_width);
+  for (u16 type : palette) {
+    write_bytes(out, type);
+  }
+
+  // Runs
+  size_t run_count_pos = out.size();
+  write_bytes(out, static_cast<u16>(0));
+
+  u16 run_count = 0;
+  u32 cell = 0;
+  while (cell < CHUNK_CELLS) {
+    Cell_Type type = chunk.cells[cell].type;
+    u16 run_length = 1;
+    while (cell + run_length < CHUNK_CELLS &&
+           chunk.cells[cell + run_length].type == type) {
+      run_length++;
+    }
+
+    u16 index = palette_index[static_cast<u16>(type)];
+    if (index_width == 1) {
+      write_bytes(out, static_cast<u8>(index));
+    } else {
+      write_bytes(out, index);
+    }
+    write_bytes(out, run_length);
+
+    run_count++;
+    cell += run_length;
+  }
+  std::memcpy(out.data() + run_count_pos, &run_count, sizeof(run_count));
+
+  // Entities
+  write_bytes(out, static_cast<u16>(entities.size()));
+  for (const Saved_Entity &e : entities) {
+    write_bytes(out, static_cast<u16>(e.type));
+    write_bytes(out, e.coord.x);
+    write_bytes(out, e.coord.y);
+    write_bytes(out, static_cast<u8>(e.texture));
+    write_bytes(out, static_cast<u8>(e.flipped));
+    write_bytes(out, e.health);
+  }
+
+  write_bytes(out, static_cast<u8>(chunk.gen_stage));
+}
+
+Result decode_chunk(const u8 *data, size_t size, Chunk &chunk,
+                    std::vector<Saved_Entity> &entities) {
+  size_t cursor = 0;
+
+  u16 all_cell, palette_size;
+  u8 index_width;
+  if (!read_bytes(data, size, cursor, all_cell) ||
+      !read_bytes(data, size, cursor, palette_size) ||
+      !read_bytes(data, size, cursor, index_width) || palette_size == 0 ||
+      (index_width != 1 && index_width != 2)) {
+    return Result::VALUE_ERROR;
+  }
+
+  std::vector<Cell_Type> palette(palette_size);
+  for (Cell_Type &type : palette) {
+    u16 raw_type;
+    if (!read_bytes(data, size, cursor, raw_type) ||
+        raw_type >= CELL_TYPE_COUNT) {
+      return Result::VALUE_ERROR;
+    }
+    type = static_cast<Cell_Type>(raw_type);
+  }
+
+  u16 run_count;
+  if (!read_bytes(data, size, cursor, run_count)) {
+    return Result::VALUE_ERROR;
+  }
+
+  // A chunk that's a single run shares the uniform cells for its type
+  bool uniform = run_count == 1;
+  if (!uniform) {
+    alloc_chunk_cells(chunk);
+  }
+
+  u32 cell = 0;
+  for (u16 run = 0; run < run_count; run++) {
+    u16 index, run_length;
+    if (index_width == 1) {
+      u8 small_index;
+      if (!read_bytes(data, size, cursor, small_index)) {
+        return Result::VALUE_ERROR;
+      }
+      index = small_index;
+    } else if (!read_bytes(data, size, cursor, index)) {
+      return Result::VALUE_ERROR;
+    }
+
+    if (!read_bytes(data, size, cursor, run_length) || index >= palette_size ||
+        cell + run_length > CHUNK_CELLS) {
+      return Result::VALUE_ERROR;
+    }
+
+    if (uniform) {
+      set_chunk_uniform(chunk, palette[index]);
+    } else {
+      fill_cells(chunk, cell, run_length, palette[index]);
+    }
+    cell += run_length;
+  }
+
+  if (cell != CHUNK_CELLS) {
+    return Result::VALUE_ERROR;
+  }
+
+  u16 entity_count;
+  if (!read_bytes(data, size, cursor, entity_count)) {
+    return Result::VALUE_ERROR;
+  }
+
+  entities.clear();
+  entities.reserve(entity_count);
+  for (u16 i = 0; i < entity_count; i++) {
+    Saved_Entity e;
+    u16 type;
+    u8 texture, flipped;
+    if (!read_bytes(data, size, cursor, type) ||
+        !read_bytes(data, size, cursor, e.coord.x) ||
+        !read_bytes(data, size, cursor, e.coord.y) ||
+        !read_bytes(data, size, cursor, texture) ||
+        !read_bytes(data, size, cursor, flipped) ||
+        !read_bytes(data, size, cursor, e.health)) {
+      return Result::VALUE_ERROR;
+    }
+    e.type = static_cast<Entity_Factory_Type>(type);
+    e.texture = static_cast<Texture_Id>(texture);
+    e.flipped = flipped != 0;
+    entities.push_back(e);
+  }
+
+  // Chunks saved before generation had stages were always finished
+  u8 gen_stage = static_cast<u8>(Gen_Stage::POPULATED);
+  if (cursor < size && (!read_bytes(data, size, cursor, gen_stage) ||
+                        gen_stage > static_cast<u8>(Gen_Stage::POPULATED))) {
+    return Result::VALUE_ERROR;
+  }
+  chunk.gen_stage = static_cast<Gen_Stage>(gen_stage);
+
+  return Result::SUCCESS;
+}
+
+/// Region reads and writes ///
+Result read_region_chunk(World_Save &save, DimensionIndex dim,
+                         const Chunk_Coord &coord, Chunk &chunk,
+                         std::vector<Saved_Entity> &entities) {
+  if (!save.enabled) {
+    return Result::NONEXIST;
+  }
+
+  std::shared_ptr<const Chunk_Snapshot> snapshot;
+  std::shared_ptr<const Region_Mapping> mapping;
+  std::filesystem::path path;
+  {
+    std::lock_guard<std::mutex> lock(save.mutex);
+
+    auto pending_iter = save.pending.find({dim, coord});
+    if (pending_iter != save.pending.end()) {
+      snapshot = pending_iter->second;
+    } else {
+      Region_File &region = get_region(save, get_region_key(dim, coord));
+      mapping = region.mapping;
+      path = region.path;
+    }
+  }
+
+  if (snapshot != nullptr) {
+    chunk.cells = snapshot->chunk.cells;
+    std::copy(std::begin(snapshot->chunk.cell_counts),
+              std::end(snapshot->chunk.cell_counts),
+              std::begin(chunk.cell_counts));
+    chunk.classes = snapshot->chunk.classes;
+    chunk.all_cell = snapshot->chunk.all_cell;
+    chunk.gen_stage = snapshot->chunk.gen_stage;
+    entities = snapshot->entities;
+    return Result::SUCCESS;
+  }
+
+  if (mapping == nullptr) {
+    return Result::NONEXIST;
+  }
+
+  const Region_Header *header =
+      reinterpret_cast<const Region_Header *>(mapping->data);
+  const Region_Entry &entry = header->entries[get_region_entry_index(coord)];
+  if (entry.offset == 0) {
+    return Result::NONEXIST;
+  }
+
+  if (static_cast<size_t>(entry.offset) + entry.size > mapping->size) {
+    LOG_WARN("Chunk {}, {} runs past the end of {}", coord.x, coord.y,
+             path.string());
+    return Result::VALUE_ERROR;
+  }
+
+  Result decode_res =
+      decode_chunk(mapping->data + entry.offset, entry.size, chunk, entities);
+  if (decode_res != Result::SUCCESS) {
+    LOG_WARN("Chunk {}, {} in {} is corrupt", coord.x, coord.y, path.string());
+  }
+
+  return decode_res;
+}
+
+void queue_chunk_save(World_Save &save, DimensionIndex dim,
+                      std::shared_ptr<const Chunk_Snapshot> snapshot) {
+  if (!save.enabled) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(save.mutex);
+  save.pending[{dim, snapshot->chunk.coord}] = std::move(snapshot);
+}
+
+using Pending_Save =
+    std::pair<Saved_Chunk_Key, std::shared_ptr<const Chunk_Snapshot>>;
+
+// Builds and writes one region. Chunks that aren't being replaced are carried
+// over from the old mapping. Only takes save.mutex to swap the files.
+Result write_region(World_Save &save, const Region_Key &key,
+                    const std::vector<Pending_Save> &saves) {
+  std::filesystem::path path;
+  std::shared_ptr<const Region_Mapping> old_mapping;
+  {
+    std::lock_guard<std::mutex> lock(save.mutex);
+    Region_File &region = get_region(save, key);
+    path = region.path;
+    old_mapping = region.mapping;
+  }
+
+  std::vector<std::vector<u8>> encoded(saves.size());
+  const std::vector<u8> *replacements[REGION_CHUNKS] = {};
+  for (size_t i = 0; i < saves.size(); i++) {
+    const Chunk_Snapshot &snapshot = *saves[i].second;
+    encode_chunk(snapshot.chunk, snapshot.entities, encoded[i]);
+    replacements[get_region_entry_index(snapshot.chunk.coord)] = &encoded[i];
+  }
+
+  const Region_Header *old_header =
+      old_mapping != nullptr
+          ? reinterpret_cast<const Region_Header *>(old_mapping->data)
+          : nullptr;
+
+  std::vector<u8> file(sizeof(Region_Header));
+  Region_Header header;
+  std::memset(&header, 0, sizeof(Region_Header));
+  header.magic = REGION_MAGIC;
+  header.version = REGION_VERSION;
+  header.chunk_width = REGION_CHUNK_WIDTH;
+
+  for (u32 entry = 0; entry < REGION_CHUNKS; entry++) {
+    const u8 *payload = nullptr;
+    size_t payload_size = 0;
+
+    if (replacements[entry] != nullptr) {
+      payload = replacements[entry]->data();
+      payload_size = replacements[entry]->size();
+    } else if (old_header != nullptr &&
+               old_header->entries[entry].offset != 0 &&
+               static_cast<size_t>(old_header->entries[entry].offset) +
+                       old_header->entries[entry].size <=
+                   old_mapping->size) {
+      payload = old_mapping->data + old_header->entries[entry].offset;
+      payload_size = old_header->entries[entry].size;
+    }
+
+    if (payload == nullptr) {
+      continue;
+    }
+
+    header.entries[entry].offset = static_cast<u32>(file.size());
+    header.entries[entry].size = static_cast<u32>(payload_size);
+    file.insert(file.end(), payload, payload + payload_size);
+  }
+  std::memcpy(file.data(), &header, sizeof(Region_Header));
+
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream tmp_file(tmp_path, std::ios::binary | std::ios::trunc);
+    tmp_file.write(reinterpret_cast<const char *>(file.data()), file.size());
+    if (!tmp_file.good()) {
+      LOG_ERROR("Failed to write region file {}", tmp_path.string());
+      return Result::FILESYSTEM_ERROR;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(save.mutex);
+  Region_File &region = save.regions[key];
+
+  // Windows won't replace a file that's still mapped
+  region.mapping.reset();
+  old_mapping.reset();
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  map_region(path, region.mapping);
+  if (ec) {
+    LOG_ERROR("Failed to replace region file {}: {}", path.string(),
+              ec.message());
+    return Result::FILESYSTEM_ERROR;
+  }
+
+  // Anything queued again while we were writing has to wait for the next
+  // flush
+  for (const auto &[chunk_key, snapshot] : saves) {
+    auto pending_iter = save.pending.find(chunk_key);
+    if (pending_iter != save.pending.end() &&
+        pending_iter->second == snapshot) {
+      save.pending.erase(pending_iter);
+    }
+  }
+
+  return Result::SUCCESS;
+}
+
+Result flush_world_save(World_Save &save) {
+  if (!save.enabled) {
+    return Result::SUCCESS;
+  }
+
+  std::lock_guard<std::mutex> flush_lock(save.flush_mutex);
+
+  std::map<Region_Key, std::vector<Pending_Save>> by_region;
+  {
+    std::lock_guard<std::mutex> lock(save.mutex);
+    for (const auto &[chunk_key, snapshot] : save.pending) {
+      by_region[get_region_key(chunk_key.dim, chunk_key.coord)].emplace_back(
+          chunk_key, snapshot);
+    }
+  }
+
+  Result ret = Result::SUCCESS;
+  for (const auto &[key, saves] : by_region) {
+    Result write_res = write_region(save, key, saves);
+    if (write_res != Result::SUCCESS) {
+      ret = write_res;
+    }
+  }
+
+  return ret;
+}
+}  // namespace VV
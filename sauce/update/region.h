@@ -0,0 +1,134 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "core.h"
+#include "update/entity.h"
+#include "update/world.h"
+
+namespace VV {
+/// Region files ///
+// Chunks are saved in region files, each holding a square of
+// REGION_CHUNK_WIDTH * REGION_CHUNK_WIDTH chunks. The file starts with a
+// header and an offset table with one entry per chunk, followed by the chunk
+// payloads. Everything is written in native byte order.
+//
+// A chunk payload is the chunk's cell types run length encoded against a small
+// palette of the types that actually appear in the chunk, followed by the
+// entities that were living in it and the generation stage it got to. Cell
+// colors aren't saved, they're picked again from the type palettes on load.
+//
+// Region files are memory mapped while the world is open, so loading a chunk
+// decodes straight out of the mapping.
+//
+// Saving is split in two so the update thread never touches the disk. Chunks
+// are copied into snapshots and queued with queue_chunk_save, then
+// flush_world_save encodes them and rewrites their regions, normally on a
+// worker thread. Reads check the queue before the region files, so a chunk
+// that's evicted and loaded again before the flush still comes back as it was
+// left.
+constexpr s32 REGION_CHUNK_WIDTH = 32;
+constexpr u32 REGION_CHUNKS = REGION_CHUNK_WIDTH * REGION_CHUNK_WIDTH;
+
+constexpr u32 REGION_MAGIC = 0x47525656;  // "VVRG"
+constexpr u16 REGION_VERSION = 1;
+
+struct Region_Entry {
+  u32 offset;  // From the start of the file. 0 means the chunk isn't saved
+  u32 size;
+};
+
+struct Region_Header {
+  u32 magic;
+  u16 version;
+  u16 chunk_width;
+  Region_Entry entries[REGION_CHUNKS];
+};
+
+struct Region_Key {
+  DimensionIndex dim;
+  s32 x, y;
+
+  bool operator<(const Region_Key &b) const;
+};
+
+Region_Key get_region_key(DimensionIndex dim, const Chunk_Coord &coord);
+u32 get_region_entry_index(const Chunk_Coord &coord);
+
+// Unmapped when the last reference goes away, so a flush can swap in a new
+// mapping while a read is still decoding out of the old one.
+struct Region_Mapping {
+  const u8 *data;
+  size_t size;
+  void *os_mapping;  // Only used on windows
+
+  ~Region_Mapping();
+};
+
+struct Region_File {
+  std::filesystem::path path;
+  std::shared_ptr<const Region_Mapping>
+      mapping;  // nullptr if the region hasn't been saved yet
+};
+
+// What's needed to bring an entity back from a save
+struct Saved_Entity {
+  Entity_Factory_Type type;
+  Entity_Coord coord;
+  Texture_Id texture;
+  bool flipped;
+  s64 health;
+};
+
+// A copy of a chunk and its entities taken on the update thread. The cells
+// are shared with the live chunk, which copies them before its next write.
+struct Chunk_Snapshot {
+  Chunk chunk;
+  std::vector<Saved_Entity> entities;
+};
+
+struct Saved_Chunk_Key {
+  DimensionIndex dim;
+  Chunk_Coord coord;
+
+  bool operator<(const Saved_Chunk_Key &b) const;
+};
+
+struct World_Save {
+  bool enabled;
+  std::filesystem::path dir;
+
+  std::map<Region_Key, Region_File> regions;
+  std::map<Saved_Chunk_Key, std::shared_ptr<const Chunk_Snapshot>>
+      pending;  // Queued snapshots that haven't been flushed yet
+  std::mutex mutex;        // Guards regions and pending. Only held briefly
+  std::mutex flush_mutex;  // Held for a whole flush_world_save
+};
+
+Result open_world_save(World_Save &save, const std::filesystem::path &dir);
+// Flush first. Anything still pending is dropped.
+void close_world_save(World_Save &save);
+
+void encode_chunk(const Chunk &chunk, const std::vector<Saved_Entity> &entities,
+                  std::vector<u8> &out);
+Result decode_chunk(const u8 *data, size_t size, Chunk &chunk,
+                    std::vector<Saved_Entity> &entities);
+
+// Fills in the chunk's cells, all_cell and gen_stage. Returns
+// Result::NONEXIST if the chunk has never been saved.
+Result read_region_chunk(World_Save &save, DimensionIndex dim,
+                         const Chunk_Coord &coord, Chunk &chunk,
+                         std::vector<Saved_Entity> &entities);
+// Replaces anything already queued for the same chunk
+void queue_chunk_save(World_Save &save, DimensionIndex dim,
+                      std::shared_ptr<const Chunk_Snapshot> snapshot);
+// Writes everything queued so far. Each touched region is written to a
+// temporary file and renamed over the old one, so a crash mid write leaves the
+// previous version intact. Snapshots that fail to write stay queued for the
+// next flush.
+Result flush_world_save(World_Save &save);
+}  // namespace VV
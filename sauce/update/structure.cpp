@@ -0,0 +1,223 @@
+#include "update/structure.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "rapidjson/document.h"
+#include "update/update.h"
+
+namespace rj = rapidjson;
+
+namespace VV {
+bool string_to_biome(const std::string &str, Biome &biome) {
+  if (str == "FOREST") {
+    biome = Biome::FOREST;
+  } else if (str == "ALASKA") {
+    biome = Biome::ALASKA;
+  } else if (str == "OCEAN") {
+    biome = Biome::OCEAN;
+  } else if (str == "NICARAGUA") {
+    biome = Biome::NICARAGUA;
+  } else if (str == "DEEP_OCEAN") {
+    biome = Biome::DEEP_OCEAN;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+// Fills in the cells and spans from the rows and the cell map. Returns false
+// if the rows don't make a rectangle that fits in a slot.
+bool bake_structure_rows(Structure_Prefab &prefab,
+                         const std::vector<std::string> &rows,
+                         const std::map<char, Cell_Type> &cell_map) {
+  if (rows.empty() || rows[0].empty() ||
+      rows[0].size() > STRUCTURE_SLOT_CELLS) {
+    return false;
+  }
+
+  prefab.width = rows[0].size();
+  prefab.height = rows.size();
+  prefab.cells.resize(prefab.width * prefab.height);
+  prefab.spans.resize(prefab.height);
+
+  for (u16 y = 0; y < prefab.height; y++) {
+    const std::string &row = rows[prefab.height - 1 - y];
+    if (row.size() != prefab.width) {
+      return false;
+    }
+
+    std::vector<Structure_Span> &spans = prefab.spans[y];
+    for (u16 x = 0; x < prefab.width; x++) {
+      auto cell_type = cell_map.find(row[x]);
+      if (cell_type == cell_map.end()) {
+        prefab.cells[y * prefab.width + x] = create_cell(Cell_Type::NONE);
+        continue;
+      }
+
+      prefab.cells[y * prefab.width + x] = create_cell(cell_type->second);
+      if (!spans.empty() && spans.back().x + spans.back().length == x) {
+        spans.back().length++;
+      } else {
+        spans.push_back({x, 1});
+      }
+    }
+  }
+
+  return true;
+}
+
+Result init_structures(std::vector<Structure_Prefab> &structures,
+                       std::filesystem::path structures_json) {
+  std::ifstream f_sjson(structures_json, std::ifstream::ate);
+  if (!f_sjson.is_open() || !f_sjson.good()) {
+    return Result::FILESYSTEM_ERROR;
+  }
+
+  std::streamsize size = f_sjson.tellg();
+  f_sjson.seekg(0, std::ios::beg);
+  std::vector<char> json_data(size + 1, '\0');
+
+  if (!f_sjson.read(json_data.data(), size)) {
+    return Result::FILESYSTEM_ERROR;
+  }
+
+  rj::Document d;
+  d.Parse(json_data.data());
+  if (d.HasParseError() || !d.IsObject()) {
+    LOG_ERROR("Structures file isn't a json object");
+    return Result::RAPIDJSON_ERROR;
+  }
+
+  structures.clear();
+  for (auto &structure_desc : d.GetObject()) {
+    if (!structure_desc.value.IsObject()) {
+      LOG_WARN("Structure descriptor {} is not an object!",
+               structure_desc.name.GetString());
+      continue;
+    }
+
+    Structure_Prefab prefab;
+    prefab.name = structure_desc.name.GetString();
+    prefab.biome = Biome::FOREST;
+    prefab.chance = 0;
+    prefab.sink = 0;
+
+    std::vector<std::string> rows;
+    std::map<char, Cell_Type> cell_map;
+    bool bad_item = false;
+
+    for (auto &structure_item : structure_desc.value.GetObject()) {
+      std::string structure_item_name = structure_item.name.GetString();
+
+      if (structure_item_name == "biome") {
+        if (!string_to_biome(structure_item.value.GetString(), prefab.biome)) {
+          LOG_WARN("Structure {} has unknown biome {}", prefab.name,
+                   structure_item.value.GetString());
+          bad_item = true;
+        }
+      } else if (structure_item_name == "chance") {
+        prefab.chance = std::min(structure_item.value.GetUint(), 100u);
+      } else if (structure_item_name == "sink") {
+        prefab.sink = structure_item.value.GetUint();
+      } else if (structure_item_name == "cells") {
+        for (auto &cell_item : structure_item.value.GetObject()) {
+          const char *key = cell_item.name.GetString();
+          if (strlen(key) != 1) {
+            LOG_WARN("Structure {} cell key {} isn't one character",
+                     prefab.name, key);
+            bad_item = true;
+            continue;
+          }
+          cell_map[key[0]] = string_to_cell_type(cell_item.value.GetString());
+        }
+      } else if (structure_item_name == "rows") {
+        for (auto &row : structure_item.value.GetArray()) {
+          rows.emplace_back(row.GetString());
+        }
+      } else if (structure_item_name == "entities") {
+        if (!structure_item.value.IsArray()) {
+          LOG_WARN("Structure {} entities is not an array!", prefab.name);
+          bad_item = true;
+          continue;
+        }
+
+        for (auto &entity_item : structure_item.value.GetArray()) {
+          if (!entity_item.IsObject() || !entity_item.HasMember("type") ||
+              !entity_item["type"].IsString() || !entity_item.HasMember("x") ||
+              !entity_item["x"].IsInt() || !entity_item.HasMember("y") ||
+              !entity_item["y"].IsInt()) {
+            LOG_WARN("Structure {} has an entity without a type, x and y",
+                     prefab.name);
+            bad_item = true;
+            continue;
+          }
+
+          Structure_Entity entity;
+          if (!string_to_entity_factory_type(entity_item["type"].GetString(),
+                                             entity.type)) {
+            LOG_WARN("Structure {} has unknown entity {}", prefab.name,
+                     entity_item["type"].GetString());
+            bad_item = true;
+            continue;
+          }
+          entity.x = entity_item["x"].GetInt();
+          entity.y = entity_item["y"].GetInt();
+          prefab.entities.push_back(entity);
+        }
+      }
+    }
+
+    if (bad_item || !bake_structure_rows(prefab, rows, cell_map)) {
+      LOG_WARN("Skipping bad structure {}", prefab.name);
+      continue;
+    }
+
+    structures.push_back(std::move(prefab));
+  }
+
+  LOG_INFO("Parsed {} structures from structure file", structures.size());
+  return Result::SUCCESS;
+}
+
+void stamp_structure(Chunk &chunk, const Structure_Placement &placement) {
+  const Structure_Prefab &prefab = *placement.prefab;
+  s64 chunk_x = static_cast<s64>(chunk.coord.x) * CHUNK_CELL_WIDTH;
+  s64 chunk_y = static_cast<s64>(chunk.coord.y) * CHUNK_CELL_WIDTH;
+
+  // Prefab rows and columns that land in the chunk
+  s64 min_x = std::max<s64>(chunk_x - placement.x, 0);
+  s64 max_x = std::min<s64>(chunk_x + CHUNK_CELL_WIDTH - placement.x,
+                            prefab.width);
+  s64 min_y = std::max<s64>(chunk_y - placement.y, 0);
+  s64 max_y = std::min<s64>(chunk_y + CHUNK_CELL_WIDTH - placement.y,
+                            prefab.height);
+  if (min_x >= max_x || min_y >= max_y) {
+    return;
+  }
+
+  make_chunk_writable(chunk);
+
+  for (s64 y = min_y; y < max_y; y++) {
+    const Cell *prefab_row = &prefab.cells[y * prefab.width];
+    Cell *chunk_row =
+        &chunk.cells[(placement.y + y - chunk_y) * CHUNK_CELL_WIDTH];
+
+    for (const Structure_Span &span : prefab.spans[y]) {
+      s64 first = std::max<s64>(span.x, min_x);
+      s64 last = std::min<s64>(span.x + span.length, max_x);
+      if (first >= last) {
+        continue;
+      }
+
+      Cell *stamped = chunk_row + (placement.x + first - chunk_x);
+      for (s64 x = first; x < last; x++) {
+        count_cell_change(chunk, &stamped[x - first] - chunk.cells.get(),
+                          stamped[x - first].type, prefab_row[x].type);
+      }
+      std::copy(prefab_row + first, prefab_row + last, stamped);
+    }
+  }
+}
+}  // namespace VV
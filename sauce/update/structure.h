@@ -0,0 +1,67 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "core.h"
+#include "update/entity.h"
+#include "update/world.h"
+
+namespace VV {
+/// Structures ///
+// Prefab buildings stamped into the world during generation. They're loaded
+// from res/structures.json, which looks like:
+//
+// "hut": {
+//   "biome": "FOREST",     // Only placed where it fits in this biome
+//   "chance": 30,          // Percent of slots it's tried in that get it
+//   "sink": 2,             // Cells it's sunk into the ground
+//   "cells": {"#": "DIRT", ".": "AIR"},
+//   "rows": ["  ##  ",     // Top row first. Characters that aren't in
+//            " #..# "],    // cells leave the world as it was
+//   "entities": [{"type": "bush", "x": 3, "y": 20}]
+// }
+
+// A run of cells in a prefab row that get stamped
+struct Structure_Span {
+  u16 x;
+  u16 length;
+};
+
+struct Structure_Entity {
+  Entity_Factory_Type type;
+  s16 x, y;  // Entity coord from the bottom left of the prefab
+};
+
+struct Structure_Prefab {
+  std::string name;
+  Biome biome;
+  u8 chance;
+  u16 sink;
+  u16 width, height;
+  // Bottom row first, so stamping a row is just a copy
+  std::vector<Cell> cells;
+  std::vector<std::vector<Structure_Span>> spans;  // By row, like cells
+  std::vector<Structure_Entity> entities;
+};
+
+// The world is split into slots this many chunks wide, each of which can have
+// one structure somewhere inside it. That way finding the structures that
+// touch a chunk only takes a look at the chunk's slot.
+constexpr s32 STRUCTURE_SLOT_CHUNKS = 4;
+constexpr s32 STRUCTURE_SLOT_CELLS = STRUCTURE_SLOT_CHUNKS * CHUNK_CELL_WIDTH;
+
+struct Structure_Placement {
+  const Structure_Prefab *prefab;
+  s64 x, y;  // World cell of the prefab's bottom left
+};
+
+// Prefabs that don't make sense are skipped with a warning
+Result init_structures(std::vector<Structure_Prefab> &structures,
+                       std::filesystem::path structures_json);
+
+// Copies the part of the placement that's inside the chunk into it. The
+// chunk's coord has to be set.
+void stamp_structure(Chunk &chunk, const Structure_Placement &placement);
+}  // namespace VV
@@ -1,5 +1,6 @@
 #include "update/update.h"
 
+#include <algorithm>
 #include <fstream>
 #include <optional>
 #include <regex>
@@ -20,6 +21,8 @@ namespace VV {
 
 Cell default_cells[MAX_CELL_TYPES];
 Cell_Type_Info cell_type_infos[MAX_CELL_TYPES];
+// Shared cells for uniform chunks. See set_chunk_uniform
+std::shared_ptr<Cell[]> uniform_cells[MAX_CELL_TYPES];
 
 Result init_cell_factory(std::filesystem::path factory_json_path) {
   std::ifstream f_fjson(factory_json_path, std::ifstream::ate);
@@ -80,6 +83,8 @@ Result init_cell_factory(std::filesystem::path factory_json_path) {
         0,                // viscosity
         {default_color},  // colors
         1,                // num_colors
+        {},               // palette: baked after parsing
+        {},               // average_color: baked with the palette
     };
 
     for (auto &cell_item : cell_desc.value.GetObject()) {
@@ -178,7 +183,13 @@ Result init_cell_factory(std::filesystem::path factory_json_path) {
         cell_info.num_colors = i;
       }  // Cell else if chain
     }    // Cell item loop
-  }      // Cell loop
+
+    bake_cell_palette(cell_info, static_cast<u32>(this_cell_type));
+
+    std::shared_ptr<Cell[]> &uniform = uniform_cells[(u16)this_cell_type];
+    uniform.reset(new Cell[CHUNK_CELLS]);
+    std::fill_n(uniform.get(), CHUNK_CELLS, create_cell(this_cell_type));
+  }  // Cell loop
 
   LOG_INFO("Parsed {} cell objects from cell factory file",
            cell_types_processed);
@@ -214,29 +225,7 @@ Result init_entity_factory(Update_State &us,
 
     std::string entity_name = entity_desc.name.GetString();
     Entity_Factory_Type entity_type;
-    if (entity_name == "guyplayer") {
-      entity_type = Entity_Factory_Type::GUYPLAYER;
-    } else if (entity_name == "tree") {
-      entity_type = Entity_Factory_Type::TREE;
-    } else if (entity_name == "bush") {
-      entity_type = Entity_Factory_Type::BUSH;
-    } else if (entity_name == "grass") {
-      entity_type = Entity_Factory_Type::GRASS;
-    } else if (entity_name == "nietzsche") {
-      entity_type = Entity_Factory_Type::NIETZSCHE;
-    } else if (entity_name == "aknietzsche") {
-      entity_type = Entity_Factory_Type::AKNIETZSCHE;
-    } else if (entity_name == "ecnietzsche") {
-      entity_type = Entity_Factory_Type::ECNIETZSCHE;
-    } else if (entity_name == "sdnietzsche") {
-      entity_type = Entity_Factory_Type::SDNIETZSCHE;
-    } else if (entity_name == "jellyfish") {
-      entity_type = Entity_Factory_Type::JELLYFISH;
-    } else if (entity_name == "seaweed") {
-      entity_type = Entity_Factory_Type::SEAWEED;
-    } else if (entity_name == "fish") {
-      entity_type = Entity_Factory_Type::FISH;
-    } else {
+    if (!string_to_entity_factory_type(entity_name, entity_type)) {
       LOG_WARN("Unknown entity in descriptor file: {}", entity_name);
       continue;
     }
@@ -245,6 +234,7 @@ Result init_entity_factory(Update_State &us,
     Entity_Factory &new_entity_factory = us.entity_factories[entity_type];
     memset(&new_entity_factory, 0, sizeof(Entity_Factory));
     Entity &new_entity = new_entity_factory.e;
+    new_entity.factory_type = entity_type;
 
     for (auto &entity_item : entity_desc.value.GetObject()) {
       std::string entity_item_name = entity_item.name.GetString();
@@ -276,6 +266,8 @@ Result init_entity_factory(Update_State &us,
       if (entity_item_name == "texture") {
         new_entity.texture = (Texture_Id)entity_item.value.GetUint();
         new_entity_factory.register_render = true;
+      } else if (entity_item_name == "contact_damage") {
+        new_entity.contact_damage = entity_item.value.GetInt64();
       } else if (entity_item_name == "max_health") {
         new_entity.max_health = entity_item.value.GetUint64();
         new_entity_factory.register_health = true;
@@ -313,6 +305,14 @@ Result init_entity_factory(Update_State &us,
 Result init_updating(Update_State &update_state, const Config &config,
                      const std::optional<u32> &seed) {
   update_state.thread_pool = new ThreadPool(config.num_threads);
+  update_state.save_thread_pool = new ThreadPool(1);
+  update_state.frame = 0;
+  update_state.chunk_memory_budget = config.chunk_memory_budget;
+  update_state.entity_id_pool.set_capacity(config.max_entities);
+  update_state.autosave_interval =
+      std::chrono::seconds(config.autosave_interval);
+  update_state.next_autosave =
+      std::chrono::steady_clock::now() + update_state.autosave_interval;
 
   const DimensionIndex starting_dim = DimensionIndex::OVERWORLD;
   // const DimensionIndex starting_dim = DimensionIndex::WATERWORLD;
@@ -327,6 +327,16 @@ Result init_updating(Update_State &update_state, const Config &config,
     update_state.world_seed = seed.value();
   }
 
+  update_state.world_save.enabled = false;
+  if (!config.save_dir.empty()) {
+    Result save_res =
+        open_world_save(update_state.world_save,
+                        get_world_save_dir(config, update_state.world_seed));
+    if (save_res != Result::SUCCESS) {
+      LOG_WARN("Couldn't open world save. Chunks won't be saved.");
+    }
+  }
+
   std::filesystem::path res_dir;
   Result res_dir_res = get_resource_dir(res_dir);
   if (res_dir_res != Result::SUCCESS) {
@@ -346,6 +356,13 @@ Result init_updating(Update_State &update_state, const Config &config,
     LOG_ERROR("Updater failed to initialize cell factories");
     return res_dir_res;
   }
+  std::filesystem::path structures_path = res_dir / "structures.json";
+  Result structures_res =
+      init_structures(update_state.structures, structures_path);
+  if (structures_res != Result::SUCCESS) {
+    LOG_ERROR("Updater failed to initialize structures");
+    return structures_res;
+  }
 
   Result ap_res =
       create_entity(update_state, update_state.active_dimension,
@@ -356,16 +373,18 @@ Result init_updating(Update_State &update_state, const Config &config,
     return ap_res;
   }
 
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
 
   load_chunks_square(update_state, update_state.active_dimension,
                      active_player.coord.x, active_player.coord.y, 8 / 2);
+  populate_chunks_square(update_state, update_state.active_dimension,
+                         active_player.coord.x, active_player.coord.y, 8 / 2);
 
   return Result::SUCCESS;
 }
 
 Result update(Update_State &update_state) {
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
   static Chunk_Coord last_player_chunk =
       get_chunk_coord(active_player.coord.x, active_player.coord.y);
 
@@ -390,17 +409,46 @@ Result update(Update_State &update_state) {
     */
     update_state.events.insert(Update_Event::PLAYER_MOVED_CHUNK);
     load_chunks_square(update_state, update_state.active_dimension,
-                       active_player.coord.x, active_player.coord.y, 8 + 5);
+                       active_player.coord.x, active_player.coord.y,
+                       CHUNK_LOAD_RADIUS);
+    populate_chunks_square(update_state, update_state.active_dimension,
+                           active_player.coord.x, active_player.coord.y,
+                           CHUNK_POPULATE_RADIUS);
+    evict_chunks(update_state, update_state.active_dimension,
+                 active_player.coord.x, active_player.coord.y,
+                 CHUNK_LOAD_RADIUS);
     last_player_chunk = current_player_chunk;
   }
 
   update_cells(update_state);
+  update_minimap(*get_active_dimension(update_state));
+
+  update_autosave(update_state);
+
+  update_state.frame++;
 
   return Result::SUCCESS;
 }
 
 void destroy_update(Update_State &update_state) {
   delete update_state.thread_pool;
+  delete update_state.save_thread_pool;  // Waits for flushes in flight
+
+  if (update_state.world_save.enabled) {
+    for (const auto &[dimid, dim] : update_state.dimensions) {
+      std::vector<Chunk_Coord> coords;
+      for (const auto &[coord, chunk] : dim.chunks) {
+        if (chunk.unsaved) {
+          coords.push_back(coord);
+        }
+      }
+
+      snapshot_chunks(update_state, dimid, coords);
+    }
+
+    flush_world_save(update_state.world_save);
+  }
+  close_world_save(update_state.world_save);
 }
 
 Result update_mouse(Update_State &us) {
@@ -408,7 +456,7 @@ Result update_mouse(Update_State &us) {
   Uint32 button_state = SDL_GetMouseState(&mouse_x, &mouse_y);
 
   u16 screen_cell_size = us.screen_cell_size;
-  Entity &active_player = *get_active_player(us);
+  Entity_Ref active_player = get_active_player(us);
   Dimension &active_dimension = *get_active_dimension(us);
 
   Entity_Coord tl;
@@ -428,14 +476,22 @@ Result update_mouse(Update_State &us) {
       for (s64 y = c.y - CELL_PLACE_RADIUS; y < c.y + CELL_PLACE_RADIUS; y++) {
         Chunk_Coord cc = get_chunk_coord(x, y);
 
-        Chunk &chunk = active_dimension.chunks[cc];
+        auto chunk_iter = active_dimension.chunks.find(cc);
+        if (chunk_iter == active_dimension.chunks.end()) {
+          continue;
+        }
+        Chunk &chunk = chunk_iter->second;
+        make_chunk_writable(chunk);
+
         u16 cx = std::abs((cc.x * CHUNK_CELL_WIDTH) - x);
         u16 cy = y - (cc.y * CHUNK_CELL_WIDTH);
         u32 cell_index = cx + cy * CHUNK_CELL_WIDTH;
 
         assert(cell_index < CHUNK_CELLS);
 
-        chunk.cells[cell_index] = create_cell(Cell_Type::WATER);
+        set_cell_type(chunk, chunk.cells[cell_index], Cell_Type::WATER);
+        chunk.unsaved = true;
+        mark_chunk_summary_stale(active_dimension, chunk);
       }
     }
 
@@ -450,7 +506,7 @@ Result update_keypresses(Update_State &us) {
 
   const Uint8 *keys = SDL_GetKeyboardState(&num_keys);
 
-  Entity &active_player = *get_active_player(us);
+  Entity_Ref active_player = get_active_player(us);
 
   static constexpr f32 MOVEMENT_CONSTANT = 0.4f;
   static constexpr f32 AIR_MOV_CONSTANT = 0.15f;
@@ -524,178 +580,454 @@ Result update_keypresses(Update_State &us) {
   return Result::SUCCESS;
 }
 
-void update_kinetic(Update_State &update_state) {
-  Dimension &active_dimension = *get_active_dimension(update_state);
+// Pushes the entity out of the cell at cell_x, cell_y if it's solid, and does
+// what else the cell's type does to things touching it
+void collide_entity_with_cell(Entity_Ref &entity, Cell_Type type, s64 cell_x,
+                              s64 cell_y, bool &nica_damage) {
+  // Bounding box colision between the entity and the cell
+  Entity_Coord cell_coord = {static_cast<f64>(cell_x),
+                             static_cast<f64>(cell_y)};
 
-  // TODO: Multithread
-
-  // Start by updating kinetics values: acc, vel, pos
-  for (Entity_ID entity_index : active_dimension.e_kinetic) {
-    // Have to trust that entity_indicies is correct at them moment.
-    Entity &entity = update_state.entities[entity_index];
-
-    if (entity.status & (u8)Entity_Status::IN_WATER) {
-      entity.ax *= cell_type_infos[(u8)Cell_Type::WATER].friction;
-      entity.ay *= cell_type_infos[(u8)Cell_Type::WATER].friction;
-      entity.vx *= cell_type_infos[(u8)Cell_Type::WATER].friction;
-      entity.vy *= cell_type_infos[(u8)Cell_Type::WATER].friction;
-
-      entity.vy += entity.bouyancy;
-    } else if (entity.status & (u8)Entity_Status::ON_GROUND) {
-      entity.ax *= cell_type_infos[(u8)Cell_Type::DIRT].friction;
-      entity.ay *= cell_type_infos[(u8)Cell_Type::DIRT].friction;
-      entity.vx *= cell_type_infos[(u8)Cell_Type::DIRT].friction;
-      entity.vy *= cell_type_infos[(u8)Cell_Type::DIRT].friction;
-    } else {
-      entity.ax *= cell_type_infos[(u8)Cell_Type::AIR].friction;
-      entity.ay *= cell_type_infos[(u8)Cell_Type::AIR].friction;
-      entity.vx *= cell_type_infos[(u8)Cell_Type::AIR].friction;
-      entity.vy *= cell_type_infos[(u8)Cell_Type::AIR].friction;
+  if (entity.coord.x + entity.boundingw < cell_coord.x ||
+      cell_coord.x + 1 < entity.coord.x) {
+    return;
+  }
+
+  if (entity.coord.y - entity.boundingh > cell_coord.y ||
+      cell_coord.y > entity.coord.y) {
+    return;
+  }
+
+  // If neither, we are coliding, and resolve based on cell
+  switch (type) {
+    case Cell_Type::NICARAGUA: {
+      if (!nica_damage) {
+        entity.health -= 10;
+        nica_damage = true;
+      }
+      [[fallthrough]];
+    }
+    case Cell_Type::SNOW:
+    case Cell_Type::GOLD:
+    case Cell_Type::SAND:
+    case Cell_Type::GRASS:
+    case Cell_Type::DIRT: {
+      if (entity.coord.y - entity.boundingh <= cell_coord.y) {
+        entity.status |= (u8)Entity_Status::ON_GROUND;
+      }
+
+      // With solid cells, we also don't allow the entity to intersect
+      // the cell
+      f32 overlap_x, overlap_y;
+
+      // For X axis
+      if (entity.coord.x < cell_coord.x) {
+        overlap_x = (entity.coord.x + entity.boundingw) - cell_coord.x;
+      } else {
+        overlap_x = (cell_coord.x + 1) - entity.coord.x;
+      }
+
+      // For Y axis
+      if (entity.coord.y > cell_coord.y) {
+        overlap_y = cell_coord.y - (entity.coord.y - entity.boundingh);
+      } else {
+        overlap_y = (cell_coord.y + 1) - entity.coord.y;
+      }
+
+      // Determine the smallest overlap to resolve the collision with
+      static constexpr f64 MOV_LIM = 0.95;
+      if (fabs(overlap_x) < fabs(overlap_y)) {
+        if (entity.coord.x < cell_coord.x) {
+          entity.coord.x -=
+              std::min(static_cast<double>(fabs(overlap_x)), MOV_LIM);
+          // Move entity left
+        } else {
+          entity.coord.x +=
+              std::min(static_cast<double>(fabs(overlap_x)),
+                       MOV_LIM);  // Move entity right
+        }
+      } else {
+        if (entity.coord.y > cell_coord.y) {
+          entity.coord.y +=
+              std::min(static_cast<double>(fabs(overlap_y)),
+                       MOV_LIM);  // Move entity down
+        } else {
+          entity.coord.y -=
+              std::min(static_cast<double>(fabs(overlap_y)),
+                       MOV_LIM);  // Move entity up
+        }
+      }
+      break;
+    }
+    // Liquids are done a row at a time in collide_entity_with_cells
+    case Cell_Type::LAVA:
+    case Cell_Type::WATER:
+    case Cell_Type::STEAM:
+    case Cell_Type::NONE:
+    case Cell_Type::AIR: {
+      break;
     }
+  }
+}
+
+// Bits for the cells from first_x to last_x in a chunk row that the entity's
+// box touches, with the same edges as collide_entity_with_cell
+u64 get_entity_row_overlap(const Entity_Ref &entity, s64 chunk_x, s64 cell_y,
+                           u32 first_x, u32 last_x) {
+  if (entity.coord.y - entity.boundingh > cell_y || cell_y > entity.coord.y) {
+    return 0;
+  }
+
+  f64 left = std::ceil(entity.coord.x - 1 - chunk_x);
+  f64 right = std::floor(entity.coord.x + entity.boundingw - chunk_x);
+  s64 lo = std::max<s64>(static_cast<s64>(left), first_x);
+  s64 hi = std::min<s64>(static_cast<s64>(right), last_x);
+  if (lo > hi) {
+    return 0;
+  }
+  return (~static_cast<u64>(0) >> (63 - hi)) & (~static_cast<u64>(0) << lo);
+}
+
+// Friction for what an entity's in. Water wins over ground.
+struct Kinetic_Frictions {
+  f32 air, ground, water;
+};
+
+// Integrates slots first up to but not including last of one page. It only
+// goes down the columns and picks with selects instead of branches, so it
+// vectorizes.
+void integrate_kinetic_slots(Entity_Page &page, u32 first, u32 last,
+                             Kinetic_Frictions frictions) {
+  for (u32 slot = first; slot < last; slot++) {
+    u16 status = page.status[slot];
+    bool in_water = status & (u8)Entity_Status::IN_WATER;
+    bool on_ground = status & (u8)Entity_Status::ON_GROUND;
+    f32 friction = on_ground ? frictions.ground : frictions.air;
+    friction = in_water ? frictions.water : friction;
+    // Multiplied out instead of picked, since GCC won't vectorize a second
+    // select on in_water
+    f32 bouyancy = page.bouyancy[slot];
+    bouyancy *= in_water;
+
+    f32 ax = page.ax[slot] * friction;
+    f32 ay = page.ay[slot] * friction;
+    f32 vx = page.vx[slot] * friction + ax;
+    f32 vy = page.vy[slot] * friction + bouyancy + ay;
+    // Gravity stops at terminal velocity. A compare and select here wouldn't
+    // vectorize, since the compare could trap, but min and max do.
+    vy = std::max(vy - KINETIC_GRAVITY,
+                  std::min(vy, KINETIC_TERMINAL_VELOCITY));
+
+    page.ax[slot] = ax;
+    page.ay[slot] = ay;
+    page.vx[slot] = vx;
+    page.vy[slot] = vy;
+    page.coord[slot].x += vx;
+    page.coord[slot].y += vy;
+  }
+}
 
-    entity.vx += entity.ax;
-    entity.vy += entity.ay;
-    if (entity.vy > KINETIC_TERMINAL_VELOCITY) {
-      entity.vy -= KINETIC_GRAVITY;
+// ids have to be sorted. Ids that follow each other in a page are done as one
+// run of slots.
+void integrate_kinetic_entities(Entity_Storage &entities,
+                                const Entity_ID *ids, size_t count,
+                                Kinetic_Frictions frictions) {
+  size_t run_first = 0;
+  while (run_first < count) {
+    size_t run_last = run_first + 1;
+    while (run_last < count && ids[run_last] == ids[run_last - 1] + 1 &&
+           get_entity_page_slot(ids[run_last]) != 0) {
+      run_last++;
     }
-    entity.coord.x += entity.vx;
-    entity.coord.y += entity.vy;
+
+    u32 slot = get_entity_page_slot(ids[run_first]);
+    integrate_kinetic_slots(entities.get_page(ids[run_first]), slot,
+                            slot + static_cast<u32>(run_last - run_first),
+                            frictions);
+    run_first = run_last;
   }
+}
+
+// row_chunks is scratch space, so a range of entities can share one
+void collide_entity_with_cells(const Dimension &dim, Entity_Ref entity,
+                               std::vector<const Chunk *> &row_chunks) {
+  bool nica_damage = false;
+  entity.status = entity.status & ~((u8)Entity_Status::IN_WATER |
+                                    (u8)Entity_Status::ON_GROUND);
+
+  // Only the cells the bounding box covers are looked at, plus one more all
+  // the way around since resolving a collision moves the entity a bit
+  s64 min_x = static_cast<s64>(std::floor(entity.coord.x)) - 1;
+  s64 max_x =
+      static_cast<s64>(std::floor(entity.coord.x + entity.boundingw)) + 1;
+  s64 min_y =
+      static_cast<s64>(std::floor(entity.coord.y - entity.boundingh)) - 1;
+  s64 max_y = static_cast<s64>(std::floor(entity.coord.y)) + 1;
+
+  // The chunks are looked up once for each row of chunks the box covers
+  s32 first_cx = get_chunk_coord(min_x, min_y).x;
+  s32 last_cx = get_chunk_coord(max_x, min_y).x;
+  s32 row_cy = INT32_MIN;
+
+  for (s64 cell_y = min_y; cell_y <= max_y; cell_y++) {
+    s32 cy = get_chunk_coord(min_x, cell_y).y;
+    if (cy != row_cy) {
+      row_cy = cy;
+      row_chunks.clear();
+      for (s32 cx = first_cx; cx <= last_cx; cx++) {
+        auto chunk_iter = dim.chunks.find({cx, cy});
+        row_chunks.push_back(
+            chunk_iter == dim.chunks.end() ? nullptr : &chunk_iter->second);
+      }
+    }
 
-  // Now resolve colisions
+    // A row at a time out of each chunk it crosses. Solid cells push the
+    // entity so they're done one at a time. Liquids only have to be touched,
+    // so after the pushes they're done all at once from where it ended up.
+    u32 local_y = cell_y - static_cast<s64>(cy) * CHUNK_CELL_WIDTH;
+    for (s32 cx = first_cx; cx <= last_cx; cx++) {
+      const Chunk *chunk = row_chunks[cx - first_cx];
+      if (chunk == nullptr) {
+        continue;
+      }
 
-  // TODO: this just does cell collisions. We need some kind of spacial data
-  // structure (octtree?) to determine if we're colliding with other entities
-  for (Entity_ID entity_index : active_dimension.e_kinetic) {
-    bool nica_damage = false;
-    Entity &entity = update_state.entities[entity_index];
-    entity.status = entity.status & ~((u8)Entity_Status::IN_WATER |
-                                      (u8)Entity_Status::ON_GROUND);
+      s64 chunk_x = static_cast<s64>(cx) * CHUNK_CELL_WIDTH;
+      u32 first_x = std::max<s64>(min_x - chunk_x, 0);
+      u32 last_x = std::min<s64>(max_x - chunk_x, CHUNK_CELL_WIDTH - 1);
+      const Cell_Class_Rows &classes = chunk->classes;
+      u64 span = (~static_cast<u64>(0) >> (63 - last_x)) &
+                 (~static_cast<u64>(0) << first_x);
+      u64 solid = classes.rows[(u8)Cell_Class::SOLID][local_y] & span;
+      while (solid != 0) {
+        u32 local_x = lowest_set_bit(solid);
+        solid &= solid - 1;
+        const Cell &cell = chunk->cells[local_y * CHUNK_CELL_WIDTH + local_x];
+        collide_entity_with_cell(entity, cell.type, chunk_x + local_x, cell_y,
+                                 nica_damage);
+      }
 
-    Chunk_Coord cc = get_chunk_coord(entity.coord.x, entity.coord.y);
+      u64 liquid = classes.rows[(u8)Cell_Class::LIQUID][local_y];
+      if (liquid & span) {
+        u64 touching = liquid & get_entity_row_overlap(entity, chunk_x, cell_y,
+                                                       first_x, last_x);
+        if (touching != 0) {
+          entity.status = entity.status | (u8)Entity_Status::IN_WATER;
+          // Lava hurts for every cell of it touched
+          entity.health -= count_set_bits(
+              touching & classes.rows[(u8)Cell_Class::DAMAGING][local_y]);
+        }
+      }
+    }
+  }
+}
 
-    // TODO: Should also definitly multithread this
+// An entity the kinetic step moved or hurt, and the chunk it started in
+struct Entity_Chunk_Move {
+  Entity_ID id;
+  Chunk_Coord last_cc;
+};
 
-    // Right now just checking the chunks below and to the right since that's
-    // where the bounding box might spill over. If an entity ever becomes
-    // larger than a chunk, we'll have to do this range based on that
+void update_kinetic(Update_State &update_state) {
+  Dimension &active_dimension = *get_active_dimension(update_state);
+  Entity_Storage &entities = update_state.entities;
+
+  Kinetic_Frictions frictions = {
+      cell_type_infos[(u8)Cell_Type::AIR].friction,
+      cell_type_infos[(u8)Cell_Type::DIRT].friction,
+      cell_type_infos[(u8)Cell_Type::WATER].friction};
+
+  // Integrating and the cell collisions after it only touch the entity
+  // they're for and read the cells, so the kinetic entities are split into
+  // ranges that are done on their own. The grid and the chunks' unsaved flags
+  // are the only things shared, so the entities that changed are collected
+  // and marked after. Entities with each other are done after that in
+  // collide_entities.
+  //
+  // Each range is sorted by id, so entities next to each other in a page are
+  // integrated as one run and the rest at least go through the pages in
+  // order.
+  const Entity_ID *kinetic_ids = active_dimension.e_kinetic.data();
+  auto move_range = [&](size_t first, size_t last) {
+    std::vector<Entity_ID> ids(kinetic_ids + first, kinetic_ids + last);
+    std::sort(ids.begin(), ids.end());
+
+    std::vector<Entity_Coord> last_coords(ids.size());
+    std::vector<s64> last_healths(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+      Entity_Ref entity = entities[ids[i]];
+      last_coords[i] = entity.coord;
+      last_healths[i] = entity.health;
+    }
 
-    // This is bad. It's going to take forever. Definitly have to only do this
-    // on entities that absolutly need it.
-    Chunk_Coord ic = cc;
-    for (ic.x = cc.x; ic.x < cc.x + 2; ic.x++) {
-      for (ic.y = cc.y; ic.y > cc.y - 2; ic.y--) {
-        Chunk &chunk = active_dimension.chunks[ic];
+    integrate_kinetic_entities(entities, ids.data(), ids.size(), frictions);
 
-        for (u32 cell = 0; cell < CHUNK_CELLS; cell++) {
-          // Bounding box colision between the entity and the cell
+    std::vector<Entity_Chunk_Move> moves;
+    std::vector<const Chunk *> row_chunks;
+    for (size_t i = 0; i < ids.size(); i++) {
+      Entity_Ref entity = entities[ids[i]];
+      collide_entity_with_cells(active_dimension, entity, row_chunks);
 
-          Entity_Coord cell_coord;
-          cell_coord.x = ic.x * CHUNK_CELL_WIDTH;
-          cell_coord.y = ic.y * CHUNK_CELL_WIDTH;
+      const Entity_Coord &last_coord = last_coords[i];
+      if (entity.coord.x != last_coord.x || entity.coord.y != last_coord.y ||
+          entity.health != last_healths[i]) {
+        moves.push_back(
+            {ids[i], get_chunk_coord(last_coord.x, last_coord.y)});
+      }
+    }
+    return moves;
+  };
+
+  // Not worth handing a few entities off to other threads
+  constexpr size_t MIN_ENTITIES_PER_TASK = 256;
+  size_t count = active_dimension.e_kinetic.size();
+  std::vector<std::vector<Entity_Chunk_Move>> moves;
+  if (update_state.thread_pool == nullptr ||
+      update_state.thread_pool->size() < 2 ||
+      count < MIN_ENTITIES_PER_TASK * 2) {
+    moves.push_back(move_range(0, count));
+  } else {
+    // One range per worker
+    size_t tasks = update_state.thread_pool->size();
+    size_t per_task = std::max((count + tasks - 1) / tasks,
+                               MIN_ENTITIES_PER_TASK);
+    std::vector<std::future<std::vector<Entity_Chunk_Move>>> futures;
+    for (size_t first = 0; first < count; first += per_task) {
+      futures.push_back(update_state.thread_pool->enqueue(
+          move_range, first, std::min(first + per_task, count)));
+    }
+    for (auto &future : futures) {
+      moves.push_back(future.get());
+    }
+  }
 
-          u8 x = cell % CHUNK_CELL_WIDTH;
-          cell_coord.x += x;
-          cell_coord.y += static_cast<s32>(
-              (cell - x) / CHUNK_CELL_WIDTH);  // -x is probably unecessary.
+  for (const std::vector<Entity_Chunk_Move> &task_moves : moves) {
+    for (const Entity_Chunk_Move &move : task_moves) {
+      mark_entity_chunk_change(
+          active_dimension, move.id, move.last_cc,
+          entities.get_page(move.id).coord[get_entity_page_slot(move.id)]);
+    }
+  }
 
-          if (entity.coord.x + entity.boundingw < cell_coord.x ||
-              cell_coord.x + 1 < entity.coord.x) {
-            continue;
-          }
+  collide_entities(update_state, active_dimension);
+}
 
-          if (entity.coord.y - entity.boundingh > cell_coord.y ||
-              cell_coord.y > entity.coord.y) {
-            continue;
-          }
+// Sweep and prune. The colliders are sorted by their left edge, so each one
+// only has to be checked against the ones after it that start before its
+// right edge. The order isn't redone as entities get pushed, so a pile of
+// them can take a few updates to settle.
+void collide_entities(Update_State &us, Dimension &dim) {
+  // Boxes are copied in so rejecting a pair doesn't touch the entities
+  struct Collider {
+    f64 min_x, max_x;
+    f64 min_y, max_y;
+    Entity_ID id;
+  };
+
+  std::vector<Collider> colliders;
+  auto add_collider = [&](Entity_ID id) {
+    Entity_Ref e = us.entities[id];
+    if (e.boundingw > 0 && e.boundingh > 0) {
+      colliders.push_back({e.coord.x, e.coord.x + e.boundingw,
+                           e.coord.y - e.boundingh, e.coord.y, id});
+    }
+  };
+  for (Entity_ID id : dim.e_kinetic) {
+    add_collider(id);
+  }
+  for (Entity_ID id : dim.e_ai) {
+    if (!dim.e_kinetic.contains(id)) {
+      add_collider(id);
+    }
+  }
+  std::sort(colliders.begin(), colliders.end(),
+            [](const Collider &a, const Collider &b) {
+              return a.min_x < b.min_x;
+            });
+
+  dim.contacts.clear();
+  for (size_t i = 0; i < colliders.size(); i++) {
+    Collider &a_box = colliders[i];
+
+    for (size_t j = i + 1;
+         j < colliders.size() && colliders[j].min_x <= a_box.max_x; j++) {
+      Collider &b_box = colliders[j];
+      if (a_box.min_y > b_box.max_y || b_box.min_y > a_box.max_y ||
+          b_box.min_x > a_box.max_x) {
+        continue;
+      }
 
-          // If neither, we are coliding, and resolve based on cell
-          switch (chunk.cells[cell].type) {
-            case Cell_Type::NICARAGUA: {
-              if (!nica_damage) {
-                entity.health -= 10;
-                nica_damage = true;
-              }
-              [[fallthrough]];
-            }
-            case Cell_Type::SNOW:
-            case Cell_Type::GOLD:
-            case Cell_Type::SAND:
-            case Cell_Type::GRASS:
-            case Cell_Type::DIRT: {
-              if (entity.coord.y - entity.boundingh <= cell_coord.y) {
-                entity.status |= (u8)Entity_Status::ON_GROUND;
-              }
-
-              // With solid cells, we also don't allow the entity to intersect
-              // the cell
-              f32 overlap_x, overlap_y;
-
-              // For X axis
-              if (entity.coord.x < cell_coord.x) {
-                overlap_x = (entity.coord.x + entity.boundingw) - cell_coord.x;
-              } else {
-                overlap_x = (cell_coord.x + 1) - entity.coord.x;
-              }
-
-              // For Y axis
-              if (entity.coord.y > cell_coord.y) {
-                overlap_y = cell_coord.y - (entity.coord.y - entity.boundingh);
-              } else {
-                overlap_y = (cell_coord.y + 1) - entity.coord.y;
-              }
-
-              // Determine the smallest overlap to resolve the collision with
-              static constexpr f64 MOV_LIM = 0.95;
-              if (fabs(overlap_x) < fabs(overlap_y)) {
-                if (entity.coord.x < cell_coord.x) {
-                  entity.coord.x -=
-                      std::min(static_cast<double>(fabs(overlap_x)), MOV_LIM);
-                  // Move entity left
-                } else {
-                  entity.coord.x +=
-                      std::min(static_cast<double>(fabs(overlap_x)),
-                               MOV_LIM);  // Move entity right
-                }
-              } else {
-                if (entity.coord.y > cell_coord.y) {
-                  entity.coord.y +=
-                      std::min(static_cast<double>(fabs(overlap_y)),
-                               MOV_LIM);  // Move entity down
-                } else {
-                  entity.coord.y -=
-                      std::min(static_cast<double>(fabs(overlap_y)),
-                               MOV_LIM);  // Move entity up
-                }
-              }
-              break;
-            }
-            case Cell_Type::STEAM:
-            case Cell_Type::NONE:
-            case Cell_Type::AIR: {
-              break;
-            }
-            case Cell_Type::LAVA: {
-              entity.health -= 1;
-              [[fallthrough]];
-            }
-            case Cell_Type::WATER: {
-              entity.status = entity.status | (u8)Entity_Status::IN_WATER;
-              break;
-            }
-          }
+      Entity_Ref a = us.entities[a_box.id];
+      Entity_Ref b = us.entities[b_box.id];
 
-          // entity.ax *= 0.1f;
-          // entity.ay *= 0.1f;
-          // entity.vx *= 0.5f;
-          // entity.vy *= 0.5f;
+      Entity_Contact contact = {a_box.id, b_box.id, 0};
+      if (a_box.min_y > b_box.min_y &&
+          a_box.min_y >= b_box.max_y - b.head_boundingh) {
+        contact.top = contact.a;
+      } else if (b_box.min_y > a_box.min_y &&
+                 b_box.min_y >= a_box.max_y - a.head_boundingh) {
+        contact.top = contact.b;
+      }
+      dim.contacts.push_back(contact);
+
+      // Push them apart along whichever way they overlap least, half each
+      f64 overlap_x = std::min(a_box.max_x, b_box.max_x) -
+                      std::max(a_box.min_x, b_box.min_x);
+      f64 overlap_y = std::min(a_box.max_y, b_box.max_y) -
+                      std::max(a_box.min_y, b_box.min_y);
+
+      Chunk_Coord a_cc = get_chunk_coord(a.coord.x, a.coord.y);
+      Chunk_Coord b_cc = get_chunk_coord(b.coord.x, b.coord.y);
+      if (overlap_x < overlap_y) {
+        f64 push = a_box.min_x < b_box.min_x ? -overlap_x / 2 : overlap_x / 2;
+        a.coord.x += push;
+        b.coord.x -= push;
+        a_box.min_x += push;
+        a_box.max_x += push;
+        b_box.min_x -= push;
+        b_box.max_x -= push;
+      } else {
+        f64 push = a_box.min_y > b_box.min_y ? overlap_y / 2 : -overlap_y / 2;
+        a.coord.y += push;
+        b.coord.y -= push;
+        a_box.min_y += push;
+        a_box.max_y += push;
+        b_box.min_y -= push;
+        b_box.max_y -= push;
+
+        // Whatever's on top is standing on the other one
+        if (push > 0) {
+          a.status |= (u8)Entity_Status::ON_GROUND;
+        } else {
+          b.status |= (u8)Entity_Status::ON_GROUND;
         }
       }
+      mark_entity_chunk_change(dim, contact.a, a_cc, a.coord);
+      mark_entity_chunk_change(dim, contact.b, b_cc, b.coord);
+    }
+  }
+}
+
+// Only the counts and classes of the chunk being worked on are changed here.
+// See update_cells_chunk.
+void swap_cells(Chunk &chunk, Cell &cell, Chunk &o_chunk, Cell &o_cell,
+                std::vector<Cell_Count_Change> &deferred) {
+  if (cell.type != o_cell.type) {
+    u32 cell_index = &cell - chunk.cells.get();
+    u32 o_cell_index = &o_cell - o_chunk.cells.get();
+    if (&o_chunk == &chunk) {
+      // Same counts, but the two cells trade classes
+      set_cell_classes(chunk, cell_index, o_cell.type);
+      set_cell_classes(chunk, o_cell_index, cell.type);
+    } else {
+      count_cell_change(chunk, cell_index, cell.type, o_cell.type);
+      deferred.push_back({&o_chunk, o_cell_index, o_cell.type, cell.type});
     }
   }
+  std::swap(cell, o_cell);
 }
 
-bool process_steam_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
+bool process_steam_cell(Dimension &dim, Chunk &chunk, u32 cell_index,
+                        std::vector<Cell_Count_Change> &deferred) {
   s64 cx = chunk.coord.x * CHUNK_CELL_WIDTH +
            static_cast<s64>(cell_index % CHUNK_CELL_WIDTH);
   s64 cy = chunk.coord.y * CHUNK_CELL_WIDTH +
@@ -709,13 +1041,15 @@ bool process_steam_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
   // Normally this would just be a for loop going through the
   // directions, but this has to be so wicked fast
 
+  // Start with bottom
+  Chunk *o_chunk;
   Cell *o_cell = get_cell_at_world_pos(
-      dim, cx, cy + (rand_dir % 4 == 0 ? 1 : 0));  // Start with bottom
+      dim, cx, cy + (rand_dir % 4 == 0 ? 1 : 0), &o_chunk);
   if (o_cell != nullptr) {
     // Giving the steam some bonus upward power
     if (cell_type_infos[(u16)o_cell->type].solidity <
         cell_type_infos[(u16)Cell_Type::STEAM].solidity + 30.0f) {
-      std::swap(cell, *o_cell);
+      swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
       return true;
     }
   }
@@ -727,20 +1061,20 @@ break;
 }
   */
   if (rand_dir & 1) {
-    o_cell = get_cell_at_world_pos(dim, cx - side_mod, cy);  // Left
+    o_cell = get_cell_at_world_pos(dim, cx - side_mod, cy, &o_chunk);  // Left
     if (o_cell != nullptr) {
       if (cell_type_infos[(u16)o_cell->type].solidity <
           cell_type_infos[(u16)Cell_Type::STEAM].solidity) {
-        std::swap(cell, *o_cell);
+        swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
         return true;
       }
     }
   } else {
-    o_cell = get_cell_at_world_pos(dim, cx + side_mod, cy);  // Right
+    o_cell = get_cell_at_world_pos(dim, cx + side_mod, cy, &o_chunk);  // Right
     if (o_cell != nullptr) {
       if (cell_type_infos[(u16)o_cell->type].solidity <
           cell_type_infos[(u16)Cell_Type::STEAM].solidity) {
-        std::swap(cell, *o_cell);
+        swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
         return true;
       }
     }
@@ -749,9 +1083,10 @@ break;
   return false;
 }
 
-bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
+bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index,
+                        std::vector<Cell_Count_Change> &deferred) {
   Cell &cell = chunk.cells[cell_index];
-  const Cell_Type_Info &cell_info = *cell.cell_info;
+  const Cell_Type_Info &cell_info = cell_type_infos[(u16)cell.type];
 
   u32 rand_dir = std::rand();
 #ifndef NDEBUG
@@ -768,11 +1103,13 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
   s8 side_mod = rand_dir % cell_info.viscosity;
 
   // if in first row, the next cell we get needs to be from the chunk below us.
+  Chunk *o_chunk = &chunk;
   Cell *o_cell = nullptr;
   if (cell_index < CHUNK_CELL_WIDTH) {
     Chunk_Coord o_cc = {chunk.coord.x, chunk.coord.y - 1};
     const auto &o_chunk_iter = dim.chunks.find(o_cc);
     if (o_chunk_iter != dim.chunks.end()) {
+      o_chunk = &o_chunk_iter->second;
       o_cell = &o_chunk_iter->second
                     .cells[CHUNK_CELLS - (CHUNK_CELL_WIDTH - cell_index)];
     }
@@ -784,17 +1121,18 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
         cell_info.sublimation_point) {
       // TODO: Need a map of cell functions that we can call with
       // cell_info.sublimation_cell
-      cell = create_cell(Cell_Type::STEAM);
+      set_cell_type(chunk, cell, Cell_Type::STEAM);
       return true;
     }
     if (cell_type_infos[(u16)o_cell->type].solidity < cell_info.solidity) {
-      std::swap(cell, *o_cell);
+      swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
       return true;
     }
   }
 
   // Only check one direction and do so randomly
   if (rand_dir & 1) {  // Move left
+    Chunk *o_chunk = &chunk;
     Cell *o_cell = nullptr;
     if ((cell_index - side_mod) / CHUNK_CELL_WIDTH !=
             (cell_index) / CHUNK_CELL_WIDTH ||
@@ -802,6 +1140,7 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
       Chunk_Coord o_cc = {chunk.coord.x - 1, chunk.coord.y};
       const auto &o_chunk_iter = dim.chunks.find(o_cc);
       if (o_chunk_iter != dim.chunks.end()) {
+        o_chunk = &o_chunk_iter->second;
         u32 o_cell_index = cell_index - side_mod + CHUNK_CELL_WIDTH;
         assert(o_cell_index < CHUNK_CELLS);
         o_cell = &o_chunk_iter->second.cells[o_cell_index];
@@ -813,11 +1152,12 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
 
     if (o_cell != nullptr) {
       if (cell_type_infos[(u16)o_cell->type].solidity < cell_info.solidity) {
-        std::swap(cell, *o_cell);
+        swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
         return true;
       }
     }
   } else {  // Move right
+    Chunk *o_chunk = &chunk;
     Cell *o_cell = nullptr;
     if ((cell_index + side_mod) / CHUNK_CELL_WIDTH !=
             (cell_index) / CHUNK_CELL_WIDTH ||
@@ -826,6 +1166,7 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
       Chunk_Coord o_cc = {chunk.coord.x + 1, chunk.coord.y};
       const auto &o_chunk_iter = dim.chunks.find(o_cc);
       if (o_chunk_iter != dim.chunks.end()) {
+        o_chunk = &o_chunk_iter->second;
         u32 o_cell_index = cell_index + side_mod - CHUNK_CELL_WIDTH;
         assert(o_cell_index < CHUNK_CELLS);
         o_cell = &o_chunk_iter->second.cells[o_cell_index];
@@ -837,7 +1178,7 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
 
     if (o_cell != nullptr) {
       if (cell_type_infos[(u16)o_cell->type].solidity < cell_info.solidity) {
-        std::swap(cell, *o_cell);
+        swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
         return true;
       }
     }
@@ -846,16 +1187,19 @@ bool process_fluid_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
   return false;
 }
 
-bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
+bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index,
+                         std::vector<Cell_Count_Change> &deferred) {
   Cell &cell = chunk.cells[cell_index];
-  const Cell_Type_Info &cell_info = *cell.cell_info;
+  const Cell_Type_Info &cell_info = cell_type_infos[(u16)cell.type];
 
   // if in first row, the next cell we get needs to be from the chunk below us.
+  Chunk *o_chunk = &chunk;
   Cell *o_cell = nullptr;
   if (cell_index < CHUNK_CELL_WIDTH) {
     Chunk_Coord o_cc = {chunk.coord.x, chunk.coord.y - 1};
     const auto &o_chunk_iter = dim.chunks.find(o_cc);
     if (o_chunk_iter != dim.chunks.end()) {
+      o_chunk = &o_chunk_iter->second;
       o_cell = &o_chunk_iter->second
                     .cells[CHUNK_CELLS - (CHUNK_CELL_WIDTH - cell_index)];
     }
@@ -864,7 +1208,7 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
   }
   if (o_cell != nullptr) {
     if (cell_type_infos[(u16)o_cell->type].solidity < cell_info.solidity) {
-      std::swap(cell, *o_cell);
+      swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
       return true;
     }
   }
@@ -872,6 +1216,7 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
   // Only check one direction and do so randomly
   u32 rand_dir = std::rand();
   if (rand_dir & 1) {  // Move left
+    Chunk *o_chunk = &chunk;
     Cell *o_cell = nullptr;
     if ((cell_index - 1) / CHUNK_CELL_WIDTH !=
             (cell_index) / CHUNK_CELL_WIDTH ||
@@ -879,6 +1224,7 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
       Chunk_Coord o_cc = {chunk.coord.x - 1, chunk.coord.y};
       const auto &o_chunk_iter = dim.chunks.find(o_cc);
       if (o_chunk_iter != dim.chunks.end()) {
+        o_chunk = &o_chunk_iter->second;
         u32 o_cell_index = cell_index - 1 + CHUNK_CELL_WIDTH;
         assert(o_cell_index < CHUNK_CELLS);
         o_cell = &o_chunk_iter->second.cells[o_cell_index];
@@ -890,11 +1236,12 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
 
     if (o_cell != nullptr) {
       if (cell_type_infos[(u16)o_cell->type].solidity < cell_info.solidity) {
-        std::swap(cell, *o_cell);
+        swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
         return true;
       }
     }
   } else {  // Move right
+    Chunk *o_chunk = &chunk;
     Cell *o_cell = nullptr;
     if ((cell_index + 1) / CHUNK_CELL_WIDTH !=
             (cell_index) / CHUNK_CELL_WIDTH ||
@@ -903,6 +1250,7 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
       Chunk_Coord o_cc = {chunk.coord.x + 1, chunk.coord.y};
       const auto &o_chunk_iter = dim.chunks.find(o_cc);
       if (o_chunk_iter != dim.chunks.end()) {
+        o_chunk = &o_chunk_iter->second;
         u32 o_cell_index = cell_index + 1 - CHUNK_CELL_WIDTH;
         assert(o_cell_index < CHUNK_CELLS);
         o_cell = &o_chunk_iter->second.cells[o_cell_index];
@@ -914,7 +1262,7 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
 
     if (o_cell != nullptr) {
       if (cell_type_infos[(u16)o_cell->type].solidity < cell_info.solidity) {
-        std::swap(cell, *o_cell);
+        swap_cells(chunk, cell, *o_chunk, *o_cell, deferred);
         return true;
       }
     }
@@ -922,13 +1270,14 @@ bool process_powder_cell(Dimension &dim, Chunk &chunk, u32 cell_index) {
 
   return false;
 }
-void update_all_water_chunk(Dimension &dim, Chunk &chunk) {
+bool update_all_water_chunk(Dimension &dim, Chunk &chunk,
+                            std::vector<Cell_Count_Change> &deferred) {
   // Iterate over the bottom row of cells in the chunk
   bool still_all_water = true;
   for (u32 x = 0; x < CHUNK_CELL_WIDTH; x++) {
     u32 bottom_index = (CHUNK_CELL_WIDTH - 1) * CHUNK_CELL_WIDTH + x;
     if (chunk.cells[bottom_index].type == Cell_Type::WATER) {
-      if (process_fluid_cell(dim, chunk, bottom_index)) {
+      if (process_fluid_cell(dim, chunk, bottom_index, deferred)) {
         still_all_water = false;
       }
     }
@@ -940,44 +1289,46 @@ void update_all_water_chunk(Dimension &dim, Chunk &chunk) {
     u32 left_index = y * CHUNK_CELL_WIDTH;
     u32 right_index = y * CHUNK_CELL_WIDTH + (CHUNK_CELL_WIDTH - 1);
     if (chunk.cells[left_index].type == Cell_Type::WATER) {
-      if (process_fluid_cell(dim, chunk, left_index)) {
+      if (process_fluid_cell(dim, chunk, left_index, deferred)) {
         still_all_water = false;
       }
     }
     if (chunk.cells[right_index].type == Cell_Type::WATER) {
-      if (process_fluid_cell(dim, chunk, right_index)) {
+      if (process_fluid_cell(dim, chunk, right_index, deferred)) {
         still_all_water = false;
       }
     }
   }
 
-  if (!still_all_water) {
-    chunk.all_cell = Cell_Type::NONE;
-  }
+  return !still_all_water;
 }
 
-void update_cells_chunk(Dimension &dim, Chunk &chunk) {
+bool update_cells_chunk(Dimension &dim, Chunk &chunk,
+                        std::vector<Cell_Count_Change> &deferred) {
+  bool changed = false;
+
   switch (chunk.all_cell) {
     case (Cell_Type::WATER): {
-      update_all_water_chunk(dim, chunk);
+      changed = update_all_water_chunk(dim, chunk, deferred);
       break;
     }
     default: {
       for (u32 cell_index = 0; cell_index < CHUNK_CELLS; cell_index++) {
-        const Cell_Type_Info &cell_info = *chunk.cells[cell_index].cell_info;
+        const Cell_Type_Info &cell_info =
+            cell_type_infos[(u16)chunk.cells[cell_index].type];
 
         switch (cell_info.state) {
           case Cell_State::POWDER: {  // Basic sand movement
-            process_powder_cell(dim, chunk, cell_index);
+            changed |= process_powder_cell(dim, chunk, cell_index, deferred);
             break;
           }
           case Cell_State::LIQUID: {
-            process_fluid_cell(dim, chunk, cell_index);
+            changed |= process_fluid_cell(dim, chunk, cell_index, deferred);
             break;
           }
           case Cell_State::GAS: {
             if (chunk.cells[cell_index].type == Cell_Type::STEAM) {
-              process_steam_cell(dim, chunk, cell_index);
+              changed |= process_steam_cell(dim, chunk, cell_index, deferred);
             }
             break;
           }
@@ -989,14 +1340,36 @@ void update_cells_chunk(Dimension &dim, Chunk &chunk) {
       break;
     }  // default case
   }    // all_cell switch
+
+  return changed;
 }
 
 void update_health(Update_State &us) {
   Dimension &dim = *get_active_dimension(us);
 
+  // Touching something hurts as much as its contact damage, unless it's
+  // being stood on. Then it can't be hurt that way for a little while, so
+  // staying in contact doesn't hurt every update.
+  for (const Entity_Contact &contact : dim.contacts) {
+    for (auto [victim, other] : {std::pair{contact.a, contact.b},
+                                 std::pair{contact.b, contact.a}}) {
+      if (contact.top == victim || !dim.e_health.contains(victim) ||
+          us.entities[other].contact_damage == 0) {
+        continue;
+      }
+
+      Entity_Ref e = us.entities[victim];
+      if (e.contact_hurt_frame <= us.frame) {
+        e.health -= us.entities[other].contact_damage;
+        e.contact_hurt_frame = us.frame + CONTACT_DAMAGE_COOLDOWN;
+        mark_chunk_unsaved(dim, get_chunk_coord(e.coord.x, e.coord.y));
+      }
+    }
+  }
+
   std::vector<Entity_ID> dead_entities;
   for (Entity_ID id : dim.e_health) {
-    Entity &e = us.entities[id];
+    Entity_Ref e = us.entities[id];
 
     // clamp health to max to be sure
     e.health = std::min(e.max_health, e.health);
@@ -1005,7 +1378,9 @@ void update_health(Update_State &us) {
       // For now return to respawn point
       if (e.status & (u16)Entity_Status::DEATHLESS) {
         LOG_DEBUG("Entity {} died.", id);
+        Chunk_Coord last_cc = get_chunk_coord(e.coord.x, e.coord.y);
         e.coord = e.respawn_point;
+        mark_entity_chunk_change(dim, id, last_cc, e.coord);
         e.health = e.max_health;
       } else {
         // Doesn't really matter since they'll be deleted
@@ -1023,8 +1398,35 @@ void update_health(Update_State &us) {
   }
 }
 
+// A chunk can only change if it has cells that move and something different
+// next to them to move into
+bool chunk_settled(const Dimension &dim, const Chunk &chunk) {
+  if (chunk.all_cell == Cell_Type::NONE) {
+    return false;
+  }
+
+  if (cell_type_infos[(u16)chunk.all_cell].state == Cell_State::SOLID) {
+    return true;
+  }
+
+  Chunk_Coord neighbor;
+  for (neighbor.x = chunk.coord.x - 1; neighbor.x <= chunk.coord.x + 1;
+       neighbor.x++) {
+    for (neighbor.y = chunk.coord.y - 1; neighbor.y <= chunk.coord.y + 1;
+         neighbor.y++) {
+      auto neighbor_iter = dim.chunks.find(neighbor);
+      if (neighbor_iter != dim.chunks.end() &&
+          neighbor_iter->second.all_cell != chunk.all_cell) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 void update_cells(Update_State &update_state) {
-  Entity &active_player = *get_active_player(update_state);
+  Entity_Ref active_player = get_active_player(update_state);
   Dimension &dim = *get_active_dimension(update_state);
 
   Chunk_Coord player_chunkc =
@@ -1039,20 +1441,37 @@ void update_cells(Update_State &update_state) {
   // processing.
   ThreadSafeProcessingSet chunk_stack;
 
-  // Populate the queue with all chunks in the area.
+  // Populate the queue with all chunks in the area that could change. Their
+  // cells can move into the neighbors, so those have to own their cells too.
+  // Settled chunks stay shared.
   for (int x = bl.x; x < bl.x + CHUNK_CELL_SIM_RADIUS * 2; x++) {
     for (int y = bl.y; y < bl.y + CHUNK_CELL_SIM_RADIUS * 2; y++) {
       Chunk_Coord ic = {x, y};
-      if (dim.chunks.find(ic) !=
-          dim.chunks.end()) {  // Ensure chunk exists before adding
-        chunk_stack.push(ic);
+      auto chunk_iter = dim.chunks.find(ic);
+      if (chunk_iter == dim.chunks.end() ||
+          chunk_settled(dim, chunk_iter->second)) {
+        continue;
+      }
+      chunk_stack.push(ic);
+
+      Chunk_Coord neighbor;
+      for (neighbor.x = ic.x - 1; neighbor.x <= ic.x + 1; neighbor.x++) {
+        for (neighbor.y = ic.y - 1; neighbor.y <= ic.y + 1; neighbor.y++) {
+          auto neighbor_iter = dim.chunks.find(neighbor);
+          if (neighbor_iter != dim.chunks.end()) {
+            make_chunk_writable(neighbor_iter->second);
+          }
+        }
       }
     }
   }
 
-  std::vector<std::future<void>> futures;
-  for (int i = 0; i < 4; i++) {  // Assuming 4 worker threads
-    auto future = update_state.thread_pool->enqueue([&]() {
+  constexpr int WORKERS = 4;  // Assuming 4 worker threads
+  std::vector<Cell_Count_Change> deferred[WORKERS];
+  std::vector<std::future<std::vector<Chunk_Coord>>> futures;
+  for (int i = 0; i < WORKERS; i++) {
+    auto future = update_state.thread_pool->enqueue([&, i]() {
+      std::vector<Chunk_Coord> changed_chunks;
       Chunk_Coord chunk_coord;
       while (chunk_stack.try_pop(
           chunk_coord)) {  // Attempt to pop a chunk from the stack
@@ -1061,7 +1480,9 @@ void update_cells(Update_State &update_state) {
           auto chunk_iter = dim.chunks.find(chunk_coord);
           if (chunk_iter !=
               dim.chunks.end()) {  // Double-check in case of race conditions
-            update_cells_chunk(dim, chunk_iter->second);
+            if (update_cells_chunk(dim, chunk_iter->second, deferred[i])) {
+              changed_chunks.push_back(chunk_coord);
+            }
           }
           chunk_stack.mark_done(
               chunk_coord);  // Mark this chunk as done processing
@@ -1073,19 +1494,47 @@ void update_cells(Update_State &update_state) {
           chunk_stack.push(chunk_coord);
         }
       }
+
+      return changed_chunks;
     });
 
     futures.push_back(std::move(future));
   }
 
   // Wait for all futures to complete
+  std::vector<Chunk_Coord> changed_chunks;
   for (auto &future : futures) {
-    future.wait();
+    std::vector<Chunk_Coord> changed = future.get();
+    changed_chunks.insert(changed_chunks.end(), changed.begin(), changed.end());
+  }
+
+  for (const std::vector<Cell_Count_Change> &changes : deferred) {
+    for (const Cell_Count_Change &change : changes) {
+      count_cell_change(*change.chunk, change.cell_index, change.removed,
+                        change.added);
+    }
+  }
+
+  // Cells can move into the neighboring chunks, so those are marked unsaved
+  // too
+  for (const Chunk_Coord &changed : changed_chunks) {
+    Chunk_Coord neighbor;
+    for (neighbor.x = changed.x - 1; neighbor.x <= changed.x + 1;
+         neighbor.x++) {
+      for (neighbor.y = changed.y - 1; neighbor.y <= changed.y + 1;
+           neighbor.y++) {
+        auto neighbor_iter = dim.chunks.find(neighbor);
+        if (neighbor_iter != dim.chunks.end()) {
+          neighbor_iter->second.unsaved = true;
+          mark_chunk_summary_stale(dim, neighbor_iter->second);
+        }
+      }
+    }
   }
 }
 
 void update_ai(Update_State &us) {
-  Entity &active_player = *get_active_player(us);
+  Entity_Ref active_player = get_active_player(us);
   Dimension &dim = *get_active_dimension(us);
 
   static u64 ai_frame = 0;
@@ -1094,12 +1543,54 @@ void update_ai(Update_State &us) {
   f64 player_x = active_player.coord.x;
   f64 player_y = active_player.coord.y;
 
-  for (Entity_ID e_id : dim.e_ai) {
-    Entity &e = us.entities[e_id];
+  // Bumping into something stops followers and sends wanderers off somewhere
+  // else
+  for (const Entity_Contact &contact : dim.contacts) {
+    for (Entity_ID id : {contact.a, contact.b}) {
+      if (!dim.e_ai.contains(id)) {
+        continue;
+      }
+
+      Entity_Ref e = us.entities[id];
+      if (e.ai_id == AI_ID::FOLLOW_PLAYER_SLOW) {
+        e.vx = 0;
+        e.vy = 0;
+      } else if (e.ai_id == AI_ID::WANDER_IN_PLACE) {
+        e.wander_target_frame = 0;
+      }
+    }
+  }
+
+  // Only the ones near the player are woken up, followers included. See
+  // AI_CHUNK_RADIUS. They're gathered first since moving entities changes the
+  // grid.
+  std::vector<Entity_ID> nearby;
+  find_entities_in_radius(us, dim, active_player.coord, AI_CELL_RADIUS,
+                          nearby);
+
+  for (Entity_ID e_id : nearby) {
+    if (!dim.e_ai.contains(e_id)) {
+      continue;
+    }
+    Entity_Ref e = us.entities[e_id];
+
+    // Followers go after their target instead, going back to the player once
+    // it's gone
+    f64 target_x = player_x;
+    f64 target_y = player_y;
+    if (e.ai_id == AI_ID::FOLLOW_PLAYER_SLOW) {
+      std::optional<Entity_Ref> target = get_entity(us, e.ai_target);
+      if (!target.has_value()) {
+        e.ai_target = us.entity_id_pool.get_handle(us.active_player);
+        target.emplace(get_active_player(us));
+      }
+      target_x = target->coord.x;
+      target_y = target->coord.y;
+    }
 
-    // Calculate the vector difference between the entity and the player
-    f64 dx = e.coord.x - player_x;
-    f64 dy = e.coord.y - player_y;
+    // Calculate the vector difference between the entity and the target
+    f64 dx = e.coord.x - target_x;
+    f64 dy = e.coord.y - target_y;
     f64 distance = sqrt(dx * dx + dy * dy);
 
     if (distance <= AI_CELL_RADIUS &&
@@ -1123,9 +1614,26 @@ void update_ai(Update_State &us) {
           e.vx *= damping_factor;
           e.vy *= damping_factor;
 
+          // Stop at walls instead of flying through them. If it's already
+          // stuck in one it's let out.
+          Entity_Coord center = {e.coord.x + e.boundingw / 2.0,
+                                 e.coord.y - e.boundingh / 2.0};
+          Raycast_Hit wall;
+          if (raycast(dim,
+                      {center, {center.x + e.vx, center.y + e.vy}},
+                      SOLID_CELL_MASK, wall) &&
+              wall.distance > 0) {
+            e.vx = 0;
+            e.vy = 0;
+          }
+
           // Update the position
-          e.coord.x += e.vx;
-          e.coord.y += e.vy;
+          if (e.vx != 0 || e.vy != 0) {
+            Chunk_Coord last_cc = get_chunk_coord(e.coord.x, e.coord.y);
+            e.coord.x += e.vx;
+            e.coord.y += e.vy;
+            mark_entity_chunk_change(dim, e_id, last_cc, e.coord);
+          }
 
           break;
         }
@@ -1162,8 +1670,10 @@ void update_ai(Update_State &us) {
           e.vy = (e.vy * (1 - blend_factor)) + (target_vy * blend_factor);
 
           // Update position
+          Chunk_Coord last_cc = get_chunk_coord(e.coord.x, e.coord.y);
           e.coord.x += e.vx;
           e.coord.y += e.vy;
+          mark_entity_chunk_change(dim, e_id, last_cc, e.coord);
 
           break;
         }
@@ -1174,422 +1684,549 @@ void update_ai(Update_State &us) {
   ai_frame++;
 }
 
-void gen_ov_forest_ch(Update_State &update_state, Chunk &chunk,
-                      const Chunk_Coord &chunk_coord) {
-  bool all_water = true;
-  bool all_air = true;
+// Generation has to come out the same no matter what order chunks are made
+// in, so spacing between forest plants is decided by the candidate columns
+// themselves rather than by whatever entities happen to exist already. A
+// column only gets a plant if there's no other candidate within spacing to
+// its left.
+bool forest_spawn_candidate(s64 abs_x, u32 world_seed) {
+  return surface_det_rand(static_cast<u64>(abs_x) ^ world_seed) %
+             GEN_TREE_MAX_WIDTH <
+         15;
+}
+
+bool forest_spawn_clear(s64 abs_x, u32 world_seed, s64 spacing) {
+  for (s64 left = abs_x - spacing + 1; left < abs_x; left++) {
+    if (forest_spawn_candidate(left, world_seed)) {
+      return false;
+    }
+  }
+  return true;
+}
 
+/// Column stages ///
+void gen_ov_forest_columns(u32 world_seed, s32 chunk_x, Gen_Columns &columns) {
   for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
-    f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
-    u8 grass_depth = 40 + surface_det_rand(static_cast<u64>(abs_x) ^
-                                           update_state.world_seed) %
-                              25;
-    s32 height =
-        static_cast<s32>(surface_height(abs_x, 64, update_state.world_seed)) +
-        SURFACE_Y_MIN * CHUNK_CELL_WIDTH;
-    for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
-      u16 cell_index = x + (y * CHUNK_CELL_WIDTH);
-
-      s32 our_height = (y + (chunk_coord.y * CHUNK_CELL_WIDTH));
-      if (height < SEA_LEVEL_CELL && our_height <= height) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::SAND);
-        all_water = false;
-        all_air = false;
-      } else if (height < SEA_LEVEL_CELL && our_height > height &&
-                 our_height < SEA_LEVEL_CELL) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::WATER);
-        all_air = false;
-      } else if (our_height < height && our_height >= height - grass_depth) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::GRASS);
-        all_water = false;
-        all_air = false;
-      } else if (our_height < height - grass_depth) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::DIRT);
-        all_water = false;
-        all_air = false;
+    f64 abs_x = x + chunk_x * CHUNK_CELL_WIDTH;
+    s32 grass_depth =
+        40 + surface_det_rand(static_cast<u64>(abs_x) ^ world_seed) % 25;
+    s32 height = static_cast<s32>(surface_height(abs_x, 64, world_seed)) +
+                 SURFACE_Y_MIN * CHUNK_CELL_WIDTH;
+    columns.heights[x] = height;
+
+    Gen_Column &column = columns.raw[x];
+    if (height < SEA_LEVEL_CELL) {
+      column = {{{Cell_Type::SAND, height + 1},
+                 {Cell_Type::WATER, static_cast<s32>(SEA_LEVEL_CELL)}},
+                2};
+    } else {
+      column = {{{Cell_Type::DIRT, height - grass_depth},
+                 {Cell_Type::GRASS, height}},
+                2};
+    }
+  }
+}
+
+void gen_ov_alaska_columns(u32 world_seed, s32 chunk_x, Gen_Columns &columns) {
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+    f64 abs_x = x + chunk_x * CHUNK_CELL_WIDTH;
+    s32 height = static_cast<s32>(surface_height(abs_x, 64, world_seed,
+                                                 64 * CHUNK_CELL_WIDTH,
+                                                 CHUNK_CELL_WIDTH * 6)) +
+                 SURFACE_Y_MIN * CHUNK_CELL_WIDTH;
+    s32 snow_depth =
+        60 + surface_det_rand(static_cast<u64>(abs_x) ^ world_seed) % 25;
+    columns.heights[x] = height;
+
+    columns.raw[x] = {{{Cell_Type::DIRT, height - snow_depth + 1},
+                       {Cell_Type::SNOW, height + 1}},
+                      2};
+  }
+}
+
+void gen_ov_ocean_columns(u32 world_seed, s32 chunk_x, Gen_Columns &columns) {
+  s32 off_shore_chunk = chunk_x - ALASKA_EAST_BORDER_CHUNK;
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+    f64 abs_x = x + chunk_x * CHUNK_CELL_WIDTH;
+    s32 height_offset =
+        static_cast<s32>(surface_height(abs_x, 64, world_seed));
+
+    f64 height_lerp_t =
+        static_cast<f64>(x) / static_cast<f64>(CHUNK_CELL_WIDTH);
+    f64 height_lerp = height_lerp_t + 1.0 * off_shore_chunk;
+
+    s32 height = height_offset + (SURFACE_Y_MIN * CHUNK_CELL_WIDTH) -
+                 static_cast<s32>(height_lerp * CHUNK_CELL_WIDTH *
+                                  1);  // Scale the decrease
+    columns.heights[x] = height;
+
+    s32 sea_level = static_cast<s32>(SEA_LEVEL_CELL);
+    columns.raw[x] = {{{Cell_Type::SAND, std::min(height + 1, sea_level)},
+                       {Cell_Type::WATER, sea_level}},
+                      2};
+  }
+}
+
+void gen_ov_nicaragua_columns(u32 world_seed, s32 chunk_x,
+                              Gen_Columns &columns) {
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+    f64 abs_x = x + chunk_x * CHUNK_CELL_WIDTH;
+    s32 height = static_cast<s32>(surface_height(abs_x, 64, world_seed,
+                                                 64 * CHUNK_CELL_WIDTH,
+                                                 CHUNK_CELL_WIDTH * 26)) +
+                 SURFACE_Y_MIN * CHUNK_CELL_WIDTH;
+    columns.heights[x] = height;
+
+    s32 lava_level =
+        static_cast<s32>(SEA_LEVEL_CELL) + (CHUNK_CELL_WIDTH * 2);
+    columns.raw[x] = {{{Cell_Type::NICARAGUA, height},
+                       {Cell_Type::LAVA, std::max(height, lava_level)}},
+                      2};
+  }
+}
+
+void gen_columns(u32 world_seed, DimensionIndex dimid, s32 chunk_x,
+                 Gen_Columns &columns) {
+  // Biomes by explicit positioning
+  switch (dimid) {
+    case DimensionIndex::OVERWORLD: {
+      if (chunk_x < NICARAGUA_EAST_BORDER_CHUNK) {
+        gen_ov_nicaragua_columns(world_seed, chunk_x, columns);
+      } else if (chunk_x < FOREST_EAST_BORDER_CHUNK) {
+        gen_ov_forest_columns(world_seed, chunk_x, columns);
+      } else if (chunk_x < ALASKA_EAST_BORDER_CHUNK) {
+        gen_ov_alaska_columns(world_seed, chunk_x, columns);
       } else {
-        chunk.cells[cell_index] = create_cell(Cell_Type::AIR);
-        all_water = false;
+        gen_ov_ocean_columns(world_seed, chunk_x, columns);
+      }
+      break;
+    }
+    case DimensionIndex::WATERWORLD: {
+      for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+        s32 sea_top = (SEA_LEVEL + 1) * CHUNK_CELL_WIDTH;
+        columns.heights[x] = sea_top;
+        columns.raw[x] = {{{Cell_Type::WATER, sea_top}}, 1};
+      }
+      break;
+    }
+  }
+
+  columns.stage = Gen_Stage::HEIGHTS;
+}
+
+void settle_columns(const Gen_Columns &left, Gen_Columns &columns,
+                    const Gen_Columns &right) {
+  const s32 WIDTH = CHUNK_CELL_WIDTH;
+
+  for (s32 x = 0; x < WIDTH; x++) {
+    Gen_Column &column = columns.settled[x];
+    column = columns.raw[x];
+
+    Gen_Band &fluid = column.bands[column.num_bands - 1];
+    if (cell_type_infos[(u16)fluid.type].state != Cell_State::LIQUID) {
+      continue;
+    }
+
+    s32 level = fluid.top;
+    for (s32 other_x = x - WIDTH; other_x <= x + WIDTH; other_x++) {
+      if (other_x == x) {
+        continue;
       }
+
+      const Gen_Column &other = other_x < 0        ? left.raw[other_x + WIDTH]
+                                : other_x >= WIDTH ? right.raw[other_x - WIDTH]
+                                                   : columns.raw[other_x];
+      s32 surface = other.bands[other.num_bands - 1].top;
+      level = std::min(level,
+                       surface + std::abs(other_x - x) * GEN_SETTLE_SLOPE);
+    }
+
+    s32 floor = column.num_bands > 1 ? column.bands[column.num_bands - 2].top
+                                     : level;
+    fluid.top = std::max(level, floor);
+  }
+
+  columns.stage = Gen_Stage::SETTLED;
+}
+
+const Gen_Columns &get_gen_columns(Update_State &update_state,
+                                   DimensionIndex dimid, s32 chunk_x,
+                                   Gen_Stage stage) {
+  Dimension &dim = update_state.dimensions[dimid];
+  Gen_Columns &columns = dim.gen_columns[chunk_x];
+
+  if (columns.stage < Gen_Stage::HEIGHTS) {
+    gen_columns(update_state.world_seed, dimid, chunk_x, columns);
+  }
+
+  if (stage >= Gen_Stage::SETTLED && columns.stage < Gen_Stage::SETTLED) {
+    settle_columns(
+        get_gen_columns(update_state, dimid, chunk_x - 1, Gen_Stage::HEIGHTS),
+        columns,
+        get_gen_columns(update_state, dimid, chunk_x + 1, Gen_Stage::HEIGHTS));
+  }
+
+  return columns;
+}
+
+/// Chunk stages ///
+void fill_chunk_terrain(Chunk &chunk, const Gen_Columns &columns) {
+  s32 bottom = chunk.coord.y * CHUNK_CELL_WIDTH;
+  s32 top = bottom + CHUNK_CELL_WIDTH - 1;
+
+  // Bands are one type each, so if the top and bottom cell of every column
+  // are the same type the whole chunk is, and it can share the uniform cells
+  // without filling anything in.
+  Cell_Type uniform = get_band_cell_type(columns.settled[0], bottom);
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH && uniform != Cell_Type::NONE; x++) {
+    if (get_band_cell_type(columns.settled[x], bottom) != uniform ||
+        get_band_cell_type(columns.settled[x], top) != uniform) {
+      uniform = Cell_Type::NONE;
     }
+  }
 
-    if (all_water) {
-      chunk.all_cell = Cell_Type::WATER;
-    } else if (all_air) {
-      chunk.all_cell = Cell_Type::AIR;
+  if (uniform != Cell_Type::NONE) {
+    set_chunk_uniform(chunk, uniform);
+  } else {
+    alloc_chunk_cells(chunk);
+    for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+      for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
+        s32 our_height = bottom + y;
+        set_cell_type(chunk, chunk.cells[x + (y * CHUNK_CELL_WIDTH)],
+                      get_band_cell_type(columns.settled[x], our_height));
+      }
     }
+  }
+
+  chunk.gen_stage = Gen_Stage::TERRAIN;
+}
+
+void gen_ov_forest_flora(u32 world_seed, const Gen_Columns &columns,
+                         const Chunk_Coord &chunk_coord,
+                         std::vector<Entity_Spawn> &spawns) {
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+    f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
+    s32 height = columns.heights[x];
 
     // added distance between tree's to prevent overlap
-    if (surface_det_rand(static_cast<u64>(abs_x) ^ update_state.world_seed) %
-                GEN_TREE_MAX_WIDTH <
-            15 &&
+    if (forest_spawn_candidate(abs_x, world_seed) &&
         height > chunk_coord.y * CHUNK_CELL_WIDTH &&
         height < (chunk_coord.y + 1) * CHUNK_CELL_WIDTH &&
         height >= SEA_LEVEL_CELL) {
-      // Check if a tree already exists at this location
-      bool locationFree = true;
-      for (const auto &entity_id :
-           update_state.dimensions[update_state.active_dimension]
-               .entity_indicies) {
-        const Entity &existingEntity = update_state.entities[entity_id];
-
-        if (existingEntity.texture == Texture_Id::TREE &&
-            std::abs(existingEntity.coord.x - abs_x) <
-                100) {  // 100 distance between tree's
-          locationFree = false;
-          break;
-        }
-      }
-
-      if (locationFree) {
-        Entity_ID id;
-        create_entity(update_state, update_state.active_dimension,
-                      Entity_Factory_Type::TREE, id);
-
-        Entity &tree = update_state.entities[id];
-        tree.coord.x = abs_x;
-        tree.coord.y =
-            height +
-            85.0f;  // This assumes tree base height doesn't affect spawn logic
+      // 100 distance between tree's
+      if (forest_spawn_clear(abs_x, world_seed, 100)) {
+        // This assumes tree base height doesn't affect spawn logic
+        spawns.push_back({Entity_Factory_Type::TREE,
+                          {abs_x, height + 85.0f},
+                          Texture_Id::NONE});
       }
     }
 
     // Unified spawner for bush and grass
-    if (surface_det_rand(static_cast<u64>(abs_x) ^ update_state.world_seed) %
-                GEN_TREE_MAX_WIDTH <
-            15 &&
+    if (forest_spawn_candidate(abs_x, world_seed) &&
         height > chunk_coord.y * CHUNK_CELL_WIDTH &&
         height < (chunk_coord.y + 1) * CHUNK_CELL_WIDTH &&
         height >= SEA_LEVEL_CELL) {
-      bool locationFreeForBush = true;
-      bool locationFreeForGrass = true;
-
-      bool tryBushFirst = (std::rand() % 2) == 0;
-
-      for (const auto &entity_id :
-           update_state.dimensions[update_state.active_dimension]
-               .entity_indicies) {
-        const Entity &existingEntity = update_state.entities[entity_id];
-
-        if (existingEntity.texture == Texture_Id::BUSH &&
-            std::abs(existingEntity.coord.x - abs_x) <
-                15) {  // Check for existing bush
-          locationFreeForBush = false;
-        }
+      bool locationFreeForBush = forest_spawn_clear(abs_x, world_seed, 15);
+      bool locationFreeForGrass = forest_spawn_clear(abs_x, world_seed, 10);
 
-        if (existingEntity.texture == Texture_Id::GRASS &&
-            std::abs(existingEntity.coord.x - abs_x) <
-                10) {  // Check for existing grass
-          locationFreeForGrass = false;
-        }
+      bool tryBushFirst =
+          (surface_det_rand(static_cast<u64>(abs_x) ^ (world_seed + 1)) &
+           1) == 0;
 
-        // If location is not free for either, stop checking
-        if (!locationFreeForBush && !locationFreeForGrass) {
-          break;
-        }
-      }
+      Entity_Spawn bush = {Entity_Factory_Type::BUSH,
+                           {abs_x, height + 20.0f},
+                           Texture_Id::NONE};
+      Entity_Spawn grass = {Entity_Factory_Type::GRASS,
+                            {abs_x, height + 10.0f},
+                            Texture_Id::NONE};
 
       if (tryBushFirst) {
         if (locationFreeForBush) {
-          Entity_ID id;
-          create_entity(update_state, update_state.active_dimension,
-                        Entity_Factory_Type::BUSH, id);
-
-          Entity &bush = update_state.entities[id];
-          bush.coord.x = abs_x;
-          bush.coord.y = height + 20.0f;
+          spawns.push_back(bush);
         }
 
         // Spawn grass if location is free
         else if (locationFreeForGrass) {
-          Entity_ID id;
-          create_entity(update_state, update_state.active_dimension,
-                        Entity_Factory_Type::GRASS, id);
-
-          Entity &grass = update_state.entities[id];
-          grass.coord.x = abs_x;
-          grass.coord.y = height + 10.0f;
+          spawns.push_back(grass);
         }
       } else {
         // Spawn grass if location is free
         if (locationFreeForGrass) {
-          Entity_ID id;
-          create_entity(update_state, update_state.active_dimension,
-                        Entity_Factory_Type::GRASS, id);
-
-          Entity &grass = update_state.entities[id];
-          grass.coord.x = abs_x;
-          grass.coord.y = height + 10.0f;
+          spawns.push_back(grass);
         }
 
         // Spawn bush if location is free
         else if (locationFreeForBush) {
-          Entity_ID id;
-          create_entity(update_state, update_state.active_dimension,
-                        Entity_Factory_Type::BUSH, id);
-
-          Entity &bush = update_state.entities[id];
-          bush.coord.x = abs_x;
-          bush.coord.y = height + 20.0f;
+          spawns.push_back(bush);
         }
       }
     }
+  }
+}
+
+void gen_ov_forest_creatures(const Gen_Columns &columns,
+                             const Chunk_Coord &chunk_coord,
+                             std::vector<Entity_Spawn> &spawns) {
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+    f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
+    s32 height = columns.heights[x];
 
     // neitzsche spawner
     if (abs_x == 250 && height > chunk_coord.y * CHUNK_CELL_WIDTH &&
         height < (chunk_coord.y + 1) * CHUNK_CELL_WIDTH) {
-      Entity_ID id;
-      create_entity(update_state, update_state.active_dimension,
-                    Entity_Factory_Type::NIETZSCHE, id);
-
-      Entity &neitzsche = update_state.entities[id];
-      neitzsche.coord.x = abs_x;
-      neitzsche.coord.y = height + 85.0f;
+      spawns.push_back({Entity_Factory_Type::NIETZSCHE,
+                        {abs_x, height + 85.0f},
+                        Texture_Id::NONE});
     }
   }
 }
 
-void gen_ov_alaska_ch(Update_State &update_state, Chunk &chunk,
-                      const Chunk_Coord &chunk_coord) {
-  bool all_air = true;
+void gen_ov_alaska_flora(u32 world_seed, const Gen_Columns &columns,
+                         const Chunk_Coord &chunk_coord,
+                         std::vector<Entity_Spawn> &spawns) {
   for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
     f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
-    s32 height = static_cast<s32>(surface_height(
-                     abs_x, 64, update_state.world_seed, 64 * CHUNK_CELL_WIDTH,
-                     CHUNK_CELL_WIDTH * 6)) +
-                 SURFACE_Y_MIN * CHUNK_CELL_WIDTH;
-
-    for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
-      u16 cell_index = x + (y * CHUNK_CELL_WIDTH);
+    s32 height = columns.heights[x];
 
-      s32 our_height = (y + (chunk_coord.y * CHUNK_CELL_WIDTH));
-      if (our_height > height) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::AIR);
-      } else {
-        u8 snow_depth = 60 + surface_det_rand(static_cast<u64>(abs_x) ^
-                                              update_state.world_seed) %
-                                 25;
-
-        if (our_height > height - snow_depth) {
-          chunk.cells[cell_index] = create_cell(Cell_Type::SNOW);
-        } else {
-          chunk.cells[cell_index] = create_cell(Cell_Type::DIRT);
-        }
-        all_air = false;
-      }
-    }
-
-    u16 tree_rand =
-        surface_det_rand(static_cast<u64>(abs_x) ^ update_state.world_seed);
+    u16 tree_rand = surface_det_rand(static_cast<u64>(abs_x) ^ world_seed);
     if (tree_rand % AK_GEN_TREE_MAX_WIDTH < 15 &&
         height > chunk_coord.y * CHUNK_CELL_WIDTH &&
         height < (chunk_coord.y + 1) * CHUNK_CELL_WIDTH &&
         height >= SEA_LEVEL_CELL) {
-      Entity_ID new_tree;
-      Result en_res = create_entity(update_state, update_state.active_dimension,
-                                    Entity_Factory_Type::TREE, new_tree);
-
-      if (en_res == Result::SUCCESS) {
-        Entity &tree = update_state.entities[new_tree];
-
-        if (tree_rand & 1) {
-          tree.texture = Texture_Id::AKTREE1;
-          tree.coord.y = height + 110;
-        } else {
-          tree.texture = Texture_Id::AKTREE2;
-          tree.coord.y = height + 90;
-        }
-
-        tree.coord.x = abs_x;
+      if (tree_rand & 1) {
+        spawns.push_back({Entity_Factory_Type::TREE,
+                          {abs_x, height + 110.0},
+                          Texture_Id::AKTREE1});
+      } else {
+        spawns.push_back({Entity_Factory_Type::TREE,
+                          {abs_x, height + 90.0},
+                          Texture_Id::AKTREE2});
       }
     }
+  }
+}
+
+void gen_ov_alaska_creatures(const Gen_Columns &columns,
+                             const Chunk_Coord &chunk_coord,
+                             std::vector<Entity_Spawn> &spawns) {
+  for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
+    f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
+    s32 height = columns.heights[x];
 
     // Alaska Nietzsche spawner
     if (abs_x == 250 + FOREST_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH &&
         height > chunk_coord.y * CHUNK_CELL_WIDTH &&
         height < (chunk_coord.y + 1) * CHUNK_CELL_WIDTH) {
-      Entity_ID id;
-      create_entity(update_state, update_state.active_dimension,
-                    Entity_Factory_Type::AKNIETZSCHE, id);
-
-      Entity &akneitzsche = update_state.entities[id];
-      akneitzsche.coord.x = abs_x;
-      akneitzsche.coord.y = height + 85.0f;
-      LOG_DEBUG("AKNIETZSCHE spawned at {}, {}", abs_x, akneitzsche.coord.y);
+      spawns.push_back({Entity_Factory_Type::AKNIETZSCHE,
+                        {abs_x, height + 85.0f},
+                        Texture_Id::NONE});
+      LOG_DEBUG("AKNIETZSCHE spawned at {}, {}", abs_x, height + 85.0f);
     }
   }
-
-  if (all_air) {
-    chunk.all_cell = Cell_Type::AIR;
-  }
 }
 
-void gen_ov_ocean_chunk(Update_State &update_state, Chunk &chunk,
-                        const Chunk_Coord &chunk_coord) {
-  bool all_water = true;
-  bool all_air = true;
-  bool all_sand = true;
-
-  s32 off_shore_chunk = chunk_coord.x - ALASKA_EAST_BORDER_CHUNK;
+void gen_ov_ocean_flora(const Gen_Columns &columns,
+                        const Chunk_Coord &chunk_coord,
+                        std::vector<Entity_Spawn> &spawns) {
+  // Spawn some flora
   for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
     f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
-    s32 height_offset =
-        static_cast<s32>(surface_height(abs_x, 64, update_state.world_seed));
-
-    f64 height_lerp_t =
-        static_cast<f64>(x) / static_cast<f64>(CHUNK_CELL_WIDTH);
-    f64 height_lerp = height_lerp_t + 1.0 * off_shore_chunk;
-
-    s64 height = height_offset + (SURFACE_Y_MIN * CHUNK_CELL_WIDTH) -
-                 static_cast<s64>(height_lerp * CHUNK_CELL_WIDTH *
-                                  1);  // Scale the decrease
-
-    for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
-      u16 cell_index = x + (y * CHUNK_CELL_WIDTH);
-
-      s32 our_height = (y + (chunk_coord.y * CHUNK_CELL_WIDTH));
-
-      if (our_height >= SEA_LEVEL_CELL) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::AIR);
-        all_water = false;
-        all_sand = false;
-      } else if (our_height > height) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::WATER);
-        all_air = false;
-        all_sand = false;
-      } else {
-        chunk.cells[cell_index] = create_cell(Cell_Type::SAND);
-        all_air = false;
-        all_water = false;
-      }
-
-      // Spawn some flora
-      u32 entity_rand = surface_det_rand(height);
-      if (our_height == height) {
-        if (entity_rand % 300 < 10) {
-          Entity_ID flora_id;
-          Result flora_create_res =
-              create_entity(update_state, DimensionIndex::OVERWORLD,
-                            Entity_Factory_Type::SEAWEED, flora_id);
-          if (flora_create_res == Result::SUCCESS) {
-            Entity &e = update_state.entities[flora_id];
-            e.coord.x = abs_x;
-            e.coord.y = our_height + 50;
-          }
-        }
-      }  // Flora
-
-    }  // y loop
+    s64 height = columns.heights[x];
+    if (height < chunk_coord.y * CHUNK_CELL_WIDTH ||
+        height >= (chunk_coord.y + 1) * CHUNK_CELL_WIDTH) {
+      continue;
+    }
 
-  }  // x loop
+    u32 entity_rand = surface_det_rand(height);
+    if (entity_rand % 300 < 10) {
+      spawns.push_back({Entity_Factory_Type::SEAWEED,
+                        {abs_x, static_cast<f64>(height + 50)},
+                        Texture_Id::NONE});
+    }
+  }
+}
 
-  // Spawn some fauna
-  // We really really need a unified entity spawner.
+void gen_ov_ocean_creatures(u32 world_seed, const Chunk_Coord &chunk_coord,
+                            std::vector<Entity_Spawn> &spawns) {
+  // Spawn some fauna. Each species rolls its own spot so they don't all turn
+  // up in the same place.
   u32 entity_rand =
       surface_det_rand(chunk_coord.y) - surface_det_rand(chunk_coord.x);
+  entity_rand ^= world_seed;
+  auto fauna_coord = [&chunk_coord, entity_rand](u32 species) {
+    u16 fauna_x = surface_det_rand(entity_rand + species * 2 + 1) % 20;
+    u16 fauna_y = surface_det_rand(entity_rand + species * 2 + 2) % 20;
+    return Entity_Coord{
+        static_cast<f64>(chunk_coord.x * CHUNK_CELL_WIDTH + fauna_x),
+        static_cast<f64>(chunk_coord.y * CHUNK_CELL_WIDTH + fauna_y)};
+  };
 
   // Fosh
   if (surface_det_rand(entity_rand) % 10000 < 150 &&
       chunk_coord.y < SEA_LEVEL) {
-    Entity_ID fauna_id;
-    Result fauna_create_res =
-        create_entity(update_state, DimensionIndex::OVERWORLD,
-                      Entity_Factory_Type::JELLYFISH, fauna_id);
-    if (fauna_create_res == Result::SUCCESS) {
-      Entity &e = update_state.entities[fauna_id];
-      e.coord.x = chunk_coord.x * CHUNK_CELL_WIDTH + rand() % 20;
-      e.coord.y = chunk_coord.y * CHUNK_CELL_WIDTH + rand() % 20;
-      // LOG_DEBUG("Spawned jellyfish: {} {}", e.coord.x, e.coord.y);
-    } else {
-      LOG_WARN("Failed to spawn jellyfish: {}", (u16)fauna_create_res);
-    }
+    spawns.push_back(
+        {Entity_Factory_Type::JELLYFISH, fauna_coord(0), Texture_Id::NONE});
   } else if (entity_rand % 100000 < 150 && chunk_coord.y < SEA_LEVEL) {
-    Entity_ID fauna_id;
-    Result fauna_create_res =
-        create_entity(update_state, DimensionIndex::OVERWORLD,
-                      Entity_Factory_Type::FISH, fauna_id);
-    if (fauna_create_res == Result::SUCCESS) {
-      Entity &e = update_state.entities[fauna_id];
-      e.coord.x = chunk_coord.x * CHUNK_CELL_WIDTH + rand() % 20;
-      e.coord.y = chunk_coord.y * CHUNK_CELL_WIDTH + rand() % 20;
-      // LOG_DEBUG("Spawned fish: {} {}", e.coord.x, e.coord.y);
-    } else {
-      LOG_WARN("Failed to spawn fish: {}", (u16)fauna_create_res);
-    }
-  }
-
-  if (all_water) {
-    chunk.all_cell = Cell_Type::WATER;
-  }
-  if (all_air) {
-    chunk.all_cell = Cell_Type::AIR;
-  }
-  if (all_sand) {
-    chunk.all_cell = Cell_Type::SAND;
+    spawns.push_back(
+        {Entity_Factory_Type::FISH, fauna_coord(1), Texture_Id::NONE});
   }
 }
 
-void gen_ov_nicaragua(Update_State &update_state, Chunk &chunk,
-                      const Chunk_Coord &chunk_coord) {
-  bool all_air = true;
+void gen_ov_nicaragua_creatures(const Gen_Columns &columns,
+                                const Chunk_Coord &chunk_coord,
+                                std::vector<Entity_Spawn> &spawns) {
   for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
     f64 abs_x = x + chunk_coord.x * CHUNK_CELL_WIDTH;
-    s32 height = static_cast<s32>(surface_height(
-                     abs_x, 64, update_state.world_seed, 64 * CHUNK_CELL_WIDTH,
-                     CHUNK_CELL_WIDTH * 26)) +
-                 SURFACE_Y_MIN * CHUNK_CELL_WIDTH;
-
-    for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
-      u16 cell_index = x + (y * CHUNK_CELL_WIDTH);
-
-      s32 our_height = (y + (chunk_coord.y * CHUNK_CELL_WIDTH));
-      if (our_height < height) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::NICARAGUA);
-        all_air = false;
-      } else if (our_height < SEA_LEVEL_CELL + (CHUNK_CELL_WIDTH * 2)) {
-        chunk.cells[cell_index] = create_cell(Cell_Type::LAVA);
-      } else {
-        chunk.cells[cell_index] = create_cell(Cell_Type::AIR);
-      }
-    }
+    s32 height = columns.heights[x];
 
     // Sand Nietzsche spawner
     if (abs_x == NICARAGUA_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH - 250 &&
         height > chunk_coord.y * CHUNK_CELL_WIDTH &&
         height < (chunk_coord.y + 1) * CHUNK_CELL_WIDTH) {
-      Entity_ID id;
-      create_entity(update_state, update_state.active_dimension,
-                    Entity_Factory_Type::SDNIETZSCHE, id);
+      spawns.push_back(
+          {Entity_Factory_Type::SDNIETZSCHE,
+           {abs_x, height + 85.0f + chunk_coord.y * CHUNK_CELL_WIDTH},
+           Texture_Id::NONE});
+    }
+  }
+}
+
+bool find_structure_placement(Update_State &update_state, DimensionIndex dimid,
+                              s32 chunk_x, Structure_Placement &placement) {
+  if (dimid != DimensionIndex::OVERWORLD || update_state.structures.empty()) {
+    return false;
+  }
+
+  s32 slot = floor_div(chunk_x, STRUCTURE_SLOT_CHUNKS);
+  u64 slot_seed = (static_cast<u64>(update_state.world_seed) << 32) ^
+                  static_cast<u32>(slot);
+  u16 prefab_rand = surface_det_rand(slot_seed);
+  u16 chance_rand = surface_det_rand(slot_seed + 1);
+  u16 offset_rand = surface_det_rand(slot_seed + 2);
+
+  const Structure_Prefab &prefab =
+      update_state.structures[prefab_rand % update_state.structures.size()];
+  if (chance_rand % 100 >= prefab.chance) {
+    return false;
+  }
+
+  s64 left = static_cast<s64>(slot) * STRUCTURE_SLOT_CELLS +
+             offset_rand % (STRUCTURE_SLOT_CELLS - prefab.width + 1);
+  s64 right = left + prefab.width - 1;
+  if (get_overworld_biome(left) != prefab.biome ||
+      get_overworld_biome(right) != prefab.biome) {
+    return false;
+  }
 
-      Entity &sdneitzsche = update_state.entities[id];
-      sdneitzsche.coord.x = abs_x;
-      sdneitzsche.coord.y = height + 85.0f + chunk_coord.y * CHUNK_CELL_WIDTH;
+  // Sits on the lower of its two edges
+  s32 left_chunk = floor_div(left, CHUNK_CELL_WIDTH);
+  s32 right_chunk = floor_div(right, CHUNK_CELL_WIDTH);
+  s32 left_height =
+      get_gen_columns(update_state, dimid, left_chunk, Gen_Stage::HEIGHTS)
+          .heights[left - static_cast<s64>(left_chunk) * CHUNK_CELL_WIDTH];
+  s32 right_height =
+      get_gen_columns(update_state, dimid, right_chunk, Gen_Stage::HEIGHTS)
+          .heights[right - static_cast<s64>(right_chunk) * CHUNK_CELL_WIDTH];
+  s32 height = std::min(left_height, right_height);
+
+  // Only ocean structures go underwater
+  if (prefab.biome != Biome::OCEAN && height < SEA_LEVEL_CELL) {
+    return false;
+  }
+
+  placement.prefab = &prefab;
+  placement.x = left;
+  placement.y = height - prefab.sink;
+  return true;
+}
+
+void decorate_chunk(Update_State &update_state, DimensionIndex dimid,
+                    Chunk &chunk) {
+  const Chunk_Coord &chunk_coord = chunk.coord;
+  const Gen_Columns &columns = get_gen_columns(
+      update_state, dimid, chunk_coord.x, Gen_Stage::HEIGHTS);
+  u32 world_seed = update_state.world_seed;
+
+  std::vector<Entity_Spawn> spawns;
+  if (dimid == DimensionIndex::OVERWORLD) {
+    if (chunk_coord.x < NICARAGUA_EAST_BORDER_CHUNK) {
+      // Nothing grows in Nicaragua
+    } else if (chunk_coord.x < FOREST_EAST_BORDER_CHUNK) {
+      gen_ov_forest_flora(world_seed, columns, chunk_coord, spawns);
+    } else if (chunk_coord.x < ALASKA_EAST_BORDER_CHUNK) {
+      gen_ov_alaska_flora(world_seed, columns, chunk_coord, spawns);
+    } else {
+      gen_ov_ocean_flora(columns, chunk_coord, spawns);
     }
   }
+  spawn_entities(update_state, dimid, spawns);
 
-  if (all_air) {
-    chunk.all_cell = Cell_Type::AIR;
+  Structure_Placement placement;
+  if (find_structure_placement(update_state, dimid, chunk_coord.x,
+                               placement)) {
+    stamp_structure(chunk, placement);
+    mark_chunk_summary_stale(update_state.dimensions[dimid], chunk);
   }
+
+  chunk.gen_stage = Gen_Stage::DECORATED;
 }
 
-void gen_overworld_chunk(Update_State &update_state, Chunk &chunk,
-                         const Chunk_Coord &chunk_coord) {
-  if (chunk_coord.x < NICARAGUA_EAST_BORDER_CHUNK) {
-    gen_ov_nicaragua(update_state, chunk, chunk_coord);
-    return;
+void populate_chunk(Update_State &update_state, DimensionIndex dimid,
+                    Chunk &chunk) {
+  const Chunk_Coord &chunk_coord = chunk.coord;
+  const Gen_Columns &columns = get_gen_columns(
+      update_state, dimid, chunk_coord.x, Gen_Stage::HEIGHTS);
+
+  std::vector<Entity_Spawn> spawns;
+  if (dimid == DimensionIndex::OVERWORLD) {
+    if (chunk_coord.x < NICARAGUA_EAST_BORDER_CHUNK) {
+      gen_ov_nicaragua_creatures(columns, chunk_coord, spawns);
+    } else if (chunk_coord.x < FOREST_EAST_BORDER_CHUNK) {
+      gen_ov_forest_creatures(columns, chunk_coord, spawns);
+    } else if (chunk_coord.x < ALASKA_EAST_BORDER_CHUNK) {
+      gen_ov_alaska_creatures(columns, chunk_coord, spawns);
+    } else {
+      gen_ov_ocean_creatures(update_state.world_seed, chunk_coord, spawns);
+    }
   }
 
-  if (chunk_coord.x < FOREST_EAST_BORDER_CHUNK) {
-    gen_ov_forest_ch(update_state, chunk, chunk_coord);
-    return;
+  // Only the chunk with the structure's corner spawns its entities so they
+  // aren't spawned again by every chunk it covers
+  Structure_Placement placement;
+  if (find_structure_placement(update_state, dimid, chunk_coord.x,
+                               placement) &&
+      floor_div(placement.x, CHUNK_CELL_WIDTH) == chunk_coord.x &&
+      floor_div(placement.y, CHUNK_CELL_WIDTH) == chunk_coord.y) {
+    for (const Structure_Entity &structure_entity :
+         placement.prefab->entities) {
+      spawns.push_back({structure_entity.type,
+                        {static_cast<f64>(placement.x + structure_entity.x),
+                         static_cast<f64>(placement.y + structure_entity.y)},
+                        Texture_Id::NONE});
+    }
   }
 
-  if (chunk_coord.x < ALASKA_EAST_BORDER_CHUNK) {
-    gen_ov_alaska_ch(update_state, chunk, chunk_coord);
-    return;
+  spawn_entities(update_state, dimid, spawns);
+
+  chunk.gen_stage = Gen_Stage::POPULATED;
+}
+
+void advance_chunk_gen(Update_State &update_state, DimensionIndex dimid,
+                       Chunk &chunk, Gen_Stage target) {
+  assert(chunk.gen_stage >= Gen_Stage::TERRAIN);
+
+  if (chunk.gen_stage < Gen_Stage::DECORATED &&
+      target >= Gen_Stage::DECORATED) {
+    decorate_chunk(update_state, dimid, chunk);
+    chunk.unsaved = true;
   }
 
-  gen_ov_ocean_chunk(update_state, chunk, chunk_coord);
+  if (chunk.gen_stage < Gen_Stage::POPULATED &&
+      target >= Gen_Stage::POPULATED) {
+    populate_chunk(update_state, dimid, chunk);
+    chunk.unsaved = true;
+  }
 }
 
 Result gen_chunk(Update_State &update_state, DimensionIndex dim, Chunk &chunk,
@@ -1607,152 +2244,571 @@ Result gen_chunk(Update_State &update_state, DimensionIndex dim, Chunk &chunk,
 
   /// Zones ///
 
-  // Biomes by explicit positioning
-  switch (dim) {
-    case DimensionIndex::OVERWORLD: {
-      gen_overworld_chunk(update_state, chunk, chunk_coord);
-      break;
-    }
-    case DimensionIndex::WATERWORLD: {
-      const Cell base_air = create_cell(Cell_Type::AIR);
-      if (chunk_coord.y > SEA_LEVEL) {
-        for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
-          for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
-            chunk.cells[x + y * CHUNK_CELL_WIDTH] = base_air;
-          }
-        }
-      } else {
-        for (u8 x = 0; x < CHUNK_CELL_WIDTH; x++) {
-          for (u8 y = 0; y < CHUNK_CELL_WIDTH; y++) {
-            chunk.cells[x + y * CHUNK_CELL_WIDTH] =
-                create_cell(Cell_Type::WATER);
-          }
-        }
-      }
-      chunk.all_cell = Cell_Type::WATER;
-      break;
-    }
-  }
-
+  // Everything below has to be a pure function of the world seed, dim and
+  // chunk_coord. No std::rand and no looking at what's already loaded, so
+  // chunks come out the same whatever order they're generated in.
   chunk.coord = chunk_coord;
+  fill_chunk_terrain(chunk, get_gen_columns(update_state, dim, chunk_coord.x,
+                                            Gen_Stage::SETTLED));
+  advance_chunk_gen(update_state, dim, chunk, Gen_Stage::POPULATED);
+
+  return Result::SUCCESS;
+}
 
+Result load_saved_chunk(Update_State &update_state, DimensionIndex dimid,
+                        const Chunk_Coord &coord) {
+  Chunk chunk = {};
+  chunk.coord = coord;
+  chunk.last_needed = update_state.frame;
+
+  std::vector<Saved_Entity> saved_entities;
+  Result read_res = read_region_chunk(update_state.world_save, dimid, coord,
+                                      chunk, saved_entities);
+  if (read_res != Result::SUCCESS) {
+    return read_res;
+  }
+
+  Dimension &dim = update_state.dimensions[dimid];
+  auto chunk_iter = dim.chunks.emplace(coord, std::move(chunk)).first;
+  mark_chunk_summary_stale(dim, chunk_iter->second);
+  spawn_saved_entities(update_state, dimid, saved_entities);
   return Result::SUCCESS;
 }
 
 Result load_chunk(Update_State &update_state, DimensionIndex dimid,
                   const Chunk_Coord &coord) {
   Dimension &dim = update_state.dimensions[dimid];
-  if (dim.chunks.find(coord) == dim.chunks.end()) {
-    gen_chunk(update_state, dimid, dim.chunks[coord], coord);
+  auto chunk_iter = dim.chunks.find(coord);
+  if (chunk_iter != dim.chunks.end()) {
+    chunk_iter->second.last_needed = update_state.frame;
+    return Result::SUCCESS;
   }
-  // Eventually we'll also load from disk
 
-  return Result::SUCCESS;
+  if (load_saved_chunk(update_state, dimid, coord) == Result::SUCCESS) {
+    return Result::SUCCESS;
+  }
+
+  Chunk &chunk = dim.chunks[coord];
+  chunk.last_needed = update_state.frame;
+  chunk.unsaved = true;
+  Result gen_res = gen_chunk(update_state, dimid, chunk, coord);
+  mark_chunk_summary_stale(dim, chunk);
+  return gen_res;
+}
+
+// Runs job for each item on the thread pool and waits for all of them
+template <typename Item, typename Job>
+void run_gen_jobs(ThreadPool &thread_pool, const std::vector<Item> &items,
+                  const Job &job) {
+  std::vector<std::future<void>> futures;
+  futures.reserve(items.size());
+  for (const Item &item : items) {
+    futures.push_back(thread_pool.enqueue([&job, &item]() { job(item); }));
+  }
+
+  for (auto &future : futures) {
+    future.get();
+  }
 }
 
 Result load_chunks_square(Update_State &update_state, DimensionIndex dimid,
                           f64 x, f64 y, u8 radius) {
+  Dimension &dim = update_state.dimensions[dimid];
   Chunk_Coord origin = get_chunk_coord(x, y);
 
+  // Columns are cheap to work out again, so only the nearby ones are kept
+  for (auto columns_iter = dim.gen_columns.begin();
+       columns_iter != dim.gen_columns.end();) {
+    if (std::abs(columns_iter->first - origin.x) > radius + 1) {
+      columns_iter = dim.gen_columns.erase(columns_iter);
+    } else {
+      columns_iter++;
+    }
+  }
+
+  std::vector<Chunk_Coord> to_gen;
   Chunk_Coord icc;
   for (icc.x = origin.x - radius; icc.x < origin.x + radius; icc.x++) {
     for (icc.y = origin.y - radius; icc.y < origin.y + radius; icc.y++) {
-      load_chunk(update_state, dimid, icc);
+      auto chunk_iter = dim.chunks.find(icc);
+      if (chunk_iter != dim.chunks.end()) {
+        chunk_iter->second.last_needed = update_state.frame;
+      } else if (load_saved_chunk(update_state, dimid, icc) !=
+                 Result::SUCCESS) {
+        to_gen.push_back(icc);
+      }
+    }
+  }
+
+  if (to_gen.empty()) {
+    return Result::SUCCESS;
+  }
+
+  // Each stage runs for every chunk that needs it at once on the thread pool.
+  // The map entries are all made here first so the workers only ever touch
+  // their own.
+  std::set<s32> heights_xs, settle_xs;
+  for (const Chunk_Coord &coord : to_gen) {
+    settle_xs.insert(coord.x);
+    for (s32 column_x = coord.x - 1; column_x <= coord.x + 1; column_x++) {
+      heights_xs.insert(column_x);
+    }
+  }
+
+  std::vector<s32> jobs;
+  for (s32 column_x : heights_xs) {
+    if (dim.gen_columns[column_x].stage < Gen_Stage::HEIGHTS) {
+      jobs.push_back(column_x);
     }
   }
+  run_gen_jobs(*update_state.thread_pool, jobs, [&](s32 column_x) {
+    gen_columns(update_state.world_seed, dimid, column_x,
+                dim.gen_columns.at(column_x));
+  });
+
+  // Settling only reads the raw bands either side, so neighbors can settle at
+  // the same time
+  jobs.clear();
+  for (s32 column_x : settle_xs) {
+    if (dim.gen_columns.at(column_x).stage < Gen_Stage::SETTLED) {
+      jobs.push_back(column_x);
+    }
+  }
+  run_gen_jobs(*update_state.thread_pool, jobs, [&](s32 column_x) {
+    settle_columns(dim.gen_columns.at(column_x - 1),
+                   dim.gen_columns.at(column_x),
+                   dim.gen_columns.at(column_x + 1));
+  });
+
+  for (const Chunk_Coord &coord : to_gen) {
+    Chunk &chunk = dim.chunks[coord];
+    chunk.coord = coord;
+    chunk.last_needed = update_state.frame;
+    chunk.unsaved = true;
+  }
+  run_gen_jobs(*update_state.thread_pool, to_gen,
+               [&](const Chunk_Coord &coord) {
+                 fill_chunk_terrain(dim.chunks.at(coord),
+                                    dim.gen_columns.at(coord.x));
+               });
+  for (const Chunk_Coord &coord : to_gen) {
+    mark_chunk_summary_stale(dim, dim.chunks.at(coord));
+  }
 
   return Result::SUCCESS;
 }
 
-Result get_entity_id(std::unordered_set<Entity_ID> &entity_id_pool,
-                     Entity_ID &id) {
-  static Entity_ID current_entity = 1;
-  static std::pair<std::unordered_set<Entity_ID>::iterator, bool> result;
+void populate_chunks_square(Update_State &update_state, DimensionIndex dimid,
+                            f64 x, f64 y, u8 radius) {
+  Dimension &dim = update_state.dimensions[dimid];
+  Chunk_Coord origin = get_chunk_coord(x, y);
+
+  Chunk_Coord icc;
+  for (icc.x = origin.x - radius; icc.x < origin.x + radius; icc.x++) {
+    for (icc.y = origin.y - radius; icc.y < origin.y + radius; icc.y++) {
+      auto chunk_iter = dim.chunks.find(icc);
+      if (chunk_iter != dim.chunks.end() &&
+          chunk_iter->second.gen_stage < Gen_Stage::POPULATED) {
+        advance_chunk_gen(update_state, dimid, chunk_iter->second,
+                          Gen_Stage::POPULATED);
+      }
+    }
+  }
+}
+
+std::filesystem::path get_world_save_dir(const Config &config, u32 world_seed) {
+  return config.save_dir / fmt::format("{:08x}", world_seed);
+}
+
+void snapshot_chunks(Update_State &update_state, DimensionIndex dimid,
+                     const std::vector<Chunk_Coord> &coords) {
+  if (!update_state.world_save.enabled || coords.empty()) {
+    return;
+  }
+
+  Dimension &dim = update_state.dimensions[dimid];
 
-  Entity_ID start_entity = current_entity;
-  do {
-    result = entity_id_pool.insert(current_entity);
-    if (result.second) {
-      id = current_entity;
-      return Result::SUCCESS;
+  std::map<Chunk_Coord, std::shared_ptr<Chunk_Snapshot>> snapshots;
+  for (const Chunk_Coord &coord : coords) {
+    auto chunk_iter = dim.chunks.find(coord);
+    if (chunk_iter == dim.chunks.end()) {
+      continue;
     }
 
-    current_entity = (current_entity + 1) % MAX_TOTAL_ENTITIES;
-    if (current_entity == 0) {
-      ++current_entity;
-    }  // Skip 0
-  } while (current_entity != start_entity);
+    auto snapshot = std::make_shared<Chunk_Snapshot>();
+    snapshot->chunk = chunk_iter->second;
+    snapshots.emplace(coord, std::move(snapshot));
+
+    chunk_iter->second.unsaved = false;
+  }
+
+  // Entities belong to whatever chunk their coord is in, which is the grid
+  // bucket they're in. The player and deathless entities aren't part of the
+  // world, so they don't get saved.
+  for (auto &[coord, snapshot] : snapshots) {
+    dim.e_grid.for_each(coord, coord, [&](Entity_ID id) {
+      Entity_Ref e = update_state.entities[id];
+      if (id != update_state.active_player &&
+          !(e.status & (u16)Entity_Status::DEATHLESS)) {
+        snapshot->entities.push_back(
+            {e.factory_type, e.coord, e.texture, e.flipped, e.health});
+      }
+    });
+    queue_chunk_save(update_state.world_save, dimid, std::move(snapshot));
+  }
+}
+
+void request_save_flush(Update_State &update_state) {
+  if (!update_state.world_save.enabled) {
+    return;
+  }
 
-  LOG_WARN("Failed to get entity id. Pool full.");
-  return Result::ENTITY_POOL_FULL;
+  World_Save &save = update_state.world_save;
+  update_state.save_thread_pool->enqueue([&save]() {
+    Result flush_res = flush_world_save(save);
+    if (flush_res != Result::SUCCESS) {
+      LOG_WARN("World save flush failed: {}", (u16)flush_res);
+    }
+  });
 }
 
-Cell create_cell(Cell_Type type) {
-  const Cell_Type_Info &CELL_INFO = cell_type_infos[static_cast<u16>(type)];
+void spawn_saved_entities(Update_State &update_state, DimensionIndex dimid,
+                          const std::vector<Saved_Entity> &entities) {
+  std::vector<Entity_Spawn> spawns;
+  spawns.reserve(entities.size());
+  for (const Saved_Entity &saved : entities) {
+    spawns.push_back({saved.type, saved.coord, saved.texture});
+  }
 
-  // Ensure there are color configurations available
-  if (CELL_INFO.num_colors == 0) {
-    return {type, &CELL_INFO, 0xff, 0, 0xff, 255};  // Default to magenta
+  std::vector<Entity_ID> ids;
+  Result spawn_res = spawn_entities(update_state, dimid, spawns, &ids);
+  if (spawn_res != Result::SUCCESS) {
+    LOG_WARN("Failed to spawn saved entities: {}", (u16)spawn_res);
+  }
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    Entity_Ref e = update_state.entities[ids[i]];
+    e.texture = entities[i].texture;
+    e.flipped = entities[i].flipped;
+    e.health = entities[i].health;
+  }
+}
+
+u64 get_resident_chunk_bytes(const Dimension &dim) {
+  u64 bytes = 0;
+  for (const auto &[coord, chunk] : dim.chunks) {
+    bytes += get_chunk_bytes(chunk);
+  }
+  return bytes;
+}
+
+void evict_chunks(Update_State &update_state, DimensionIndex dimid, f64 x,
+                  f64 y, u8 radius) {
+  Dimension &dim = update_state.dimensions[dimid];
+
+  u64 resident_bytes = get_resident_chunk_bytes(dim);
+  if (resident_bytes <= update_state.chunk_memory_budget) {
+    return;
   }
 
-  const Cell_Color *selected_color = nullptr;
+  Chunk_Coord origin = get_chunk_coord(x, y);
 
-  // Iterate through each color and select based on probability
-  for (u8 i = 0; i < CELL_INFO.num_colors; ++i) {
-    const Cell_Color &color = CELL_INFO.colors[i];
-    int random_value =
-        std::rand() % 100 + 1;  // Generate a number from 1 to 100
-    if (random_value <= color.probability) {
-      selected_color = &color;
+  // Everything outside the load radius is a candidate. Oldest first.
+  std::vector<std::pair<u64, Chunk_Coord>> candidates;
+  for (const auto &[coord, chunk] : dim.chunks) {
+    if (coord.x >= origin.x - radius && coord.x < origin.x + radius &&
+        coord.y >= origin.y - radius && coord.y < origin.y + radius) {
+      continue;
+    }
+    candidates.emplace_back(chunk.last_needed, coord);
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  std::vector<Chunk_Coord> evicted;
+  for (const auto &[last_needed, coord] : candidates) {
+    if (resident_bytes <= update_state.chunk_memory_budget) {
       break;
     }
+
+    evicted.push_back(coord);
+    resident_bytes -= get_chunk_bytes(dim.chunks[coord]);
+  }
+
+  if (evicted.empty()) {
+    return;
+  }
+
+  // Entities in the evicted chunks are saved with them and come back when
+  // the chunk is loaded again. Chunks that haven't changed since they were
+  // loaded are already on disk.
+  std::vector<Chunk_Coord> unsaved;
+  for (const Chunk_Coord &coord : evicted) {
+    if (dim.chunks[coord].unsaved) {
+      unsaved.push_back(coord);
+    }
+  }
+  snapshot_chunks(update_state, dimid, unsaved);
+  request_save_flush(update_state);
+
+  // Now drop the entities standing in the evicted chunks. Ones that only
+  // wandered off into chunks that were never loaded stay.
+  std::vector<Entity_ID> dropped_entities;
+  for (const Chunk_Coord &coord : evicted) {
+    dim.chunks.erase(coord);
+    dim.e_grid.for_each(coord, coord, [&](Entity_ID id) {
+      if (id != update_state.active_player &&
+          !(update_state.entities[id].status &
+            (u16)Entity_Status::DEATHLESS)) {
+        dropped_entities.push_back(id);
+      }
+    });
+  }
+
+  for (Entity_ID id : dropped_entities) {
+    delete_entity(update_state, dim, id);
+  }
+
+  LOG_DEBUG("Evicted {} chunks and {} entities. {} chunks resident",
+            evicted.size(), dropped_entities.size(), dim.chunks.size());
+}
+
+void mark_chunk_unsaved(Dimension &dim, const Chunk_Coord &coord) {
+  auto chunk_iter = dim.chunks.find(coord);
+  if (chunk_iter != dim.chunks.end()) {
+    chunk_iter->second.unsaved = true;
+  }
+}
+
+void mark_entity_chunk_change(Dimension &dim, Entity_ID id,
+                              const Chunk_Coord &last_cc,
+                              const Entity_Coord &coord) {
+  Chunk_Coord cc = get_chunk_coord(coord.x, coord.y);
+  if (!(cc == last_cc)) {
+    mark_chunk_unsaved(dim, last_cc);
+    dim.e_grid.move(id, cc);
+  }
+  mark_chunk_unsaved(dim, cc);
+}
+
+void find_entities_in_box(Update_State &us, const Dimension &dim,
+                          const Entity_Coord &min, const Entity_Coord &max,
+                          std::vector<Entity_ID> &found) {
+  dim.e_grid.for_each(
+      get_chunk_coord(min.x, min.y), get_chunk_coord(max.x, max.y),
+      [&](Entity_ID id) {
+        const Entity_Coord &coord =
+            us.entities.get_page(id).coord[get_entity_page_slot(id)];
+        if (coord.x >= min.x && coord.x <= max.x && coord.y >= min.y &&
+            coord.y <= max.y) {
+          found.push_back(id);
+        }
+      });
+}
+
+void find_entities_in_radius(Update_State &us, const Dimension &dim,
+                             const Entity_Coord &center, f64 radius,
+                             std::vector<Entity_ID> &found) {
+  dim.e_grid.for_each(
+      get_chunk_coord(center.x - radius, center.y - radius),
+      get_chunk_coord(center.x + radius, center.y + radius),
+      [&](Entity_ID id) {
+        const Entity_Coord &coord =
+            us.entities.get_page(id).coord[get_entity_page_slot(id)];
+        f64 dx = coord.x - center.x;
+        f64 dy = coord.y - center.y;
+        if (dx * dx + dy * dy <= radius * radius) {
+          found.push_back(id);
+        }
+      });
+}
+
+void update_autosave(Update_State &update_state) {
+  if (!update_state.world_save.enabled ||
+      update_state.autosave_interval.count() == 0) {
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (now < update_state.next_autosave) {
+    return;
+  }
+  update_state.next_autosave = now + update_state.autosave_interval;
+
+  // Every unsaved chunk is copied in the same update, so the save is the
+  // world as it was at one frame and an entity can't end up in two chunks or
+  // neither. The copies share cells with the live chunks until they're next
+  // written, so this is cheap.
+  Dimension &dim = *get_active_dimension(update_state);
+  std::vector<Chunk_Coord> unsaved;
+  for (const auto &[coord, chunk] : dim.chunks) {
+    if (chunk.unsaved) {
+      unsaved.push_back(coord);
+    }
+  }
+  if (unsaved.empty()) {
+    return;
+  }
+
+  snapshot_chunks(update_state, update_state.active_dimension, unsaved);
+  request_save_flush(update_state);
+}
+
+void bake_cell_palette(Cell_Type_Info &cell_info, u32 seed) {
+  // Ensure there are color configurations available
+  if (cell_info.num_colors == 0) {
+    for (Cell_Palette_Color &pcolor : cell_info.palette) {
+      pcolor = {0xff, 0, 0xff, 255};  // Default to magenta
+    }
+    cell_info.average_color = cell_info.palette[0];
+    return;
+  }
+
+  // Same rolls create_cell used to do per cell, just done ahead of time with
+  // a fixed seed so a cell type always bakes to the same palette.
+  u32 state = seed * 2654435761u + 1;
+  auto roll = [&state]() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  };
+
+  for (Cell_Palette_Color &pcolor : cell_info.palette) {
+    const Cell_Color *selected_color = nullptr;
+
+    // Iterate through each color and select based on probability
+    for (u8 i = 0; i < cell_info.num_colors; ++i) {
+      const Cell_Color &color = cell_info.colors[i];
+      u32 random_value = roll() % 100 + 1;  // Generate a number from 1 to 100
+      if (random_value <= color.probability) {
+        selected_color = &color;
+        break;
+      }
+    }
+
+    // If no color was selected by probability, default to the last color
+    if (!selected_color) {
+      selected_color = &cell_info.colors[cell_info.num_colors - 1];
+    }
+
+    // Compute color components with variation
+    pcolor.r =
+        selected_color->r_variety == 0
+            ? selected_color->r_base
+            : selected_color->r_base + roll() % selected_color->r_variety;
+    pcolor.g =
+        selected_color->g_variety == 0
+            ? selected_color->g_base
+            : selected_color->g_base + roll() % selected_color->g_variety;
+    pcolor.b =
+        selected_color->b_variety == 0
+            ? selected_color->b_base
+            : selected_color->b_base + roll() % selected_color->b_variety;
+    pcolor.a =
+        selected_color->a_variety == 0
+            ? selected_color->a_base
+            : selected_color->a_base + roll() % selected_color->a_variety;
+  }
+
+  u32 r = 0, g = 0, b = 0, a = 0;
+  for (const Cell_Palette_Color &pcolor : cell_info.palette) {
+    r += pcolor.r;
+    g += pcolor.g;
+    b += pcolor.b;
+    a += pcolor.a;
+  }
+  cell_info.average_color = {
+      static_cast<u8>(r / CELL_PALETTE_SIZE),
+      static_cast<u8>(g / CELL_PALETTE_SIZE),
+      static_cast<u8>(b / CELL_PALETTE_SIZE),
+      static_cast<u8>(a / CELL_PALETTE_SIZE)};
+}
+
+Cell create_cell(Cell_Type type) { return {type}; }
+
+void fill_cells(Chunk &chunk, u32 first_cell, u32 count, Cell_Type type) {
+  for (u32 cell = first_cell; cell < first_cell + count; cell++) {
+    chunk.cell_counts[(u16)chunk.cells[cell].type]--;
+    set_cell_classes(chunk, cell, type);
   }
+  std::fill_n(&chunk.cells[first_cell], count, create_cell(type));
+  chunk.cell_counts[(u16)type] += count;
+  chunk.all_cell = chunk.cell_counts[(u16)type] == CHUNK_CELLS
+                       ? type
+                       : Cell_Type::NONE;
+}
 
-  // If no color was selected by probability, default to the last color
-  if (!selected_color) {
-    selected_color = &CELL_INFO.colors[CELL_INFO.num_colors - 1];
+void set_chunk_uniform(Chunk &chunk, Cell_Type type) {
+  const std::shared_ptr<Cell[]> &uniform = uniform_cells[(u16)type];
+  if (uniform == nullptr) {
+    // Not a type from the cell factory. Nothing to share.
+    alloc_chunk_cells(chunk);
+    fill_cells(chunk, 0, CHUNK_CELLS, type);
+  } else {
+    chunk.cells = uniform;
+    std::fill(std::begin(chunk.cell_counts), std::end(chunk.cell_counts), 0);
+    chunk.cell_counts[(u16)type] = CHUNK_CELLS;
+    for (u8 cell_class = 0; cell_class < CELL_CLASS_COUNT; cell_class++) {
+      bool in_class = CELL_CLASS_TYPES[cell_class] & cell_type_bit(type);
+      std::fill(std::begin(chunk.classes.rows[cell_class]),
+                std::end(chunk.classes.rows[cell_class]),
+                in_class ? ~static_cast<u64>(0) : 0);
+    }
+    chunk.all_cell = type;
   }
+}
+
+void alloc_chunk_cells(Chunk &chunk) {
+  chunk.cells.reset(new Cell[CHUNK_CELLS]);
+  std::fill_n(chunk.cells.get(), CHUNK_CELLS, create_cell(Cell_Type::AIR));
+  std::fill(std::begin(chunk.cell_counts), std::end(chunk.cell_counts), 0);
+  chunk.cell_counts[(u16)Cell_Type::AIR] = CHUNK_CELLS;
+  chunk.classes = {};  // Air isn't in any
+  chunk.all_cell = Cell_Type::AIR;
+}
 
-  // Compute color components with variation
-  u8 r =
-      selected_color->r_variety == 0
-          ? selected_color->r_base
-          : selected_color->r_base + std::rand() % (selected_color->r_variety);
-  u8 g =
-      selected_color->g_variety == 0
-          ? selected_color->g_base
-          : selected_color->g_base + std::rand() % (selected_color->g_variety);
-  u8 b =
-      selected_color->b_variety == 0
-          ? selected_color->b_base
-          : selected_color->b_base + std::rand() % (selected_color->b_variety);
-  u8 a =
-      selected_color->a_variety == 0
-          ? selected_color->a_base
-          : selected_color->a_base + std::rand() % (selected_color->a_variety);
+void make_chunk_writable(Chunk &chunk) {
+  if (chunk.cells.use_count() <= 1) {
+    return;
+  }
 
-  // Create and return the cell
-  Cell ret_cell = {type, &CELL_INFO, r, g, b, a};
+  // Same cells, so the counts and classes stay
+  std::shared_ptr<Cell[]> shared = std::move(chunk.cells);
+  chunk.cells.reset(new Cell[CHUNK_CELLS]);
+  std::copy(shared.get(), shared.get() + CHUNK_CELLS, chunk.cells.get());
+}
 
-  return ret_cell;
+u64 get_chunk_bytes(const Chunk &chunk) {
+  u64 bytes = sizeof(Chunk);
+  if (chunk.cells != nullptr &&
+      chunk.cells != uniform_cells[(u16)chunk.all_cell]) {
+    bytes += CHUNK_CELLS * sizeof(Cell);
+  }
+  return bytes;
 }
 
 Result create_entity(Update_State &us, DimensionIndex dim,
                      Entity_Factory_Type type, Entity_ID &id) {
-  Result id_res = get_entity_id(us.entity_id_pool, id);
+  Result id_res = us.entity_id_pool.take(id);
   if (id_res != Result::SUCCESS) {
     id = 0;
     return id_res;
   }
 
-  us.entities[id] = default_entity();
+  us.entities.add(id);
 
   Entity_Factory &factory = us.entity_factories[type];
-  us.entities[id] = factory.e;
+  us.entities.store(id, factory.e);
+  us.entities[id].factory_type = type;
 
   auto dimension_iter = us.dimensions.find(dim);
   if (dimension_iter != us.dimensions.end()) {
     dimension_iter->second.entity_indicies.insert(id);
+    Entity_Ref e = us.entities[id];
+    dimension_iter->second.e_grid.insert(id,
+                                         get_chunk_coord(e.coord.x, e.coord.y));
 
     if (factory.register_kinetic) {
       dimension_iter->second.e_kinetic.insert(id);
@@ -1761,7 +2817,7 @@ Result create_entity(Update_State &us, DimensionIndex dim,
       dimension_iter->second.e_health.insert(id);
     }
     if (factory.register_render) {
-      dimension_iter->second.e_render.emplace(us.entities[id].zdepth, id);
+      dimension_iter->second.e_render.insert(id, e.zdepth);
     }
     if (factory.register_ai) {
       dimension_iter->second.e_ai.insert(id);
@@ -1776,25 +2832,106 @@ Result create_entity(Update_State &us, DimensionIndex dim,
   return Result::SUCCESS;
 }
 
-void delete_entity(Update_State &us, Dimension &dim, Entity_ID id) {
-  auto kin_iter = dim.e_kinetic.find(id);
-  if (kin_iter != dim.e_kinetic.end()) {
-    dim.e_kinetic.erase(id);
+Result spawn_entities(Update_State &us, DimensionIndex dim,
+                      const std::vector<Entity_Spawn> &spawns,
+                      std::vector<Entity_ID> *ids) {
+  if (spawns.empty()) {
+    return Result::SUCCESS;
+  }
+
+  auto dimension_iter = us.dimensions.find(dim);
+  if (dimension_iter == us.dimensions.end()) {
+    LOG_WARN(
+        "Failed to spawn entities. Couldn't find dimension specified: {}",
+        (u8)dim);
+    return Result::VALUE_ERROR;
   }
-  auto health_iter = dim.e_kinetic.find(id);
-  if (health_iter != dim.e_health.end()) {
-    dim.e_health.erase(id);
+  Dimension &dimension = dimension_iter->second;
+
+  // Spawners tend to make runs of the same thing, so the factories are only
+  // looked up when the type changes. They're all found before any ids are
+  // taken so a bad type doesn't leave half a batch behind.
+  std::vector<const Entity_Factory *> factories(spawns.size());
+  for (size_t i = 0; i < spawns.size(); i++) {
+    if (i > 0 && spawns[i].type == spawns[i - 1].type) {
+      factories[i] = factories[i - 1];
+      continue;
+    }
+
+    auto factory_iter = us.entity_factories.find(spawns[i].type);
+    if (factory_iter == us.entity_factories.end()) {
+      LOG_WARN("Failed to spawn entities. No factory for type {}",
+               (u16)spawns[i].type);
+      return Result::VALUE_ERROR;
+    }
+    factories[i] = &factory_iter->second;
+  }
+
+  std::vector<Entity_ID> new_ids;
+  Result ids_res = us.entity_id_pool.take(spawns.size(), new_ids);
+
+  for (size_t i = 0; i < new_ids.size(); i++) {
+    const Entity_Spawn &spawn = spawns[i];
+    const Entity_Factory *factory = factories[i];
+    Entity_ID id = new_ids[i];
+
+    us.entities.add(id);
+    us.entities.store(id, factory->e);
+    Entity_Ref e = us.entities[id];
+    e.factory_type = spawn.type;
+    e.coord = spawn.coord;
+    if (spawn.texture != Texture_Id::NONE) {
+      e.texture = spawn.texture;
+    }
+
+    dimension.entity_indicies.insert(id);
+    dimension.e_grid.insert(id, get_chunk_coord(e.coord.x, e.coord.y));
+    if (factory->register_kinetic) {
+      dimension.e_kinetic.insert(id);
+    }
+    if (factory->register_health) {
+      dimension.e_health.insert(id);
+    }
+    if (factory->register_render) {
+      dimension.e_render.insert(id, e.zdepth);
+    }
+    if (factory->register_ai) {
+      dimension.e_ai.insert(id);
+    }
   }
-  auto range = dim.e_render.equal_range(id);
-  // Erase all elements within this range
-  if (range.first != range.second) {
-    dim.e_render.erase(range.first, range.second);
+
+  if (ids != nullptr) {
+    ids->insert(ids->end(), new_ids.begin(), new_ids.end());
   }
 
-  auto entity_iter = us.entity_id_pool.find(id);
-  if (entity_iter != us.entity_id_pool.end()) {
-    us.entity_id_pool.erase(id);
+  return ids_res;
+}
+
+void delete_entity(Update_State &us, Dimension &dim, Entity_ID id) {
+  if (!us.entity_id_pool.in_use(id)) {
+    return;  // Already deleted, and its page might be gone
   }
+
+  Entity_Ref e = us.entities[id];
+  mark_chunk_unsaved(dim, get_chunk_coord(e.coord.x, e.coord.y));
+
+  dim.entity_indicies.erase(id);
+  dim.e_kinetic.erase(id);
+  dim.e_health.erase(id);
+  dim.e_ai.erase(id);
+  dim.e_render.erase(id);
+  dim.e_grid.erase(id);
+
+  // Its id can be handed out again before the contacts are used
+  dim.contacts.erase(
+      std::remove_if(dim.contacts.begin(), dim.contacts.end(),
+                     [id](const Entity_Contact &contact) {
+                       return contact.a == id || contact.b == id;
+                     }),
+      dim.contacts.end());
+
+  us.entities.remove(id);
+  us.entity_id_pool.release(id);
 }
 
 }  // namespace VV
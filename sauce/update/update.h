@@ -1,12 +1,16 @@
 #pragma once
 
+#include <chrono>
 #include <optional>
 #include <set>
-#include <unordered_set>
 
 #include "SDL_events.h"
 #include "core.h"
 #include "update/entity.h"
+#include "update/minimap.h"
+#include "update/raycast.h"
+#include "update/region.h"
+#include "update/structure.h"
 #include "update/world.h"
 #include "utils/config.h"
 #include "utils/threadpool.h"
@@ -19,15 +23,17 @@ enum Update_Event : u8 {
 
 struct Update_State {
   ThreadPool *thread_pool;
+  ThreadPool *save_thread_pool;  // One thread for flushing the world save
 
   std::vector<SDL_Event> pending_events;
 
   std::map<DimensionIndex, Dimension> dimensions;
 
   std::map<Entity_Factory_Type, Entity_Factory> entity_factories;
+  std::vector<Structure_Prefab> structures;  // See init_structures
 
-  std::unordered_set<Entity_ID> entity_id_pool;
-  Entity entities[MAX_TOTAL_ENTITIES];
+  Entity_ID_Pool entity_id_pool;
+  Entity_Storage entities;
 
   DimensionIndex active_dimension;  // Key of active dimension
   Entity_ID active_player;          // Index into entities
@@ -36,6 +42,15 @@ struct Update_State {
 
   u32 world_seed;
 
+  u64 frame;                // Incremented every update
+  u64 chunk_memory_budget;  // From Config. See evict_chunks
+
+  World_Save world_save;
+
+  // See update_autosave
+  std::chrono::seconds autosave_interval;  // From Config
+  std::chrono::steady_clock::time_point next_autosave;
+
   // Render. These are duplicates so that we can do update things based on
   // render without including render headers here
   u16 screen_cell_size;
@@ -61,32 +76,154 @@ Result update_keypresses(Update_State &us);
 constexpr f32 KINETIC_FRICTION = 0.8f;
 constexpr f32 KINETIC_GRAVITY = 0.43f;
 constexpr f32 KINETIC_TERMINAL_VELOCITY = -300.0f;
+// Moves the kinetic entities and resolves their collisions, with the cells on
+// the thread pool when there are enough of them
 void update_kinetic(Update_State &update_state);
+// Pushes moving entities whose body boxes overlap apart and records the
+// contacts in dim.contacts. Entities without a body box don't collide. It's a
+// single sweep, so a push that moves a box past one it wasn't compared with
+// leaves that pair for the next update.
+void collide_entities(Update_State &us, Dimension &dim);
+// Updates an entity can't take contact damage again for after it's been hurt
+// by touching something
+constexpr u64 CONTACT_DAMAGE_COOLDOWN = 30;
 void update_health(Update_State &us);
 
 constexpr u8 CHUNK_CELL_SIM_RADIUS = (8 / 2) + 2;
 
-void update_cells_chunk(Dimension &dim, Chunk &chunk);
+// A cell that changed type in a chunk whose counts and classes haven't caught
+// up yet
+struct Cell_Count_Change {
+  Chunk *chunk;
+  u32 cell_index;
+  Cell_Type removed, added;
+};
+
+// Returns true if any cells moved. The chunk and its neighbors have to be
+// writable. Count changes for the neighbors are added to deferred instead of
+// being made, since other workers can be moving cells into them too.
+bool update_cells_chunk(Dimension &dim, Chunk &chunk,
+                        std::vector<Cell_Count_Change> &deferred);
 void update_cells(Update_State &update_state);
 
+// AI only runs for entities this close to the player. That includes
+// FOLLOW_PLAYER_SLOW followers with some other ai_target: one that's further
+// than this from the player stands still until the player comes back, even if
+// its target is right next to it. Nothing hands out other targets yet, and
+// finding those followers would mean going through every AI entity again.
 constexpr u8 AI_CHUNK_RADIUS = 20;
 constexpr u32 AI_CELL_RADIUS = AI_CHUNK_RADIUS * CHUNK_CELL_WIDTH;
 void update_ai(Update_State &us);
 
-void gen_overworld_chunk(Update_State &update_state, DimensionIndex dim,
-                         Chunk &chunk, const Chunk_Coord &chunk_coord);
+/// Generation ///
+// Generation is a pure function of the world seed, dim and chunk_coord. It
+// runs in the stages in Gen_Stage.
 
-Result gen_chunk(Update_State &update_state, Chunk &chunk,
+// HEIGHTS
+void gen_columns(u32 world_seed, DimensionIndex dimid, s32 chunk_x,
+                 Gen_Columns &columns);
+// SETTLED. Where a biome leaves a fluid standing higher than the ground next
+// to it, it would all pour out at once when the sim got to it. Settling lowers
+// each fluid column so it's no more than GEN_SETTLE_SLOPE cells above any
+// surface within a chunk width for every column away that surface is. Only
+// the raw bands either side are read, so the order columns are settled in
+// doesn't matter.
+void settle_columns(const Gen_Columns &left, Gen_Columns &columns,
+                    const Gen_Columns &right);
+// Works out the columns up to stage, along with whatever neighbors that needs.
+// They're kept in the dimension's gen_columns.
+const Gen_Columns &get_gen_columns(Update_State &update_state,
+                                   DimensionIndex dimid, s32 chunk_x,
+                                   Gen_Stage stage);
+// The structure in the slot chunk_x is part of, if it has one. It only takes
+// the slot's hash and the heights at the structure's edges, so it's cheap
+// enough to look up again for every chunk in the slot.
+bool find_structure_placement(Update_State &update_state, DimensionIndex dimid,
+                              s32 chunk_x, Structure_Placement &placement);
+// TERRAIN. The chunk's coord has to be set and the columns SETTLED.
+void fill_chunk_terrain(Chunk &chunk, const Gen_Columns &columns);
+// Runs the stages after TERRAIN up to target. These make entities, so they
+// only run on the update thread. Structures are stamped into the chunk when
+// it's DECORATED and their entities are spawned with the chunk their bottom
+// left corner is in when that's POPULATED.
+void advance_chunk_gen(Update_State &update_state, DimensionIndex dimid,
+                       Chunk &chunk, Gen_Stage target);
+// Every stage, start to finish
+Result gen_chunk(Update_State &update_state, DimensionIndex dim, Chunk &chunk,
                  const Chunk_Coord &chunk_coord);
+
+// Loads a chunk from the save or generates it completely
 Result load_chunk(Update_State &update_state, DimensionIndex dimid,
                   const Chunk_Coord &coord);
+// Loads every chunk in the square. The ones that aren't saved are generated up
+// to TERRAIN on the thread pool.
 Result load_chunks_square(Update_State &update_state, DimensionIndex dimid,
                           f64 x, f64 y, u8 radius);
+// Finishes generating the loaded chunks in the square
+constexpr u8 CHUNK_POPULATE_RADIUS = CHUNK_CELL_SIM_RADIUS + 2;
+void populate_chunks_square(Update_State &update_state, DimensionIndex dimid,
+                            f64 x, f64 y, u8 radius);
+
+// Where the world for a seed is saved
+std::filesystem::path get_world_save_dir(const Config &config, u32 world_seed);
+// Snapshots the chunks and the entities standing in them into the world save's
+// queue and marks the chunks saved. The cells aren't copied until the chunk is
+// next written. Nothing is written to disk until a flush.
+void snapshot_chunks(Update_State &update_state, DimensionIndex dimid,
+                     const std::vector<Chunk_Coord> &coords);
+// Flushes the world save on save_thread_pool
+void request_save_flush(Update_State &update_state);
+void spawn_saved_entities(Update_State &update_state, DimensionIndex dimid,
+                          const std::vector<Saved_Entity> &entities);
 
-// This can fail! Check the result.
-Result get_entity_id(Entity_ID &id);
+constexpr u8 CHUNK_LOAD_RADIUS = 8 + 5;
+u64 get_resident_chunk_bytes(const Dimension &dim);
+// Once the dimension is over update_state.chunk_memory_budget, saves and
+// removes the least recently needed chunks outside of radius along with the
+// entities that were in them.
+void evict_chunks(Update_State &update_state, DimensionIndex dimid, f64 x,
+                  f64 y, u8 radius);
+
+// Every autosave_interval the unsaved chunks of the active dimension are all
+// snapshotted at once and the save is flushed in the background
+void update_autosave(Update_State &update_state);
+// Flags a chunk as changed since it was saved. Does nothing if it isn't loaded
+void mark_chunk_unsaved(Dimension &dim, const Chunk_Coord &coord);
+// Entities are saved with the chunk they're in, so the chunk changes when one
+// moves in it, and both change when one crosses a chunk border. It also moves
+// the entity's grid bucket, so call this whenever an entity's coord changes.
+void mark_entity_chunk_change(Dimension &dim, Entity_ID id,
+                              const Chunk_Coord &last_cc,
+                              const Entity_Coord &coord);
+
+// Appends the entities whose coord is inside the box, from min up to and
+// including max. Only the grid buckets the box covers are looked at.
+void find_entities_in_box(Update_State &us, const Dimension &dim,
+                          const Entity_Coord &min, const Entity_Coord &max,
+                          std::vector<Entity_ID> &found);
+// Appends the entities whose coord is within radius of center
+void find_entities_in_radius(Update_State &us, const Dimension &dim,
+                             const Entity_Coord &center, f64 radius,
+                             std::vector<Entity_ID> &found);
 
 Cell create_cell(Cell_Type type);
+// Writes a run of cells of the same type into a chunk, keeping the counts
+// right. It has to own its cells.
+void fill_cells(Chunk &chunk, u32 first_cell, u32 count, Cell_Type type);
+
+// Most of the world is chunks of nothing but air, water, sand or dirt, so
+// instead of 8 KiB each those point at one shared block of cells per type.
+// init_cell_factory builds the blocks.
+void set_chunk_uniform(Chunk &chunk, Cell_Type type);
+// Gives the chunk its own cells, all air
+void alloc_chunk_cells(Chunk &chunk);
+// Copies the chunk's cells if anything else is looking at them, including a
+// shared uniform block or a save snapshot. Call before writing cells.
+void make_chunk_writable(Chunk &chunk);
+// What the chunk costs in memory, counting cells only if it owns them
+u64 get_chunk_bytes(const Chunk &chunk);
+// Rolls the palette for a cell type from its factory colors
+void bake_cell_palette(Cell_Type_Info &cell_info, u32 seed);
 
 // Factory functions. These should be used over default_entity.
 Result create_entity(Update_State &us, DimensionIndex dim,
@@ -94,6 +231,17 @@ Result create_entity(Update_State &us, DimensionIndex dim,
                      Entity_ID &id);  // Creates default entity and returns
                                       // index in update_state.entities
 
+// Creates a batch of entities. The ids are taken from the pool in one pass,
+// each factory is only looked up once, and the ids are appended to the
+// registries in the order they're taken, which is much cheaper than calling
+// create_entity for each of the dozens a chunk can spawn. If ids is given it
+// gets the new ids in the same order as spawns. Nothing is made if any spawn
+// has an unknown type (Result::VALUE_ERROR) or the pool can't fit the whole
+// batch (Result::ENTITY_POOL_FULL).
+Result spawn_entities(Update_State &us, DimensionIndex dim,
+                      const std::vector<Entity_Spawn> &spawns,
+                      std::vector<Entity_ID> *ids = nullptr);
+
 // There's currently no need to call this for existing entities when
 // the program closes since the memory is freed with Update_State
 void delete_entity(Update_State &us, Dimension &dim, Entity_ID id);
@@ -110,7 +258,16 @@ inline Dimension *get_active_dimension(Update_State &update_state) {
 #endif
 }
 
-inline Entity *get_active_player(Update_State &update_state) {
-  return &update_state.entities[update_state.active_player];
+inline Entity_Ref get_active_player(Update_State &update_state) {
+  return update_state.entities[update_state.active_player];
+}
+
+// Empty if the entity's been deleted since the handle was made
+inline std::optional<Entity_Ref> get_entity(Update_State &update_state,
+                                            const Entity_Handle &handle) {
+  if (!update_state.entity_id_pool.is_live(handle)) {
+    return std::nullopt;
+  }
+  return update_state.entities[handle.id];
 }
 }  // namespace VV
@@ -1,5 +1,8 @@
 #include "update/world.h"
 
+#include <algorithm>
+#include <tuple>
+
 namespace VV {
 bool Chunk_Coord::operator<(const Chunk_Coord &other) const {
   return x < other.x || (x == other.x && y < other.y);
@@ -12,6 +15,18 @@ bool Chunk_Coord::operator==(const Chunk_Coord &b) const {
 // sublimation_points of -1.0f mean it cannot sublimate.
 Cell_Type_Info CELL_TYPE_INFOS[MAX_CELL_TYPES];
 
+Biome get_overworld_biome(s64 x) {
+  if (x < NICARAGUA_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH) {
+    return Biome::NICARAGUA;
+  } else if (x < FOREST_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH) {
+    return Biome::FOREST;
+  } else if (x < ALASKA_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH) {
+    return Biome::ALASKA;
+  } else {
+    return Biome::OCEAN;
+  }
+}
+
 u16 surface_det_rand(u64 seed) {
   seed = (~seed) + (seed << 21);  // input = (input << 21) - input - 1;
   seed = seed ^ (seed >> 24);
@@ -40,20 +55,22 @@ u16 interpolate_and_nudge(u16 y1, u16 y2, f64 fraction, u64 seed,
   return std::min(cell_range, height);
 }
 
+constexpr size_t SURFACE_MIDPOINT_CACHE_SIZE = 1 << 16;
+
 u16 surface_height(s64 x, u16 max_depth, u32 world_seed, u64 randomness_range,
                    u16 cell_range) {
-  static std::map<s64, u16> heights;
-
-  auto height_iter = heights.find(x);
-  if (height_iter != heights.end()) {
-    return height_iter->second;
-  }
+  // The surface is a midpoint displacement between random heights every
+  // randomness_range cells. Each midpoint is nudged with a seed from its own x,
+  // so it only depends on where it is and never on which x asked for it first.
+  // That keeps heights a pure function of the arguments. The midpoints are
+  // cached per thread since every column walks the same ones, and the cache is
+  // just thrown away when it gets big since any midpoint can be worked out
+  // again.
+  using Midpoint_Key = std::tuple<s64, u32, u64, u16>;
+  static thread_local std::map<Midpoint_Key, u16> midpoints;
 
   if (x % randomness_range == 0) {
-    u16 height =
-        surface_det_rand(static_cast<u64>(x ^ world_seed)) % cell_range;
-    heights[x] = height;
-    return height;
+    return surface_det_rand(static_cast<u64>(x ^ world_seed)) % cell_range;
   }
 
   s64 lower_x = static_cast<s64>(x / randomness_range) * randomness_range;
@@ -66,14 +83,18 @@ u16 surface_height(s64 x, u16 max_depth, u32 world_seed, u64 randomness_range,
     s64 x_mid = static_cast<s64>(lower_x + upper_x) / 2;
 
     u16 y_mid;
-    auto height_iter = heights.find(x_mid);
-    if (height_iter != heights.end()) {
-      y_mid = height_iter->second;
+    Midpoint_Key key = {x_mid, world_seed, randomness_range, cell_range};
+    auto midpoint_iter = midpoints.find(key);
+    if (midpoint_iter != midpoints.end()) {
+      y_mid = midpoint_iter->second;
     } else {
       y_mid = interpolate_and_nudge(lower_height, upper_height, 0.5,
-                                    static_cast<u64>(x ^ world_seed),
+                                    static_cast<u64>(x_mid ^ world_seed),
                                     0.5 / std::pow(depth, 2.5), cell_range);
-      heights[x_mid] = y_mid;
+      if (midpoints.size() >= SURFACE_MIDPOINT_CACHE_SIZE) {
+        midpoints.clear();
+      }
+      midpoints.emplace(key, y_mid);
     }
 
     if (x == x_mid) {
@@ -88,11 +109,9 @@ u16 surface_height(s64 x, u16 max_depth, u32 world_seed, u64 randomness_range,
   }
 
   f64 fraction = static_cast<f64>(x - lower_x) / (upper_x - lower_x);
-  u16 height = interpolate_and_nudge(
-      lower_height, upper_height, fraction, static_cast<u64>(x ^ world_seed),
-      0.5 / std::pow(max_depth, 2.5), cell_range);
-  heights[x] = height;
-  return height;
+  return interpolate_and_nudge(lower_height, upper_height, fraction,
+                               static_cast<u64>(x ^ world_seed),
+                               0.5 / std::pow(max_depth, 2.5), cell_range);
 }
 
 Entity_Coord get_world_pos_from_chunk(Chunk_Coord coord) {
@@ -124,7 +143,60 @@ Chunk_Coord get_chunk_coord(f64 x, f64 y) {
   return return_chunk_coord;
 }
 
-Cell *get_cell_at_world_pos(Dimension &dim, s64 x, s64 y) {
+Cell_Type get_band_cell_type(const Gen_Column &column, s32 y) {
+  for (u8 band = 0; band < column.num_bands; band++) {
+    if (y < column.bands[band].top) {
+      return column.bands[band].type;
+    }
+  }
+  return Cell_Type::AIR;
+}
+
+bool Entity_Grid::insert(Entity_ID id, const Chunk_Coord &bucket) {
+  if (contains(id)) {
+    return false;
+  }
+
+  if (id >= slots.size()) {
+    slots.resize(id + 1, {{0, 0}, NOT_IN_GRID});
+  }
+  std::vector<Entity_ID> &ids = buckets[bucket];
+  slots[id] = {bucket, static_cast<u32>(ids.size())};
+  ids.push_back(id);
+  return true;
+}
+
+bool Entity_Grid::erase(Entity_ID id) {
+  if (!contains(id)) {
+    return false;
+  }
+
+  // Swap the last id in the bucket into the hole
+  Slot &slot = slots[id];
+  auto bucket_iter = buckets.find(slot.bucket);
+  std::vector<Entity_ID> &ids = bucket_iter->second;
+  Entity_ID moved = ids.back();
+  ids[slot.index] = moved;
+  slots[moved].index = slot.index;
+  ids.pop_back();
+  slot.index = NOT_IN_GRID;
+
+  if (ids.empty()) {
+    buckets.erase(bucket_iter);
+  }
+  return true;
+}
+
+void Entity_Grid::move(Entity_ID id, const Chunk_Coord &bucket) {
+  if (!contains(id) || slots[id].bucket == bucket) {
+    return;
+  }
+
+  erase(id);
+  insert(id, bucket);
+}
+
+Cell *get_cell_at_world_pos(Dimension &dim, s64 x, s64 y, Chunk **chunk) {
   Chunk_Coord cc = get_chunk_coord(x, y);
 
   u32 cell_x = ((x % CHUNK_CELL_WIDTH) + CHUNK_CELL_WIDTH) % CHUNK_CELL_WIDTH;
@@ -132,6 +204,69 @@ Cell *get_cell_at_world_pos(Dimension &dim, s64 x, s64 y) {
 
   u32 cell_index = cell_x + cell_y * CHUNK_CELL_WIDTH;
 
-  return &(dim.chunks[cc].cells[cell_index]);
+  auto chunk_iter = dim.chunks.find(cc);
+  if (chunk_iter == dim.chunks.end()) {
+    return nullptr;
+  }
+
+  if (chunk != nullptr) {
+    *chunk = &chunk_iter->second;
+  }
+  return &chunk_iter->second.cells[cell_index];
+}
+
+void count_region_cells(const Dimension &dim, const Chunk_Coord &min,
+                        const Chunk_Coord &max, Region_Cell_Counts &region) {
+  region = {};
+
+  // Chunks are ordered by x then y, so each column is one run of the map
+  for (s32 x = min.x; x < max.x; x++) {
+    for (auto chunk_iter = dim.chunks.lower_bound({x, min.y});
+         chunk_iter != dim.chunks.end() && chunk_iter->first.x == x &&
+         chunk_iter->first.y < max.y;
+         chunk_iter++) {
+      const Chunk &chunk = chunk_iter->second;
+      for (u16 type = 0; type < CELL_TYPE_COUNT; type++) {
+        region.counts[type] += chunk.cell_counts[type];
+      }
+      region.chunks++;
+    }
+  }
+}
+
+Biome get_ambient_biome(const Dimension &dim, s64 x, s64 y) {
+  Chunk_Coord center = get_chunk_coord(x, y);
+  Region_Cell_Counts region;
+  count_region_cells(dim,
+                     {center.x - AMBIENT_CHUNK_RADIUS,
+                      center.y - AMBIENT_CHUNK_RADIUS},
+                     {center.x + AMBIENT_CHUNK_RADIUS + 1,
+                      center.y + AMBIENT_CHUNK_RADIUS + 1},
+                     region);
+
+  const u64 *counts = region.counts;
+  u64 lava = counts[(u16)Cell_Type::LAVA] + counts[(u16)Cell_Type::NICARAGUA];
+  u64 snow = counts[(u16)Cell_Type::SNOW];
+  u64 water = counts[(u16)Cell_Type::WATER];
+  u64 grass = counts[(u16)Cell_Type::GRASS];
+
+  u64 most = std::max({lava, snow, water, grass});
+  Biome biome = get_overworld_biome(x);
+  if (most == 0) {
+    // Nothing to go on
+  } else if (most == lava) {
+    biome = Biome::NICARAGUA;
+  } else if (most == snow) {
+    biome = Biome::ALASKA;
+  } else if (most == water) {
+    biome = Biome::OCEAN;
+  } else {
+    biome = Biome::FOREST;
+  }
+
+  if (biome == Biome::OCEAN && y < DEEP_SEA_LEVEL_CELL) {
+    biome = Biome::DEEP_OCEAN;
+  }
+  return biome;
 }
 }  // namespace VV
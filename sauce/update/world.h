@@ -1,11 +1,17 @@
 #pragma once
 
 #include <map>
-#include <set>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "core.h"
 #include "update/entity.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace VV {
 /// Chunk_Coord ///
 struct Chunk_Coord {
@@ -15,6 +21,18 @@ struct Chunk_Coord {
   bool operator==(const Chunk_Coord &b) const;
 };
 
+struct Chunk_Coord_Hash {
+  size_t operator()(const Chunk_Coord &coord) const {
+    return std::hash<u64>()(static_cast<u64>(static_cast<u32>(coord.x)) << 32 |
+                            static_cast<u32>(coord.y));
+  }
+};
+
+// Division that rounds towards negative infinity so chunk -1 is in region -1
+inline s32 floor_div(s32 a, s32 b) {
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
 /// Cell ///
 
 // You can increase this as you please as long as it is under 2^16
@@ -30,8 +48,9 @@ enum class Cell_Type : u16 {
   NICARAGUA,
   LAVA,
   SAND,
-  GRASS
+  GRASS  // Update CELL_TYPE_COUNT if adding after this
 };
+constexpr u16 CELL_TYPE_COUNT = static_cast<u16>(Cell_Type::GRASS) + 1;
 
 inline Cell_Type string_to_cell_type(const char *str) {
   if (strcmp(str, "DIRT") == 0) {
@@ -91,6 +110,14 @@ struct Cell_Color {
   u8 probability;
 };
 
+// Pre-rolled colors for a cell type. Rolling colors per cell was a good chunk
+// of chunk generation, so the probability and variety rolls from the factory
+// colors are all done up front and cells just pick one of these.
+constexpr u16 CELL_PALETTE_SIZE = 256;
+struct Cell_Palette_Color {
+  u8 r, g, b, a;
+};
+
 #define MAX_CELL_TYPE_COLORS 8
 struct Cell_Type_Info {
   Cell_State state;
@@ -104,6 +131,9 @@ struct Cell_Type_Info {
 
   Cell_Color colors[MAX_CELL_TYPE_COLORS];
   u8 num_colors;
+
+  Cell_Palette_Color palette[CELL_PALETTE_SIZE];  // Filled by init_cell_factory
+  Cell_Palette_Color average_color;               // Of the palette
 };
 
 extern Cell_Type_Info cell_type_infos[MAX_CELL_TYPES];
@@ -112,24 +142,174 @@ extern Cell_Type_Info cell_type_infos[MAX_CELL_TYPES];
 // There should be support for millions of cells, so avoid putting too much here
 // If it isn't something that every cell needs, it should be in the cell's type
 // info or static.
+//
+// Cells don't store a color. See get_cell_color.
 struct Cell {
   Cell_Type type;
-  const Cell_Type_Info *cell_info;
-  u8 cr, cg, cb, ca;  // Color rgba8
 };
 
+// Mixes a cell type and world cell position into a palette pick
+inline u32 cell_position_hash(Cell_Type type, s64 x, s64 y) {
+  u64 hash = static_cast<u64>(x) * 0x9E3779B97F4A7C15ull ^
+             static_cast<u64>(y) * 0xC2B2AE3D27D4EB4Full ^
+             static_cast<u64>(type) * 0x165667B19E3779F9ull;
+  hash ^= hash >> 29;
+  hash *= 0xBF58476D1CE4E5B9ull;
+  hash ^= hash >> 32;
+  return static_cast<u32>(hash);
+}
+
+// The color of a cell of type at a world cell position. The shade comes from
+// where the cell is, so it's the same every frame and nothing about it has to
+// be stored or moved along with the cell.
+inline const Cell_Palette_Color &get_cell_color(Cell_Type type, s64 x, s64 y) {
+  return cell_type_infos[static_cast<u16>(type)]
+      .palette[cell_position_hash(type, x, y) % CELL_PALETTE_SIZE];
+}
+
+// Bit n is set for Cell_Type n
+typedef u32 Cell_Type_Mask;
+static_assert(CELL_TYPE_COUNT <= 32, "Cell_Type_Mask needs more bits");
+
+constexpr Cell_Type_Mask cell_type_bit(Cell_Type type) {
+  return static_cast<Cell_Type_Mask>(1) << static_cast<u16>(type);
+}
+
+// The cells entities can't move through
+constexpr Cell_Type_Mask SOLID_CELL_MASK =
+    cell_type_bit(Cell_Type::DIRT) | cell_type_bit(Cell_Type::GOLD) |
+    cell_type_bit(Cell_Type::SNOW) | cell_type_bit(Cell_Type::NICARAGUA) |
+    cell_type_bit(Cell_Type::SAND) | cell_type_bit(Cell_Type::GRASS);
+// The cells entities swim in
+constexpr Cell_Type_Mask LIQUID_CELL_MASK =
+    cell_type_bit(Cell_Type::WATER) | cell_type_bit(Cell_Type::LAVA);
+// The cells that hurt entities touching them
+constexpr Cell_Type_Mask DAMAGING_CELL_MASK =
+    cell_type_bit(Cell_Type::NICARAGUA) | cell_type_bit(Cell_Type::LAVA);
+
+// What entity collisions care about. Each chunk keeps a bit per cell for
+// every class so they can be checked a row at a time.
+enum class Cell_Class : u8 { SOLID, LIQUID, DAMAGING };
+constexpr u8 CELL_CLASS_COUNT = 3;
+constexpr Cell_Type_Mask CELL_CLASS_TYPES[CELL_CLASS_COUNT] = {
+    SOLID_CELL_MASK, LIQUID_CELL_MASK, DAMAGING_CELL_MASK};
+
+// Index of the lowest set bit. bits can't be 0.
+inline u32 lowest_set_bit(u64 bits) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, bits);
+  return index;
+#else
+  return __builtin_ctzll(bits);
+#endif
+}
+
+inline u32 count_set_bits(u64 bits) {
+#ifdef _MSC_VER
+  return static_cast<u32>(__popcnt64(bits));
+#else
+  return __builtin_popcountll(bits);
+#endif
+}
+
 /// Chunk ///
 // All cell interactions are done in chunks. This is how they're simulated,
 // loaded, and generated.
 constexpr u16 CHUNK_CELL_WIDTH = 64;
 constexpr u16 CHUNK_CELLS = CHUNK_CELL_WIDTH * CHUNK_CELL_WIDTH;  // 4096
                                                                   //
+// Chunks are generated in stages, each building on the last. The first two
+// are done per chunk column since everything they work out only depends on x.
+// A stage can need the neighbors to be at an earlier stage, and the later
+// stages only run once a chunk comes close to the player.
+enum class Gen_Stage : u8 {
+  NONE,
+  HEIGHTS,    // Columns: surface heights and cell bands laid out by biome
+  SETTLED,    // Columns: fluid bands leveled off against the columns around
+              // them. Needs the neighboring columns at HEIGHTS.
+  TERRAIN,    // Chunks: cells filled in from the settled columns
+  DECORATED,  // Chunks: flora placed
+  POPULATED,  // Chunks: creatures spawned. Generation's done
+};
+
+// A chunk boiled down to a few colors for the minimap. See update_minimap.
+constexpr u16 MINIMAP_TILE_WIDTH = 8;  // Texels on a side
+constexpr u16 MINIMAP_TILE_CELLS = CHUNK_CELL_WIDTH / MINIMAP_TILE_WIDTH;
+struct Minimap_Tile {
+  // Average colors, bottom row first like cells
+  Cell_Palette_Color texels[MINIMAP_TILE_WIDTH * MINIMAP_TILE_WIDTH];
+};
+
+struct Chunk_Summary {
+  Minimap_Tile tile;    // Each texel is a MINIMAP_TILE_CELLS square of cells
+  Cell_Type dominant;   // The most common cell type
+  bool stale;           // Queued in the dimension's minimap to be redone
+};
+
+// Bit x of rows[class][y] is set if the cell at x, y is in the class
+struct Cell_Class_Rows {
+  u64 rows[CELL_CLASS_COUNT][CHUNK_CELL_WIDTH];
+};
+static_assert(CHUNK_CELL_WIDTH == 64, "Cell_Class_Rows needs a u64 per row");
+
 struct Chunk {
   Chunk_Coord coord;
-  Cell cells[CHUNK_CELLS];
-  Cell_Type all_cell;
+  // Uniform chunks share one read-only block of cells for their type. Call
+  // make_chunk_writable before changing any of them.
+  std::shared_ptr<Cell[]> cells;
+  // How many of each type the cells are, and which cells are in each class.
+  // Change types with set_cell_type or count_cell_change so these stay right.
+  u16 cell_counts[CELL_TYPE_COUNT];
+  Cell_Class_Rows classes;
+  Cell_Type all_cell;  // Type of every cell in the chunk, or NONE if mixed.
+                       // Follows from cell_counts.
+
+  u64 last_needed;  // Update frame this chunk was last in a load radius
+  bool unsaved;      // Changed since it was generated, loaded, or saved
+  Gen_Stage gen_stage;  // Last generation stage done. At least TERRAIN
+
+  Chunk_Summary summary;
 };
 
+// Sets or clears the cell's bit in each class for a cell of type
+inline void set_cell_classes(Chunk &chunk, u32 cell_index, Cell_Type type) {
+  u64 bit = static_cast<u64>(1) << (cell_index % CHUNK_CELL_WIDTH);
+  u32 y = cell_index / CHUNK_CELL_WIDTH;
+  for (u8 cell_class = 0; cell_class < CELL_CLASS_COUNT; cell_class++) {
+    u64 &row = chunk.classes.rows[cell_class][y];
+    if (CELL_CLASS_TYPES[cell_class] & cell_type_bit(type)) {
+      row |= bit;
+    } else {
+      row &= ~bit;
+    }
+  }
+}
+
+// Moves one cell's worth of count from removed to added, and moves the cell
+// at cell_index over to added's classes
+inline void count_cell_change(Chunk &chunk, u32 cell_index, Cell_Type removed,
+                              Cell_Type added) {
+  if (removed == added) {
+    return;
+  }
+
+  set_cell_classes(chunk, cell_index, added);
+  chunk.cell_counts[(u16)removed]--;
+  chunk.cell_counts[(u16)added]++;
+  if (chunk.cell_counts[(u16)added] == CHUNK_CELLS) {
+    chunk.all_cell = added;
+  } else if (chunk.all_cell == removed) {
+    chunk.all_cell = Cell_Type::NONE;
+  }
+}
+
+// The cell has to be one of the chunk's, and the chunk has to own its cells
+inline void set_cell_type(Chunk &chunk, Cell &cell, Cell_Type type) {
+  count_cell_change(chunk, &cell - chunk.cells.get(), cell.type, type);
+  cell.type = type;
+}
+
 enum class Biome : u8 { FOREST, ALASKA, OCEAN, NICARAGUA, DEEP_OCEAN };
 
 /// Surface generation ///
@@ -151,6 +331,10 @@ constexpr s64 NICARAGUA_EAST_BORDER_CHUNK = -25;
 constexpr s64 FOREST_EAST_BORDER_CHUNK = 25;
 constexpr s64 ALASKA_EAST_BORDER_CHUNK = 50;
 
+// Biome of the overworld surface at a world cell x. The oceans aren't split by
+// depth here.
+Biome get_overworld_biome(s64 x);
+
 u16 surface_det_rand(u64 seed);
 u16 interpolate_and_nudge(u16 y1, u16 y2, f64 fraction, u64 seed,
                           f64 randomness_scale, u16 cell_range);
@@ -158,6 +342,34 @@ u16 surface_height(s64 x, u16 max_depth, u32 world_seed,
                    u64 randomness_range = CHUNK_CELL_WIDTH * 64,
                    u16 cell_range = FOREST_CELL_RANGE);
 
+// A column of cells is laid out in bands from the bottom up. Each band runs
+// from the top of the one below it up to, but not including, its own top.
+// Everything above the last band is air.
+constexpr u8 GEN_MAX_BANDS = 3;
+struct Gen_Band {
+  Cell_Type type;
+  s32 top;
+};
+
+struct Gen_Column {
+  Gen_Band bands[GEN_MAX_BANDS];
+  u8 num_bands;
+};
+
+// Generation for a chunk wide strip of columns
+struct Gen_Columns {
+  Gen_Stage stage;  // HEIGHTS or SETTLED
+  s32 heights[CHUNK_CELL_WIDTH];  // The biome's surface. Spawners go by this
+  Gen_Column raw[CHUNK_CELL_WIDTH];      // As the biome laid them out
+  Gen_Column settled[CHUNK_CELL_WIDTH];  // The cells are filled from these
+};
+
+// Fluids don't stand more than this many cells higher than a surface for each
+// column away from it. See settle_columns
+constexpr s32 GEN_SETTLE_SLOPE = 2;
+
+Cell_Type get_band_cell_type(const Gen_Column &column, s32 y);
+
 // For finding out where a chunk bottom left corner is
 Entity_Coord get_world_pos_from_chunk(Chunk_Coord coord);
 Chunk_Coord get_chunk_coord(f64 x, f64 y);
@@ -168,21 +380,105 @@ enum class DimensionIndex : u8 {
   WATERWORLD,
 };
 
+// Tiles at level n cover 2^n chunks on a side, so every level is the one
+// below it shrunk by half. Level 0 is the chunk summaries. Tiles stay after
+// their chunks are evicted, so it's a map of everywhere that's been loaded.
+constexpr u8 MINIMAP_LEVELS = 6;
+struct Minimap {
+  std::map<Chunk_Coord, Minimap_Tile> levels[MINIMAP_LEVELS];
+  std::vector<Chunk_Coord> stale;  // Chunks with a stale summary
+};
+
+// Entities bucketed by the chunk their coord is in, so finding the ones near
+// somewhere only looks at the buckets around it instead of every entity in
+// the dimension. An entity's bucket is moved when it crosses a chunk border
+// (see mark_entity_chunk_change), and buckets are dropped once they're empty.
+class Entity_Grid {
+ public:
+  // Returns false if it was already in the grid
+  bool insert(Entity_ID id, const Chunk_Coord &bucket);
+  // Returns false if it wasn't in the grid
+  bool erase(Entity_ID id);
+  // Does nothing if it isn't in the grid
+  void move(Entity_ID id, const Chunk_Coord &bucket);
+
+  bool contains(Entity_ID id) const {
+    return id < slots.size() && slots[id].index != NOT_IN_GRID;
+  }
+  size_t bucket_count() const { return buckets.size(); }
+
+  // Calls f with each id in the buckets from min to max, both included. f
+  // can't insert, erase or move.
+  template <typename F>
+  void for_each(const Chunk_Coord &min, const Chunk_Coord &max, F f) const {
+    for (s32 y = min.y; y <= max.y; y++) {
+      for (s32 x = min.x; x <= max.x; x++) {
+        auto bucket_iter = buckets.find({x, y});
+        if (bucket_iter == buckets.end()) {
+          continue;
+        }
+        for (Entity_ID id : bucket_iter->second) {
+          f(id);
+        }
+      }
+    }
+  }
+
+ private:
+  static constexpr u32 NOT_IN_GRID = UINT32_MAX;
+
+  // Where an id is in the buckets
+  struct Slot {
+    Chunk_Coord bucket;
+    u32 index;  // NOT_IN_GRID if it isn't in the grid
+  };
+
+  std::unordered_map<Chunk_Coord, std::vector<Entity_ID>, Chunk_Coord_Hash>
+      buckets;
+  std::vector<Slot> slots;  // By id. Grown as needed.
+};
+
 struct Dimension {
   std::map<Chunk_Coord, Chunk> chunks;
-  std::set<Entity_ID>
+  std::map<s32, Gen_Columns> gen_columns;  // By chunk x. See get_gen_columns
+  Entity_Set
       entity_indicies;  // General collection of all entities in the dimension
 
   // Entities are all stored in Update_State, but for existance based
   // processing, we keep an index here
-  std::multimap<Entity_Z, Entity_ID> e_render;  // Entites with a texture
-  std::set<Entity_ID>
-      e_kinetic;  // Entities that should be updated in the kinetic step
-  std::set<Entity_ID>
-      e_health;              // Entites that need to have their health checked
-  std::set<Entity_ID> e_ai;  // Entities with AI stuff
+  Render_Registry e_render;  // Entites with a texture
+  Entity_Set e_kinetic;  // Entities that should be updated in the kinetic step
+  Entity_Set e_health;   // Entites that need to have their health checked
+  Entity_Set e_ai;       // Entities with AI stuff
+  Entity_Grid e_grid;    // Every entity, by where it is
+
+  // Found by the last update_kinetic, and used by the next update_health and
+  // update_ai
+  std::vector<Entity_Contact> contacts;
+
+  Minimap minimap;
+};
+
+// If chunk isn't nullptr it's set to the chunk the cell is in
+Cell *get_cell_at_world_pos(Dimension &dim, s64 x, s64 y,
+                            Chunk **chunk = nullptr);
+
+struct Region_Cell_Counts {
+  u64 counts[CELL_TYPE_COUNT];
+  u32 chunks;  // Loaded chunks that were counted
 };
 
-Cell *get_cell_at_world_pos(Dimension &dim, s64 x, s64 y);
+// Adds up the counts of the loaded chunks from min up to but not including
+// max. It's a few adds per chunk, so it's cheap enough to call every frame.
+void count_region_cells(const Dimension &dim, const Chunk_Coord &min,
+                        const Chunk_Coord &max, Region_Cell_Counts &region);
+
+// Chunks around the player looked at by get_ambient_biome
+constexpr s32 AMBIENT_CHUNK_RADIUS = 2;
+
+// The biome the cells around a world cell look like, for music and
+// backgrounds. Goes by whichever of lava, snow, water and grass there's the
+// most of, and falls back on get_overworld_biome in open air.
+Biome get_ambient_biome(const Dimension &dim, s64 x, s64 y);
 
 }  // namespace VV
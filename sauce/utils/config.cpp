@@ -1,5 +1,7 @@
 #include "utils/config.h"
 
+#include "update/entity.h"
+
 #ifdef _WIN32
 #include <windows.h>
 #undef min  // SDL has a macro for this on windows for some reason
@@ -15,13 +17,17 @@
 namespace VV {
 Config default_config() {
   return {
-      600,    // window_width
-      400,    // window_height
-      true,   // window_start_maximized
-      false,  // show_chunk_corners
-      4,      // num_threads
-      "",     // res_dir: Should be set by caller
-      "",     // tex_dir: set with res_dir
+      600,                   // window_width
+      400,                   // window_height
+      true,                  // window_start_maximized
+      false,                 // show_chunk_corners
+      4,                     // num_threads
+      16ull * 1024 * 1024,   // chunk_memory_budget: ~2000 chunks at 8 KiB
+      30,                    // autosave_interval
+      DEFAULT_MAX_ENTITIES,  // max_entities
+      "",                    // res_dir: Should be set by caller
+      "",                    // tex_dir: set with res_dir
+      "",                    // save_dir: set with res_dir
   };
 }
 
@@ -12,8 +12,15 @@ struct Config {
   bool debug_overlay;
   u8 num_threads;
 
+  // Chunks outside the load radius get evicted once the resident chunks of a
+  // dimension go over this many bytes
+  u64 chunk_memory_budget;
+  u32 autosave_interval;  // Seconds between autosaves. 0 turns them off
+  u32 max_entities;       // Entity ids handed out at most, including id 0
+
   std::filesystem::path res_dir;
   std::filesystem::path tex_dir;
+  std::filesystem::path save_dir;  // Worlds are saved here by seed
 };
 
 Config default_config();
@@ -70,6 +70,8 @@ class ThreadPool {
     return stop;
   }
 
+  size_t size() const { return workers.size(); }
+
  private:
   std::vector<std::thread> workers;
   std::queue<std::function<void()>> tasks;
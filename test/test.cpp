@@ -1,3 +1,11 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <random>
+#include <thread>
+#include <tuple>
+
 #include "app.h"
 #include "gtest/gtest.h"
 
@@ -32,4 +40,1210 @@ TEST(SurfaceGen, ReasonableLessThanZero) {
   EXPECT_NE(x, CHUNK_CELL_WIDTH) << "All heights at chunk_x " << chunk_x
                                  << " were the same height: " << last_height;
 }
+
+// Whether the palette color could have come from rolling color
+bool rolled_from(const Cell_Palette_Color &pcolor, const Cell_Color &color) {
+  auto in_range = [](u8 value, u8 base, u8 variety) {
+    return value >= base && value < base + std::max<u16>(variety, 1);
+  };
+  return in_range(pcolor.r, color.r_base, color.r_variety) &&
+         in_range(pcolor.g, color.g_base, color.g_variety) &&
+         in_range(pcolor.b, color.b_base, color.b_variety) &&
+         in_range(pcolor.a, color.a_base, color.a_variety);
+}
+
+TEST(CellPalette, FollowsFactoryColors) {
+  // Rolled in order, so the first is picked a quarter of the time and the
+  // other two split what's left
+  Cell_Type_Info info = {};
+  info.num_colors = 3;
+  info.colors[0] = {10, 5, 20, 0, 30, 0, 255, 0, 25};
+  info.colors[1] = {100, 0, 110, 8, 120, 0, 200, 0, 50};
+  info.colors[2] = {0, 0, 0, 0, 250, 4, 255, 0, 100};
+  bake_cell_palette(info, 3);
+
+  u32 picked[3] = {};
+  for (const Cell_Palette_Color &pcolor : info.palette) {
+    u8 color = 0;
+    while (color < 3 && !rolled_from(pcolor, info.colors[color])) {
+      color++;
+    }
+    ASSERT_LT(color, 3) << "palette color isn't any of the factory's";
+    picked[color]++;
+  }
+  EXPECT_NEAR(picked[0] / (f64)CELL_PALETTE_SIZE, 0.25, 0.1);
+  EXPECT_NEAR(picked[1] / (f64)CELL_PALETTE_SIZE, 0.375, 0.1);
+  EXPECT_NEAR(picked[2] / (f64)CELL_PALETTE_SIZE, 0.375, 0.1);
+
+  // Looking a cell's color up gives one the old per cell rolls could have,
+  // and the same one every time
+  std::filesystem::path res_dir;
+  ASSERT_EQ(get_resource_dir(res_dir), Result::SUCCESS);
+  ASSERT_EQ(init_cell_factory(res_dir / "cell_factory.json"), Result::SUCCESS);
+  const Cell_Type_Info &dirt = cell_type_infos[(u16)Cell_Type::DIRT];
+  for (s64 x = -50; x < 50; x++) {
+    const Cell_Palette_Color &pcolor = get_cell_color(Cell_Type::DIRT, x, 7);
+    EXPECT_EQ(&pcolor, &get_cell_color(Cell_Type::DIRT, x, 7));
+    EXPECT_TRUE(std::any_of(dirt.colors, dirt.colors + dirt.num_colors,
+                            [&](const Cell_Color &color) {
+                              return rolled_from(pcolor, color);
+                            }));
+  }
+}
+
+TEST(RegionFile, ChunkRoundTrip) {
+  std::unique_ptr<Chunk> chunk = std::make_unique<Chunk>();
+  chunk->coord = {0, 0};
+  alloc_chunk_cells(*chunk);
+  fill_cells(*chunk, 0, CHUNK_CELLS, Cell_Type::AIR);
+  fill_cells(*chunk, 0, CHUNK_CELL_WIDTH * 10, Cell_Type::DIRT);
+  chunk->cells[CHUNK_CELL_WIDTH * 10 + 3] = create_cell(Cell_Type::WATER);
+  chunk->all_cell = Cell_Type::NONE;
+
+  std::vector<Saved_Entity> entities = {
+      {Entity_Factory_Type::TREE, {12.5, -40.0}, Texture_Id::AKTREE1, true, 7}};
+
+  std::filesystem::path save_dir =
+      std::filesystem::temp_directory_path() / "vv_region_test";
+  std::filesystem::remove_all(save_dir);
+
+  World_Save save;
+  ASSERT_EQ(open_world_save(save, save_dir), Result::SUCCESS);
+
+  // A negative coord to check chunks land in the right region
+  Chunk_Coord coord = {-33, 5};
+  auto snapshot = std::make_shared<Chunk_Snapshot>();
+  snapshot->chunk = *chunk;
+  snapshot->chunk.coord = coord;
+  snapshot->entities = entities;
+  queue_chunk_save(save, DimensionIndex::OVERWORLD, snapshot);
+
+  // Queued chunks can be read back before they're written
+  std::unique_ptr<Chunk> loaded = std::make_unique<Chunk>();
+  std::vector<Saved_Entity> loaded_entities;
+  ASSERT_EQ(read_region_chunk(save, DimensionIndex::OVERWORLD, coord, *loaded,
+                              loaded_entities),
+            Result::SUCCESS);
+  EXPECT_EQ(loaded_entities.size(), 1u);
+
+  ASSERT_EQ(flush_world_save(save), Result::SUCCESS);
+  EXPECT_TRUE(save.pending.empty());
+
+  EXPECT_EQ(read_region_chunk(save, DimensionIndex::OVERWORLD, {-32, 5},
+                              *loaded, loaded_entities),
+            Result::NONEXIST);
+  ASSERT_EQ(read_region_chunk(save, DimensionIndex::OVERWORLD, coord, *loaded,
+                              loaded_entities),
+            Result::SUCCESS);
+
+  for (u32 cell = 0; cell < CHUNK_CELLS; cell++) {
+    ASSERT_EQ(loaded->cells[cell].type, chunk->cells[cell].type)
+        << "Cell " << cell << " changed type";
+  }
+  EXPECT_EQ(loaded->all_cell, Cell_Type::NONE);
+
+  ASSERT_EQ(loaded_entities.size(), 1u);
+  EXPECT_EQ(loaded_entities[0].type, Entity_Factory_Type::TREE);
+  EXPECT_EQ(loaded_entities[0].coord.x, 12.5);
+  EXPECT_EQ(loaded_entities[0].coord.y, -40.0);
+  EXPECT_EQ(loaded_entities[0].texture, Texture_Id::AKTREE1);
+  EXPECT_TRUE(loaded_entities[0].flipped);
+  EXPECT_EQ(loaded_entities[0].health, 7);
+
+  close_world_save(save);
+  std::filesystem::remove_all(save_dir);
+}
+
+TEST(UniformChunk, CopiedOnWrite) {
+  std::filesystem::path res_dir;
+  ASSERT_EQ(get_resource_dir(res_dir), Result::SUCCESS);
+  ASSERT_EQ(init_cell_factory(res_dir / "cell_factory.json"), Result::SUCCESS);
+
+  Chunk sky, more_sky;
+  set_chunk_uniform(sky, Cell_Type::AIR);
+  set_chunk_uniform(more_sky, Cell_Type::AIR);
+  EXPECT_EQ(sky.cells, more_sky.cells);
+  EXPECT_EQ(get_chunk_bytes(sky), sizeof(Chunk));
+
+  make_chunk_writable(sky);
+  ASSERT_NE(sky.cells, more_sky.cells);
+  EXPECT_EQ(get_chunk_bytes(sky), sizeof(Chunk) + CHUNK_CELLS * sizeof(Cell));
+
+  sky.cells[0] = create_cell(Cell_Type::WATER);
+  EXPECT_EQ(more_sky.cells[0].type, Cell_Type::AIR);
+
+  // Owned cells aren't copied again
+  const Cell *owned = sky.cells.get();
+  make_chunk_writable(sky);
+  EXPECT_EQ(sky.cells.get(), owned);
+}
+
+TEST(Structures, StampedAcrossChunks) {
+  std::filesystem::path res_dir;
+  ASSERT_EQ(get_resource_dir(res_dir), Result::SUCCESS);
+  ASSERT_EQ(init_cell_factory(res_dir / "cell_factory.json"), Result::SUCCESS);
+  std::vector<Structure_Prefab> structures;
+  ASSERT_EQ(init_structures(structures, res_dir / "structures.json"),
+            Result::SUCCESS);
+
+  auto hut = std::find_if(
+      structures.begin(), structures.end(),
+      [](const Structure_Prefab &prefab) { return prefab.name == "hut"; });
+  ASSERT_NE(hut, structures.end());
+
+  // Straddles the border between the two chunks
+  Structure_Placement placement = {&*hut, CHUNK_CELL_WIDTH - 5, 10};
+  Chunk chunks[2];
+  for (s32 x = 0; x < 2; x++) {
+    chunks[x].coord = {x, 0};
+    set_chunk_uniform(chunks[x], Cell_Type::DIRT);
+    stamp_structure(chunks[x], placement);
+    EXPECT_EQ(chunks[x].all_cell, Cell_Type::NONE);
+  }
+
+  Chunk untouched;
+  set_chunk_uniform(untouched, Cell_Type::DIRT);
+  for (u32 cell = 0; cell < CHUNK_CELLS; cell++) {
+    ASSERT_EQ(untouched.cells[cell].type, Cell_Type::DIRT);
+  }
+
+  for (u16 y = 0; y < hut->height; y++) {
+    for (u16 x = 0; x < hut->width; x++) {
+      s64 world_x = placement.x + x;
+      const Chunk &chunk = chunks[world_x / CHUNK_CELL_WIDTH];
+      const Cell &cell =
+          chunk.cells[(placement.y + y) * CHUNK_CELL_WIDTH +
+                      world_x % CHUNK_CELL_WIDTH];
+
+      // Cells outside of the spans are left alone
+      Cell_Type expected = hut->cells[y * hut->width + x].type;
+      if (expected == Cell_Type::NONE) {
+        expected = Cell_Type::DIRT;
+      }
+      ASSERT_EQ(cell.type, expected) << "Cell " << x << ", " << y;
+    }
+  }
+}
+
+// FNV-1a over everything generation decides: cells, all_cell, and entities
+void hash_bytes(u64 &hash, const void *data, size_t size) {
+  const u8 *bytes = static_cast<const u8 *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+}
+
+std::unique_ptr<Update_State> make_gen_state(u32 world_seed) {
+  std::filesystem::path res_dir;
+  EXPECT_EQ(get_resource_dir(res_dir), Result::SUCCESS);
+  EXPECT_EQ(init_cell_factory(res_dir / "cell_factory.json"), Result::SUCCESS);
+
+  auto update_state = std::make_unique<Update_State>();
+  EXPECT_EQ(
+      init_entity_factory(*update_state, res_dir / "entity_factory.json"),
+      Result::SUCCESS);
+  EXPECT_EQ(
+      init_structures(update_state->structures, res_dir / "structures.json"),
+      Result::SUCCESS);
+  update_state->world_seed = world_seed;
+  update_state->dimensions.emplace(DimensionIndex::OVERWORLD, Dimension());
+  update_state->active_dimension = DimensionIndex::OVERWORLD;
+  return update_state;
+}
+
+TEST(ChunkEviction, OldestOutsideRadiusGo) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+  std::filesystem::path save_dir =
+      std::filesystem::temp_directory_path() / "vv_eviction_test";
+  std::filesystem::remove_all(save_dir);
+  ASSERT_EQ(open_world_save(update_state->world_save, save_dir),
+            Result::SUCCESS);
+  auto save_pool = std::make_unique<ThreadPool>(1);
+  update_state->save_thread_pool = save_pool.get();
+
+  // The origin chunk is the oldest but inside the radius, so the two oldest
+  // after it go
+  std::map<Chunk_Coord, u64> last_needed = {
+      {{0, 0}, 0}, {{10, 0}, 4}, {{11, 0}, 1}, {{12, 0}, 3}, {{13, 0}, 2}};
+  for (const auto &[coord, frame] : last_needed) {
+    Chunk &chunk = dim.chunks[coord];
+    chunk.coord = coord;
+    chunk.last_needed = frame;
+    set_chunk_uniform(chunk, Cell_Type::AIR);
+  }
+  dim.chunks[{11, 0}].unsaved = true;
+  update_state->chunk_memory_budget = 3 * sizeof(Chunk);
+
+  // One jellyfish in a chunk that goes, and one that wandered off somewhere
+  // that was never loaded
+  std::vector<Entity_ID> ids;
+  ASSERT_EQ(spawn_entities(
+                *update_state, DimensionIndex::OVERWORLD,
+                {{Entity_Factory_Type::JELLYFISH, {11 * 64.0 + 5, 5.0}, {}},
+                 {Entity_Factory_Type::JELLYFISH, {50 * 64.0, 5.0}, {}}},
+                &ids),
+            Result::SUCCESS);
+
+  evict_chunks(*update_state, DimensionIndex::OVERWORLD, 0.0, 0.0, 1);
+  EXPECT_EQ(dim.chunks.size(), 3u);
+  EXPECT_EQ(dim.chunks.count({0, 0}), 1u);
+  EXPECT_EQ(dim.chunks.count({11, 0}), 0u);
+  EXPECT_EQ(dim.chunks.count({13, 0}), 0u);
+  EXPECT_LE(get_resident_chunk_bytes(dim), update_state->chunk_memory_budget);
+
+  EXPECT_FALSE(dim.entity_indicies.contains(ids[0]));
+  EXPECT_FALSE(dim.e_grid.contains(ids[0]));
+  EXPECT_TRUE(dim.entity_indicies.contains(ids[1]));
+
+  // The jellyfish went into the save with its chunk
+  save_pool.reset();
+  Chunk loaded = {};
+  std::vector<Saved_Entity> loaded_entities;
+  ASSERT_EQ(read_region_chunk(update_state->world_save,
+                              DimensionIndex::OVERWORLD, {11, 0}, loaded,
+                              loaded_entities),
+            Result::SUCCESS);
+  ASSERT_EQ(loaded_entities.size(), 1u);
+  EXPECT_EQ(loaded_entities[0].type, Entity_Factory_Type::JELLYFISH);
+
+  close_world_save(update_state->world_save);
+  std::filesystem::remove_all(save_dir);
+}
+
+TEST(Autosave, SavesChangedChunksAtOnce) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+  std::filesystem::path save_dir =
+      std::filesystem::temp_directory_path() / "vv_autosave_test";
+  std::filesystem::remove_all(save_dir);
+  ASSERT_EQ(open_world_save(update_state->world_save, save_dir),
+            Result::SUCCESS);
+  auto save_pool = std::make_unique<ThreadPool>(1);
+  update_state->save_thread_pool = save_pool.get();
+  update_state->autosave_interval = std::chrono::seconds(60);
+
+  for (s32 x = 0; x <= 2; x++) {
+    Chunk &chunk = dim.chunks[{x, 0}];
+    chunk.coord = {x, 0};
+    set_chunk_uniform(chunk, Cell_Type::AIR);
+  }
+
+  // A jellyfish that stays put and a fish that falls. Only the fish's chunk
+  // changes.
+  std::vector<Entity_ID> ids;
+  ASSERT_EQ(spawn_entities(*update_state, DimensionIndex::OVERWORLD,
+                           {{Entity_Factory_Type::JELLYFISH, {10.0, 50.0}, {}},
+                            {Entity_Factory_Type::FISH, {74.0, 50.0}, {}}},
+                           &ids),
+            Result::SUCCESS);
+  dim.e_kinetic.insert(ids[1]);
+  for (auto &[coord, chunk] : dim.chunks) {
+    chunk.unsaved = false;
+  }
+  update_kinetic(*update_state);
+  EXPECT_FALSE((dim.chunks[{0, 0}].unsaved));
+  EXPECT_TRUE((dim.chunks[{1, 0}].unsaved));
+
+  // Everything unsaved goes in the one update
+  dim.chunks[{2, 0}].unsaved = true;
+  update_autosave(*update_state);
+  for (const auto &[coord, chunk] : dim.chunks) {
+    EXPECT_FALSE(chunk.unsaved);
+  }
+
+  save_pool.reset();
+  EXPECT_TRUE(update_state->world_save.pending.empty());
+  Chunk loaded = {};
+  std::vector<Saved_Entity> loaded_entities;
+  EXPECT_EQ(read_region_chunk(update_state->world_save,
+                              DimensionIndex::OVERWORLD, {0, 0}, loaded,
+                              loaded_entities),
+            Result::NONEXIST);
+  ASSERT_EQ(read_region_chunk(update_state->world_save,
+                              DimensionIndex::OVERWORLD, {1, 0}, loaded,
+                              loaded_entities),
+            Result::SUCCESS);
+  ASSERT_EQ(loaded_entities.size(), 1u);
+  EXPECT_EQ(loaded_entities[0].type, Entity_Factory_Type::FISH);
+  EXPECT_EQ(read_region_chunk(update_state->world_save,
+                              DimensionIndex::OVERWORLD, {2, 0}, loaded,
+                              loaded_entities),
+            Result::SUCCESS);
+
+  close_world_save(update_state->world_save);
+  std::filesystem::remove_all(save_dir);
+}
+
+TEST(Pregen, ChunksLoadBack) {
+  Config config = {};
+  config.save_dir = std::filesystem::temp_directory_path() / "vv_pregen_test";
+  std::filesystem::remove_all(config.save_dir);
+
+  // Crosses region boundaries both ways, and the top edge cuts through the
+  // forest so some trees stand outside the rectangle
+  Pregen_Request request = {0, {-12, -6}, {6, 2}};
+  ASSERT_EQ(pregen_world(config, request), Result::SUCCESS);
+
+  // The same rectangle generated in game
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+  Chunk_Coord icc;
+  for (icc.x = request.min.x; icc.x < request.max.x; icc.x++) {
+    for (icc.y = request.min.y; icc.y < request.max.y; icc.y++) {
+      load_chunk(*update_state, DimensionIndex::OVERWORLD, icc);
+    }
+  }
+
+  World_Save save = {};
+  ASSERT_EQ(open_world_save(save, get_world_save_dir(config, 0)),
+            Result::SUCCESS);
+
+  // Entities outside the rectangle are saved with the closest chunk on its
+  // edge
+  using Entity_Key = std::tuple<u16, f64, f64>;
+  std::map<Chunk_Coord, std::vector<Entity_Key>> expected_entities;
+  for (Entity_ID id : dim.entity_indicies) {
+    Entity_Ref e = update_state->entities[id];
+    if (e.status & (u16)Entity_Status::DEATHLESS) {
+      continue;
+    }
+    Chunk_Coord coord = get_chunk_coord(e.coord.x, e.coord.y);
+    coord.x = std::clamp(coord.x, request.min.x, request.max.x - 1);
+    coord.y = std::clamp(coord.y, request.min.y, request.max.y - 1);
+    expected_entities[coord].emplace_back(static_cast<u16>(e.factory_type),
+                                          e.coord.x, e.coord.y);
+  }
+
+  size_t entity_count = 0;
+  for (icc.x = request.min.x; icc.x < request.max.x; icc.x++) {
+    for (icc.y = request.min.y; icc.y < request.max.y; icc.y++) {
+      Chunk loaded = {};
+      std::vector<Saved_Entity> loaded_entities;
+      ASSERT_EQ(read_region_chunk(save, DimensionIndex::OVERWORLD, icc, loaded,
+                                  loaded_entities),
+                Result::SUCCESS);
+      EXPECT_EQ(loaded.gen_stage, Gen_Stage::POPULATED);
+
+      const Chunk &generated = dim.chunks.at(icc);
+      for (u32 cell = 0; cell < CHUNK_CELLS; cell++) {
+        ASSERT_EQ(loaded.cells[cell].type, generated.cells[cell].type);
+      }
+
+      std::vector<Entity_Key> expected = expected_entities[icc], got;
+      for (const Saved_Entity &e : loaded_entities) {
+        got.emplace_back(static_cast<u16>(e.type), e.coord.x, e.coord.y);
+      }
+      std::sort(expected.begin(), expected.end());
+      std::sort(got.begin(), got.end());
+      EXPECT_EQ(got, expected) << "chunk " << icc.x << ", " << icc.y;
+      entity_count += got.size();
+    }
+  }
+  EXPECT_GT(entity_count, 0u);
+
+  close_world_save(save);
+  std::filesystem::remove_all(config.save_dir);
+}
+
+TEST(SpawnEntities, RegistersLikeCreateEntity) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+
+  std::vector<Entity_Spawn> spawns = {
+      {Entity_Factory_Type::TREE, {1.0, 2.0}, Texture_Id::NONE},
+      {Entity_Factory_Type::TREE, {3.0, 4.0}, Texture_Id::AKTREE2},
+      {Entity_Factory_Type::JELLYFISH, {5.0, 6.0}, Texture_Id::NONE}};
+  std::vector<Entity_ID> ids;
+  ASSERT_EQ(spawn_entities(*update_state, DimensionIndex::OVERWORLD, spawns,
+                           &ids),
+            Result::SUCCESS);
+  ASSERT_EQ(ids.size(), spawns.size());
+
+  Entity_ID created;
+  ASSERT_EQ(create_entity(*update_state, DimensionIndex::OVERWORLD,
+                          Entity_Factory_Type::JELLYFISH, created),
+            Result::SUCCESS);
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    Entity_Ref e = update_state->entities[ids[i]];
+    EXPECT_EQ(e.factory_type, spawns[i].type);
+    EXPECT_EQ(e.coord.x, spawns[i].coord.x);
+    EXPECT_EQ(e.coord.y, spawns[i].coord.y);
+    EXPECT_TRUE(dim.entity_indicies.count(ids[i]));
+  }
+  EXPECT_EQ(update_state->entities[ids[0]].texture, Texture_Id::TREE);
+  EXPECT_EQ(update_state->entities[ids[1]].texture, Texture_Id::AKTREE2);
+
+  // The batched jellyfish is in every registry the created one is
+  EXPECT_EQ(dim.e_kinetic.count(ids[2]), dim.e_kinetic.count(created));
+  EXPECT_EQ(dim.e_health.count(ids[2]), dim.e_health.count(created));
+  EXPECT_EQ(dim.e_ai.count(ids[2]), dim.e_ai.count(created));
+  EXPECT_EQ(dim.e_render.size(), 4u);
+  EXPECT_EQ(update_state->entity_id_pool.size(), 4u);
+
+  // A type without a factory fails the whole batch
+  update_state->entity_factories.erase(Entity_Factory_Type::BUSH);
+  EXPECT_EQ(spawn_entities(
+                *update_state, DimensionIndex::OVERWORLD,
+                {{Entity_Factory_Type::TREE, {1.0, 2.0}, Texture_Id::NONE},
+                 {Entity_Factory_Type::BUSH, {3.0, 4.0}, Texture_Id::NONE}}),
+            Result::VALUE_ERROR);
+  EXPECT_EQ(update_state->entity_factories.count(Entity_Factory_Type::BUSH),
+            0u);
+  EXPECT_EQ(update_state->entity_id_pool.size(), 4u);
+}
+
+u64 hash_dimension(const Update_State &update_state, const Dimension &dim) {
+  u64 hash = 0xcbf29ce484222325ull;
+  for (const auto &[coord, chunk] : dim.chunks) {
+    hash_bytes(hash, &coord, sizeof(coord));
+    for (u32 cell_index = 0; cell_index < CHUNK_CELLS; cell_index++) {
+      const Cell &cell = chunk.cells[cell_index];
+      hash_bytes(hash, &cell.type, sizeof(cell.type));
+    }
+    hash_bytes(hash, &chunk.all_cell, sizeof(chunk.all_cell));
+    hash_bytes(hash, &chunk.gen_stage, sizeof(chunk.gen_stage));
+  }
+
+  // Entity ids depend on creation order, so compare them sorted by content
+  std::vector<std::tuple<u16, f64, f64, u8>> entities;
+  for (Entity_ID id : dim.entity_indicies) {
+    Entity e = update_state.entities.load(id);
+    entities.emplace_back(static_cast<u16>(e.factory_type), e.coord.x,
+                          e.coord.y, static_cast<u8>(e.texture));
+  }
+  std::sort(entities.begin(), entities.end());
+  for (const auto &entity : entities) {
+    hash_bytes(hash, &std::get<0>(entity), sizeof(u16));
+    hash_bytes(hash, &std::get<1>(entity), sizeof(f64));
+    hash_bytes(hash, &std::get<2>(entity), sizeof(f64));
+    hash_bytes(hash, &std::get<3>(entity), sizeof(u8));
+  }
+
+  return hash;
+}
+
+u64 gen_chunks_hash_on_thread(const std::vector<Chunk_Coord> &order,
+                              u32 world_seed) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(world_seed);
+
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+  for (const Chunk_Coord &coord : order) {
+    gen_chunk(*update_state, DimensionIndex::OVERWORLD, dim.chunks[coord],
+              coord);
+  }
+
+  return hash_dimension(*update_state, dim);
+}
+
+// Each run gets its own thread so surface_height's per thread cache starts
+// cold, like it would in a fresh game
+u64 gen_chunks_hash(const std::vector<Chunk_Coord> &order, u32 world_seed) {
+  u64 hash = 0;
+  std::thread gen_thread(
+      [&]() { hash = gen_chunks_hash_on_thread(order, world_seed); });
+  gen_thread.join();
+  return hash;
+}
+
+TEST(WorldGen, OrderIndependent) {
+  // Spread across every overworld biome and their borders
+  std::vector<Chunk_Coord> coords;
+  for (s32 x = NICARAGUA_EAST_BORDER_CHUNK - 3;
+       x < ALASKA_EAST_BORDER_CHUNK + 4; x += 3) {
+    for (s32 y = SURFACE_Y_MIN - 1; y <= SURFACE_Y_MAX; y++) {
+      coords.push_back({x, y});
+    }
+  }
+
+  const u32 WORLD_SEED = 0x5eed;
+  u64 in_order = gen_chunks_hash(coords, WORLD_SEED);
+
+  std::reverse(coords.begin(), coords.end());
+  EXPECT_EQ(gen_chunks_hash(coords, WORLD_SEED), in_order);
+
+  std::mt19937 shuffle_rng(1234);
+  for (int shuffle = 0; shuffle < 2; shuffle++) {
+    std::shuffle(coords.begin(), coords.end(), shuffle_rng);
+    EXPECT_EQ(gen_chunks_hash(coords, WORLD_SEED), in_order)
+        << "Shuffled generation " << shuffle << " differs";
+  }
+
+  EXPECT_NE(gen_chunks_hash(coords, WORLD_SEED + 1), in_order);
+}
+
+// Generating a square a stage at a time on the thread pool has to come out the
+// same as generating each chunk start to finish
+TEST(WorldGen, StagedMatchesDirect) {
+  const u32 WORLD_SEED = 0x5eed;
+  const u8 RADIUS = 3;
+  // The ocean runs into Alaska here, so there's some settling to do
+  f64 x = ALASKA_EAST_BORDER_CHUNK * CHUNK_CELL_WIDTH;
+  f64 y = 0.0;
+
+  std::unique_ptr<Update_State> staged = make_gen_state(WORLD_SEED);
+  staged->thread_pool = new ThreadPool(4);
+  load_chunks_square(*staged, DimensionIndex::OVERWORLD, x, y, RADIUS);
+  Dimension &staged_dim = staged->dimensions[DimensionIndex::OVERWORLD];
+  for (const auto &[coord, chunk] : staged_dim.chunks) {
+    EXPECT_EQ(chunk.gen_stage, Gen_Stage::TERRAIN);
+  }
+  EXPECT_TRUE(staged_dim.entity_indicies.empty());
+
+  populate_chunks_square(*staged, DimensionIndex::OVERWORLD, x, y, RADIUS);
+  delete staged->thread_pool;
+
+  std::unique_ptr<Update_State> direct = make_gen_state(WORLD_SEED);
+  Dimension &direct_dim = direct->dimensions[DimensionIndex::OVERWORLD];
+  for (const auto &[coord, chunk] : staged_dim.chunks) {
+    gen_chunk(*direct, DimensionIndex::OVERWORLD, direct_dim.chunks[coord],
+              coord);
+  }
+
+  EXPECT_EQ(hash_dimension(*staged, staged_dim),
+            hash_dimension(*direct, direct_dim));
+}
+
+// The preview skips making chunks, so it has to agree with the terrain the
+// chunks would have had
+TEST(WorldPreview, MatchesTerrain) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0x5eed);
+  World_Preview_Request request = {0x5eed,
+                                   {ALASKA_EAST_BORDER_CHUNK - 2, -2},
+                                   {ALASKA_EAST_BORDER_CHUNK + 2, 2}};
+
+  std::vector<Cell_Palette_Color> pixels;
+  u32 width, height;
+  render_world_preview(request, pixels, width, height);
+  ASSERT_EQ(width, 4u * CHUNK_CELL_WIDTH / PREVIEW_CELLS_PER_PIXEL);
+  ASSERT_EQ(height, 4u * CHUNK_CELL_WIDTH / PREVIEW_CELLS_PER_PIXEL);
+
+  Chunk_Coord coord;
+  for (coord.x = request.min.x; coord.x < request.max.x; coord.x++) {
+    const Gen_Columns &columns =
+        get_gen_columns(*update_state, DimensionIndex::OVERWORLD, coord.x,
+                        Gen_Stage::SETTLED);
+    for (coord.y = request.min.y; coord.y < request.max.y; coord.y++) {
+      Chunk chunk;
+      chunk.coord = coord;
+      fill_chunk_terrain(chunk, columns);
+
+      for (u16 y = 0; y < CHUNK_CELL_WIDTH; y += PREVIEW_CELLS_PER_PIXEL) {
+        for (u16 x = 0; x < CHUNK_CELL_WIDTH; x += PREVIEW_CELLS_PER_PIXEL) {
+          s64 cell_x = coord.x * CHUNK_CELL_WIDTH + x;
+          s64 cell_y = coord.y * CHUNK_CELL_WIDTH + y;
+          Cell_Palette_Color expected = get_preview_color(
+              chunk.cells[y * CHUNK_CELL_WIDTH + x].type, cell_x, cell_y);
+
+          u32 pixel_x = (cell_x - request.min.x * CHUNK_CELL_WIDTH) /
+                        PREVIEW_CELLS_PER_PIXEL;
+          u32 pixel_y = (request.max.y * CHUNK_CELL_WIDTH - 1 - cell_y) /
+                        PREVIEW_CELLS_PER_PIXEL;
+          const Cell_Palette_Color &pixel = pixels[pixel_y * width + pixel_x];
+          ASSERT_EQ(std::tie(pixel.r, pixel.g, pixel.b),
+                    std::tie(expected.r, expected.g, expected.b))
+              << "Cell " << cell_x << ", " << cell_y;
+        }
+      }
+    }
+  }
+}
+
+TEST(Minimap, OnlyStaleChunksRedone) {
+  std::filesystem::path res_dir;
+  ASSERT_EQ(get_resource_dir(res_dir), Result::SUCCESS);
+  ASSERT_EQ(init_cell_factory(res_dir / "cell_factory.json"), Result::SUCCESS);
+
+  Dimension dim = {};
+  for (s32 x = 0; x < 2; x++) {
+    Chunk &chunk = dim.chunks[{x, 0}];
+    chunk.coord = {x, 0};
+    set_chunk_uniform(chunk, x == 0 ? Cell_Type::DIRT : Cell_Type::AIR);
+    mark_chunk_summary_stale(dim, chunk);
+    mark_chunk_summary_stale(dim, chunk);
+  }
+  EXPECT_EQ(dim.minimap.stale.size(), 2u);
+
+  update_minimap(dim);
+  EXPECT_TRUE(dim.minimap.stale.empty());
+  EXPECT_EQ((dim.chunks[{0, 0}].summary.dominant), Cell_Type::DIRT);
+  for (u8 level = 0; level < MINIMAP_LEVELS; level++) {
+    EXPECT_NE(get_minimap_tile(dim.minimap, level, {0, 0}), nullptr);
+  }
+  EXPECT_EQ(get_minimap_tile(dim.minimap, 0, {2, 0}), nullptr);
+
+  // Dig some water into the dirt. Only that chunk's summary changes.
+  Chunk &dirt = dim.chunks[{0, 0}];
+  make_chunk_writable(dirt);
+  fill_cells(dirt, 0, CHUNK_CELLS * 3 / 4, Cell_Type::WATER);
+  mark_chunk_summary_stale(dim, dirt);
+  dim.chunks[{1, 0}].summary.dominant = Cell_Type::NONE;
+
+  update_minimap(dim);
+  EXPECT_EQ(dirt.summary.dominant, Cell_Type::WATER);
+  EXPECT_EQ((dim.chunks[{1, 0}].summary.dominant), Cell_Type::NONE);
+}
+
+TEST(CellCounts, FollowSimulation) {
+  std::filesystem::path res_dir;
+  ASSERT_EQ(get_resource_dir(res_dir), Result::SUCCESS);
+  ASSERT_EQ(init_cell_factory(res_dir / "cell_factory.json"), Result::SUCCESS);
+
+  // Water over air, with the water free to fall and spread into the air
+  Dimension dim = {};
+  for (s32 x = -1; x <= 1; x++) {
+    for (s32 y = -1; y <= 1; y++) {
+      Chunk &chunk = dim.chunks[{x, y}];
+      chunk.coord = {x, y};
+      set_chunk_uniform(chunk, y == 1 ? Cell_Type::WATER : Cell_Type::AIR);
+      make_chunk_writable(chunk);
+    }
+  }
+  Chunk &sand = dim.chunks[{0, 0}];
+  fill_cells(sand, 0, CHUNK_CELL_WIDTH, Cell_Type::SAND);
+  set_cell_type(sand, sand.cells[CHUNK_CELL_WIDTH * 2], Cell_Type::WATER);
+  EXPECT_EQ(sand.all_cell, Cell_Type::NONE);
+
+  std::srand(7);
+  for (int step = 0; step < 20; step++) {
+    std::vector<Cell_Count_Change> deferred;
+    for (s32 y = -1; y <= 1; y++) {
+      update_cells_chunk(dim, dim.chunks[{0, y}], deferred);
+    }
+    for (const Cell_Count_Change &change : deferred) {
+      count_cell_change(*change.chunk, change.cell_index, change.removed,
+                        change.added);
+    }
+  }
+
+  for (const auto &[coord, chunk] : dim.chunks) {
+    u16 counts[CELL_TYPE_COUNT] = {};
+    Cell_Class_Rows classes = {};
+    for (u32 cell = 0; cell < CHUNK_CELLS; cell++) {
+      Cell_Type type = chunk.cells[cell].type;
+      counts[(u16)type]++;
+      for (u8 cell_class = 0; cell_class < CELL_CLASS_COUNT; cell_class++) {
+        if (CELL_CLASS_TYPES[cell_class] & cell_type_bit(type)) {
+          classes.rows[cell_class][cell / CHUNK_CELL_WIDTH] |=
+              static_cast<u64>(1) << (cell % CHUNK_CELL_WIDTH);
+        }
+      }
+    }
+    for (u8 cell_class = 0; cell_class < CELL_CLASS_COUNT; cell_class++) {
+      for (u16 y = 0; y < CHUNK_CELL_WIDTH; y++) {
+        ASSERT_EQ(chunk.classes.rows[cell_class][y],
+                  classes.rows[cell_class][y])
+            << "chunk " << coord.x << ", " << coord.y << " row " << y;
+      }
+    }
+
+    Cell_Type all_cell = Cell_Type::NONE;
+    for (u16 type = 0; type < CELL_TYPE_COUNT; type++) {
+      ASSERT_EQ(chunk.cell_counts[type], counts[type])
+          << "chunk " << coord.x << ", " << coord.y << " type " << type;
+      if (counts[type] == CHUNK_CELLS) {
+        all_cell = static_cast<Cell_Type>(type);
+      }
+    }
+    EXPECT_EQ(chunk.all_cell, all_cell);
+  }
+
+  Region_Cell_Counts region;
+  count_region_cells(dim, {-1, -1}, {2, 2}, region);
+  EXPECT_EQ(region.chunks, 9u);
+  EXPECT_EQ(region.counts[(u16)Cell_Type::WATER], CHUNK_CELLS * 3u + 1);
+  EXPECT_EQ(region.counts[(u16)Cell_Type::SAND], CHUNK_CELL_WIDTH);
+
+  count_region_cells(dim, {5, 5}, {8, 8}, region);
+  EXPECT_EQ(region.chunks, 0u);
+}
+
+// Cell by cell, with none of raycast's chunk skipping
+bool walk_ray_cells(Dimension &dim, const Ray &ray, Cell_Type_Mask mask,
+                    s64 &hit_x, s64 &hit_y) {
+  f64 dx = ray.to.x - ray.from.x, dy = ray.to.y - ray.from.y;
+  f64 length = std::sqrt(dx * dx + dy * dy);
+  s64 x = std::floor(ray.from.x), y = std::floor(ray.from.y);
+  s8 step_x = dx > 0 ? 1 : -1, step_y = dy > 0 ? 1 : -1;
+  f64 t_delta_x = dx == 0 ? INFINITY : length / std::abs(dx);
+  f64 t_delta_y = dy == 0 ? INFINITY : length / std::abs(dy);
+  f64 t_max_x = dx == 0 ? INFINITY
+                        : (dx > 0 ? x + 1 - ray.from.x : ray.from.x - x) *
+                              t_delta_x;
+  f64 t_max_y = dy == 0 ? INFINITY
+                        : (dy > 0 ? y + 1 - ray.from.y : ray.from.y - y) *
+                              t_delta_y;
+
+  for (f64 t = 0; t <= length;) {
+    Cell *cell = get_cell_at_world_pos(dim, x, y);
+    if (cell != nullptr && (mask & cell_type_bit(cell->type))) {
+      hit_x = x;
+      hit_y = y;
+      return true;
+    }
+    if (t_max_x < t_max_y) {
+      t = t_max_x;
+      t_max_x += t_delta_x;
+      x += step_x;
+    } else {
+      t = t_max_y;
+      t_max_y += t_delta_y;
+      y += step_y;
+    }
+  }
+  return false;
+}
+
+TEST(Raycast, MatchesCellWalk) {
+  // Dirt under air with a rough band of both between and some water and
+  // unloaded chunks to cross
+  Dimension dim = {};
+  std::mt19937 rng(11);
+  for (s32 x = -4; x < 4; x++) {
+    for (s32 y = -4; y < 4; y++) {
+      if (x == 2 && y >= 0) {
+        continue;
+      }
+
+      Chunk &chunk = dim.chunks[{x, y}];
+      chunk.coord = {x, y};
+      if (y < -1) {
+        set_chunk_uniform(chunk, Cell_Type::DIRT);
+      } else if (y == -1) {
+        alloc_chunk_cells(chunk);
+        for (u32 cell = 0; cell < CHUNK_CELLS; cell += 16) {
+          fill_cells(chunk, cell, 16,
+                     rng() % 3 == 0 ? Cell_Type::DIRT : Cell_Type::AIR);
+        }
+      } else {
+        set_chunk_uniform(chunk, x == -4 ? Cell_Type::WATER : Cell_Type::AIR);
+      }
+    }
+  }
+
+  std::uniform_real_distribution<f64> coord(-4.0 * CHUNK_CELL_WIDTH,
+                                            4.0 * CHUNK_CELL_WIDTH);
+  std::vector<Ray> rays(20000);
+  for (Ray &ray : rays) {
+    ray = {{coord(rng), coord(rng)}, {coord(rng), coord(rng)}};
+  }
+  rays[0] = {{10.5, 100.5}, {10.5, -300.0}};  // Straight down
+  rays[1] = {{-200.0, 50.0}, {-200.0, 50.0}};  // Goes nowhere
+
+  ThreadPool pool(4);
+  std::vector<Raycast_Hit> hits;
+  auto start = std::chrono::steady_clock::now();
+  raycast_batch(dim, rays, SOLID_CELL_MASK, hits, &pool);
+  std::chrono::duration<f64> took = std::chrono::steady_clock::now() - start;
+  RecordProperty("rays_per_second",
+                 std::to_string(static_cast<u64>(rays.size() / took.count())));
+
+  ASSERT_EQ(hits.size(), rays.size());
+  EXPECT_TRUE(hits[0].hit);
+  EXPECT_EQ(hits[0].x, 10);
+  EXPECT_FALSE(hits[1].hit);
+
+  for (size_t ray = 0; ray < rays.size(); ray++) {
+    s64 hit_x = 0, hit_y = 0;
+    bool hit = walk_ray_cells(dim, rays[ray], SOLID_CELL_MASK, hit_x, hit_y);
+    ASSERT_EQ(hits[ray].hit, hit) << "ray " << ray;
+    if (hit) {
+      ASSERT_EQ(hits[ray].x, hit_x) << "ray " << ray;
+      ASSERT_EQ(hits[ray].y, hit_y) << "ray " << ray;
+      EXPECT_EQ(hits[ray].type, Cell_Type::DIRT);
+    }
+  }
+}
+
+TEST(EntitySet, ErasingKeepsItPacked) {
+  Entity_Set set;
+  for (Entity_ID id : {5u, 90u, 3u, 17u}) {
+    EXPECT_TRUE(set.insert(id));
+  }
+  EXPECT_FALSE(set.insert(90));
+  EXPECT_EQ(set.size(), 4u);
+
+  EXPECT_TRUE(set.erase(5));
+  EXPECT_FALSE(set.erase(5));
+  EXPECT_FALSE(set.erase(1000));
+  EXPECT_FALSE(set.contains(5));
+
+  std::vector<Entity_ID> ids(set.begin(), set.end());
+  std::sort(ids.begin(), ids.end());
+  EXPECT_EQ(ids, (std::vector<Entity_ID>{3, 17, 90}));
+  for (Entity_ID id : ids) {
+    EXPECT_TRUE(set.contains(id));
+  }
+
+  set.clear();
+  EXPECT_TRUE(set.empty());
+  EXPECT_FALSE(set.contains(17));
+  EXPECT_TRUE(set.insert(17));
+}
+
+TEST(RenderRegistry, KeepsLayerOrder) {
+  Render_Registry registry;
+  for (Entity_ID id = 0; id < 100; id++) {
+    EXPECT_TRUE(registry.insert(id, id % 2 == 0 ? -3 : 5));
+  }
+  EXPECT_FALSE(registry.insert(10, 0));
+
+  // Enough to make the even layer get packed
+  for (Entity_ID id = 0; id < 80; id += 2) {
+    EXPECT_TRUE(registry.erase(id));
+  }
+  EXPECT_FALSE(registry.erase(0));
+  EXPECT_EQ(registry.size(), 60u);
+
+  std::vector<Entity_ID> drawn;
+  registry.for_each(INT8_MIN, INT8_MAX,
+                    [&](Entity_ID id) { drawn.push_back(id); });
+  std::vector<Entity_ID> expected;
+  for (Entity_ID id = 80; id < 100; id += 2) {
+    expected.push_back(id);
+  }
+  for (Entity_ID id = 1; id < 100; id += 2) {
+    expected.push_back(id);
+  }
+  EXPECT_EQ(drawn, expected);
+
+  drawn.clear();
+  registry.for_each(0, INT8_MAX, [&](Entity_ID id) { drawn.push_back(id); });
+  EXPECT_EQ(drawn.size(), 50u);
+
+  // Erased ids can come back on another layer
+  EXPECT_TRUE(registry.insert(4, 7));
+  EXPECT_TRUE(registry.contains(4));
+}
+
+TEST(DeleteEntity, LeavesNoRegistryBehind) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+
+  std::vector<Entity_ID> ids;
+  ASSERT_EQ(spawn_entities(
+                *update_state, DimensionIndex::OVERWORLD,
+                {{Entity_Factory_Type::GUYPLAYER, {5.0, 5.0}, {}},
+                 {Entity_Factory_Type::JELLYFISH, {6.0, 5.0}, {}}},
+                &ids),
+            Result::SUCCESS);
+  dim.contacts.push_back({ids[0], ids[1], 0});
+
+  for (Entity_ID id : ids) {
+    delete_entity(*update_state, dim, id);
+    EXPECT_FALSE(dim.entity_indicies.contains(id));
+    EXPECT_FALSE(dim.e_kinetic.contains(id));
+    EXPECT_FALSE(dim.e_health.contains(id));
+    EXPECT_FALSE(dim.e_ai.contains(id));
+    EXPECT_FALSE(dim.e_render.contains(id));
+    EXPECT_FALSE(dim.e_grid.contains(id));
+  }
+  EXPECT_TRUE(dim.contacts.empty());
+  EXPECT_EQ(dim.e_render.size(), 0u);
+  EXPECT_EQ(update_state->entity_id_pool.size(), 0u);
+
+  // Deleting again is harmless
+  delete_entity(*update_state, dim, ids[0]);
+  EXPECT_EQ(update_state->entity_id_pool.size(), 0u);
+}
+
+TEST(EntityIDPool, RecycledIdsAreStale) {
+  Entity_ID_Pool pool;
+  Entity_ID first, second;
+  ASSERT_EQ(pool.take(first), Result::SUCCESS);
+  ASSERT_EQ(pool.take(second), Result::SUCCESS);
+  EXPECT_NE(first, 0u);
+  EXPECT_NE(first, second);
+
+  Entity_Handle old_handle = pool.get_handle(first);
+  EXPECT_TRUE(pool.is_live(old_handle));
+  pool.release(first);
+  pool.release(first);
+  EXPECT_EQ(pool.size(), 1u);
+  EXPECT_FALSE(pool.is_live(old_handle));
+
+  // Released ids are reused, but old handles to them stay stale
+  Entity_ID reused;
+  ASSERT_EQ(pool.take(reused), Result::SUCCESS);
+  EXPECT_EQ(reused, first);
+  EXPECT_FALSE(pool.is_live(old_handle));
+  EXPECT_TRUE(pool.is_live(pool.get_handle(reused)));
+
+  std::vector<Entity_ID> ids;
+  EXPECT_EQ(pool.take(DEFAULT_MAX_ENTITIES, ids), Result::ENTITY_POOL_FULL);
+  EXPECT_TRUE(ids.empty());
+  ASSERT_EQ(pool.take(DEFAULT_MAX_ENTITIES - 3, ids), Result::SUCCESS);
+  EXPECT_EQ(pool.occupancy(), 1.0f);
+  EXPECT_EQ(pool.take(reused), Result::ENTITY_POOL_FULL);
+
+  // Too small to hand out anything
+  Entity_ID_Pool tiny;
+  tiny.set_capacity(1);
+  EXPECT_EQ(tiny.occupancy(), 1.0f);
+  EXPECT_EQ(tiny.take(reused), Result::ENTITY_POOL_FULL);
+}
+
+TEST(EntityStorage, RefsWriteThroughToColumns) {
+  Entity_Storage storage;
+  EXPECT_EQ(storage.page_count(), 0u);
+
+  Entity e = default_entity();
+  e.coord = {3.5, -2.0};
+  e.vx = 1.0f;
+  e.boundingw = 4.0f;
+  e.health = 20;
+  e.texture = Texture_Id::TREE;
+  storage.add(9);
+  storage.store(9, e);
+
+  Entity_Ref ref = storage[9];
+  EXPECT_EQ(ref.coord.x, 3.5);
+  EXPECT_EQ(ref.texture, Texture_Id::TREE);
+  ref.coord.y += 1.0;
+  ref.vx = 2.0f;
+  ref.health -= 5;
+
+  const Entity_Page &page = storage.get_page(9);
+  EXPECT_EQ(page.coord[9].y, -1.0);
+  EXPECT_EQ(page.vx[9], 2.0f);
+  EXPECT_EQ(page.cold[9].health, 15);
+
+  Entity loaded = storage.load(9);
+  EXPECT_EQ(loaded.boundingw, 4.0f);
+  EXPECT_EQ(loaded.vx, 2.0f);
+  EXPECT_EQ(loaded.health, 15);
+
+  // Pages come and go with the ids in them, and don't move in between
+  Entity_ID far_id = ENTITY_PAGE_SIZE * 40 + 3;
+  storage.add(far_id);
+  storage.add(10);
+  EXPECT_EQ(storage.page_count(), 2u);
+  EXPECT_EQ(&storage.get_page(9), &page);
+  EXPECT_EQ(storage[10].coord.x, 0.0);
+
+  storage.remove(9);
+  EXPECT_EQ(storage.page_count(), 2u);
+  storage.remove(10);
+  EXPECT_EQ(storage.page_count(), 1u);
+  storage.remove(far_id);
+  EXPECT_EQ(storage.page_count(), 0u);
+}
+
+TEST(EntityGrid, QueriesMatchScan) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<f64> spread(-500.0, 500.0);
+  std::vector<Entity_Spawn> spawns;
+  for (u32 i = 0; i < 2000; i++) {
+    spawns.push_back(
+        {Entity_Factory_Type::BUSH, {spread(rng), spread(rng)}, {}});
+  }
+  std::vector<Entity_ID> ids;
+  ASSERT_EQ(spawn_entities(*update_state, DimensionIndex::OVERWORLD, spawns,
+                           &ids),
+            Result::SUCCESS);
+
+  // Move some across chunk borders and delete some
+  for (size_t i = 0; i < ids.size(); i += 3) {
+    Entity_Ref e = update_state->entities[ids[i]];
+    Chunk_Coord last_cc = get_chunk_coord(e.coord.x, e.coord.y);
+    e.coord.x += 150.0;
+    mark_entity_chunk_change(dim, ids[i], last_cc, e.coord);
+  }
+  for (size_t i = 0; i < ids.size(); i += 7) {
+    delete_entity(*update_state, dim, ids[i]);
+  }
+
+  Entity_Coord min = {-120.5, -40.0}, max = {260.0, 75.25};
+  Entity_Coord center = {33.0, -17.0};
+  f64 radius = 140.0;
+  std::vector<Entity_ID> expected_box, expected_radius;
+  for (Entity_ID id : dim.entity_indicies) {
+    Entity_Ref e = update_state->entities[id];
+    if (e.coord.x >= min.x && e.coord.x <= max.x && e.coord.y >= min.y &&
+        e.coord.y <= max.y) {
+      expected_box.push_back(id);
+    }
+    f64 dx = e.coord.x - center.x, dy = e.coord.y - center.y;
+    if (dx * dx + dy * dy <= radius * radius) {
+      expected_radius.push_back(id);
+    }
+  }
+
+  std::vector<Entity_ID> box, in_radius;
+  find_entities_in_box(*update_state, dim, min, max, box);
+  find_entities_in_radius(*update_state, dim, center, radius, in_radius);
+  std::sort(box.begin(), box.end());
+  std::sort(in_radius.begin(), in_radius.end());
+  std::sort(expected_box.begin(), expected_box.end());
+  std::sort(expected_radius.begin(), expected_radius.end());
+  EXPECT_FALSE(expected_box.empty());
+  EXPECT_EQ(box, expected_box);
+  EXPECT_EQ(in_radius, expected_radius);
+}
+
+TEST(EntityCollision, PairsPushedApart) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+
+  // Pairs of jellyfish that overlap each other and nothing else, strung out
+  // along the world like they would be
+  constexpr u32 PAIRS = 2000;
+  std::vector<Entity_Spawn> spawns;
+  for (u32 i = 0; i < PAIRS; i++) {
+    f64 x = i * 150.0, y = (i % 7) * 30.0;
+    spawns.push_back({Entity_Factory_Type::JELLYFISH, {x, y}, {}});
+    spawns.push_back(
+        {Entity_Factory_Type::JELLYFISH, {x + 30.0, y - 10.0}, {}});
+  }
+  std::vector<Entity_ID> ids;
+  ASSERT_EQ(spawn_entities(*update_state, DimensionIndex::OVERWORLD, spawns,
+                           &ids),
+            Result::SUCCESS);
+
+  auto start = std::chrono::steady_clock::now();
+  collide_entities(*update_state, dim);
+  std::chrono::duration<f64> took = std::chrono::steady_clock::now() - start;
+  RecordProperty("collide_microseconds",
+                 std::to_string(static_cast<u64>(took.count() * 1e6)));
+
+  ASSERT_EQ(dim.contacts.size(), PAIRS);
+  std::set<std::pair<Entity_ID, Entity_ID>> pairs;
+  for (const Entity_Contact &contact : dim.contacts) {
+    pairs.insert(std::minmax(contact.a, contact.b));
+    EXPECT_EQ(contact.top, 0u);
+  }
+  for (u32 i = 0; i < PAIRS; i++) {
+    EXPECT_TRUE(pairs.count(std::minmax(ids[i * 2], ids[i * 2 + 1])));
+  }
+
+  // The first pair only overlapped by 20 cells across, so it's pushed apart
+  // that way
+  Entity_Ref left = update_state->entities[ids[0]];
+  Entity_Ref right = update_state->entities[ids[1]];
+  EXPECT_EQ(left.coord.x, -10.0);
+  EXPECT_EQ(right.coord.x, 40.0);
+  EXPECT_EQ(right.coord.x - left.coord.x, left.boundingw);
+
+  // Contacts hurt whatever can be hurt, and deleting an entity drops its
+  // contacts
+  dim.e_health.insert(ids[0]);
+  update_state->entities[ids[0]].max_health = 100;
+  update_state->entities[ids[0]].health = 100;
+  update_health(*update_state);
+  s64 hurt_health = 100 - update_state->entities[ids[1]].contact_damage;
+  EXPECT_EQ(update_state->entities[ids[0]].health, hurt_health);
+
+  // Staying in contact doesn't hurt again until the cooldown's over
+  update_state->frame += CONTACT_DAMAGE_COOLDOWN - 1;
+  update_health(*update_state);
+  EXPECT_EQ(update_state->entities[ids[0]].health, hurt_health);
+  update_state->frame++;
+  update_health(*update_state);
+  EXPECT_EQ(update_state->entities[ids[0]].health,
+            hurt_health - update_state->entities[ids[1]].contact_damage);
+  delete_entity(*update_state, dim, ids[1]);
+  EXPECT_EQ(dim.contacts.size(), PAIRS - 1);
+}
+
+TEST(CellCollision, LandsAcrossChunkBorders) {
+  std::unique_ptr<Update_State> update_state = make_gen_state(0);
+  Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+
+  // A dirt floor with its top at y 0, and the player dropped onto it
+  // straddling chunk x 0
+  for (s32 x = -1; x <= 0; x++) {
+    for (s32 y = -1; y <= 0; y++) {
+      Chunk &chunk = dim.chunks[{x, y}];
+      chunk.coord = {x, y};
+      set_chunk_uniform(chunk, y == -1 ? Cell_Type::DIRT : Cell_Type::AIR);
+    }
+  }
+
+  Entity_ID id;
+  ASSERT_EQ(create_entity(*update_state, DimensionIndex::OVERWORLD,
+                          Entity_Factory_Type::GUYPLAYER, id),
+            Result::SUCCESS);
+  Entity_Ref player = update_state->entities[id];
+  player.coord = {-5.0, player.boundingh + 20.0};
+
+  for (int step = 0; step < 120; step++) {
+    update_kinetic(*update_state);
+  }
+
+  EXPECT_TRUE(player.status & (u16)Entity_Status::ON_GROUND);
+  f64 bottom = player.coord.y - player.boundingh;
+  EXPECT_GT(bottom, -1.0);
+  EXPECT_LT(bottom, 1.0);
+}
+
+TEST(KineticStep, PoolMatchesSerial) {
+  // A school of fish falling through water onto a sand floor, stepped with
+  // and without the pool. They're spaced out so they don't pile up.
+  std::unique_ptr<Update_State> states[2] = {make_gen_state(0),
+                                             make_gen_state(0)};
+  ThreadPool pool(4);
+  states[1]->thread_pool = &pool;
+
+  constexpr u32 COLUMNS = 64, ROWS = 32;
+  for (std::unique_ptr<Update_State> &update_state : states) {
+    Dimension &dim = update_state->dimensions[DimensionIndex::OVERWORLD];
+    for (s32 x = -1; x <= 111; x++) {
+      for (s32 y = -1; y <= 25; y++) {
+        Chunk &chunk = dim.chunks[{x, y}];
+        chunk.coord = {x, y};
+        set_chunk_uniform(chunk, y == -1 ? Cell_Type::SAND : Cell_Type::WATER);
+      }
+    }
+
+    std::vector<Entity_Spawn> spawns;
+    for (u32 i = 0; i < COLUMNS * ROWS; i++) {
+      spawns.push_back({Entity_Factory_Type::FISH,
+                        {(i % COLUMNS) * 110.0, (i / COLUMNS) * 50.0 + 45.0},
+                        {}});
+    }
+    std::vector<Entity_ID> ids;
+    ASSERT_EQ(spawn_entities(*update_state, DimensionIndex::OVERWORLD, spawns,
+                             &ids),
+              Result::SUCCESS);
+    for (Entity_ID id : ids) {
+      dim.e_kinetic.insert(id);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int step = 0; step < 30; step++) {
+    update_kinetic(*states[0]);
+  }
+  std::chrono::duration<f64> serial = std::chrono::steady_clock::now() - start;
+  start = std::chrono::steady_clock::now();
+  for (int step = 0; step < 30; step++) {
+    update_kinetic(*states[1]);
+  }
+  std::chrono::duration<f64> pooled = std::chrono::steady_clock::now() - start;
+  RecordProperty("serial_microseconds",
+                 std::to_string(static_cast<u64>(serial.count() * 1e6)));
+  RecordProperty("pooled_microseconds",
+                 std::to_string(static_cast<u64>(pooled.count() * 1e6)));
+
+  Dimension &serial_dim = states[0]->dimensions[DimensionIndex::OVERWORLD];
+  Dimension &pooled_dim = states[1]->dimensions[DimensionIndex::OVERWORLD];
+  ASSERT_EQ(serial_dim.e_kinetic.size(), COLUMNS * ROWS);
+  for (Entity_ID id : serial_dim.e_kinetic) {
+    Entity serial_fish = states[0]->entities.load(id);
+    Entity pooled_fish = states[1]->entities.load(id);
+    ASSERT_EQ(serial_fish.coord.x, pooled_fish.coord.x) << "fish " << id;
+    ASSERT_EQ(serial_fish.coord.y, pooled_fish.coord.y) << "fish " << id;
+    ASSERT_EQ(serial_fish.status, pooled_fish.status) << "fish " << id;
+
+    // Still in the right grid bucket
+    std::vector<Entity_ID> found;
+    find_entities_in_box(*states[1], pooled_dim, pooled_fish.coord,
+                         pooled_fish.coord, found);
+    EXPECT_NE(std::find(found.begin(), found.end(), id), found.end());
+  }
+}
 }  // namespace VV